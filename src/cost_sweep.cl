@@ -0,0 +1,306 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+// Grey values summed together in the block sums of the horizontal window
+#define BLOCK 8
+
+/*
+@brief Index of a pixel in a BORDER_REFLECT_101 border, as cv::borderInterpolate
+@param p index, possibly outside the image
+@param len size of the image in this dimension
+*/
+inline int reflect101(int p, int len)
+{
+	if (len == 1)
+		return 0;
+	while (p < 0 || p >= len)
+		p = p < 0 ? -p : 2 * len - 2 - p;
+	return p;
+}
+
+/*
+@brief First restoration step of a channel: I - tau * I translated by d0, where the translation is defined
+@param row interleaved colour row
+@param lut x * tau with saturation
+*/
+inline uchar restoreFirst(__global const uchar * row, int cols, int x, int c, int d0, __constant uchar * lut)
+{
+	uchar value = row[x * 3 + c];
+	return x - d0 >= 0 && x - d0 < cols ? sub_sat(value, lut[row[(x - d0) * 3 + c]]) : value;
+}
+
+/*
+@brief Two-step restoration of a channel, as CostSweep::restorePixel
+@param d translations by the disparity and by twice the disparity
+@param lut x * tau followed by x * tau^2, with saturation
+*/
+inline uchar restorePixel(__global const uchar * row, int cols, int x, int c, int2 d, __constant uchar * lut)
+{
+	uchar first = restoreFirst(row, cols, x, c, d.x, lut);
+	int x_shifted = x - d.y;
+	if (x_shifted < 0 || x_shifted >= cols)
+		return first;
+	return add_sat(first, lut[256 + restoreFirst(row, cols, x_shifted, c, d.x, lut)]);
+}
+
+/*
+@brief Sum of the grey values [begin, end), whole blocks from their block sums
+*/
+inline int windowSum(__local const uchar * grey, __local const int * block_sum, int begin, int end)
+{
+	int first_block = (begin + BLOCK - 1) / BLOCK, last_block = end / BLOCK;
+	int sum = 0;
+	if (first_block >= last_block)
+	{
+		for (int i = begin; i < end; i++)
+			sum += grey[i];
+		return sum;
+	}
+	for (int i = begin; i < first_block * BLOCK; i++)
+		sum += grey[i];
+	for (int b = first_block; b < last_block; b++)
+		sum += block_sum[b];
+	for (int i = last_block * BLOCK; i < end; i++)
+		sum += grey[i];
+	return sum;
+}
+
+/*
+@brief Depth candidate sweep of the colour cost, as the cv:: chain of DepthEstimator::reconstructDepthAndColour. 
+A work-group evaluates all the candidates on a tile of tile_rows rows and one column per work-item: 
+for each candidate, the rows of the tile and of its vertical window are restored, 
+converted to a grey gradient and aggregated one after the other in local memory, 
+and the winner of each pixel is kept in local memory until the last candidate. 
+Only the labels, the extreme costs and the colour restored with the winning candidate are written
+@param src rectified image (CV_8UC3)
+@param labels winning candidate + 1 (CV_8UC1)
+@param min_cost cost of the winner (CV_8UC1)
+@param max_cost largest cost of the candidates (CV_8UC1)
+@param dst colour restored with the winning candidate (CV_8UC3)
+@param lower_cost cost of the candidate before the winner, -1 for none (CV_16SC1), written if subpixel
+@param upper_cost cost of the candidate after the winner, -1 for none (CV_16SC1), written if subpixel
+@param shifts translations by the disparity and by twice the disparity of each candidate
+@param z_count number of candidates
+@param lut x * tau followed by x * tau^2, with saturation
+@param inv_win_size reciprocal giving the rounded window mean by truncation, see CostSweep
+@param radius radius of the aggregation window
+@param tile_rows rows of a tile
+@param subpixel non-zero to write the costs of the neighbours of the winner
+@param restored three restored rows, 3 * 3 * (tile columns + 2 * radius + 2)
+@param grey grey gradient of a row, tile columns + 2 * radius rounded up to BLOCK
+@param block_sum sums of BLOCK grey values
+@param ring aggregated rows of the vertical window, (2 * radius + 1) * tile columns
+@param state winning cost, largest cost, label, and the cost of the previous candidate if subpixel, 
+(3 or 4) * tile_rows * tile columns
+@param neighbours costs of the candidates before and after the winner, 2 * tile_rows * tile columns if subpixel
+*/
+__kernel void costSweep(__global const uchar * src, int src_step, int src_offset,
+	__global uchar * labels, int labels_step, int labels_offset, int rows, int cols,
+	__global uchar * min_cost, int min_step, int min_offset,
+	__global uchar * max_cost, int max_step, int max_offset,
+	__global uchar * dst, int dst_step, int dst_offset,
+	__global uchar * lower_cost, int lower_step, int lower_offset,
+	__global uchar * upper_cost, int upper_step, int upper_offset,
+	__constant int2 * shifts, int z_count, __constant uchar * lut, float inv_win_size, 
+	int radius, int tile_rows, int subpixel,
+	__local uchar * restored, __local uchar * grey, __local int * block_sum, __local uchar * ring, 
+	__local uchar * state, __local short * neighbours)
+{
+	const int lid = get_local_id(0), tile_cols = get_local_size(0);
+	const int x0 = get_group_id(0) * tile_cols, y0 = get_group_id(1) * tile_rows, x = x0 + lid;
+	const int width = min(tile_cols, cols - x0), height = min(tile_rows, rows - y0);
+	const int win_size = 2 * radius + 1, tile_size = tile_rows * tile_cols;
+
+	// Restored columns [x0 - radius - 1, x0 + width + radius + 1), grey columns [x0 - radius, x0 + width + radius)
+	const int restored_begin = x0 - radius - 1, restored_width = tile_cols + 2 * radius + 2;
+	const int grey_width = width + 2 * radius, block_count = (grey_width + BLOCK - 1) / BLOCK;
+
+	__local uchar * tile_min = state;
+	__local uchar * tile_max = state + tile_size;
+	__local uchar * tile_label = state + 2 * tile_size;
+	__local uchar * tile_previous = state + 3 * tile_size;
+	__local short * tile_lower = neighbours;
+	__local short * tile_upper = neighbours + tile_size;
+
+	for (int z = 0; z < z_count; z++)
+	{
+		const int2 d = shifts[z];
+		// Image rows held by the restored slots, the same in all the work-items
+		int tags[3] = { -1, -1, -1 };
+		int col_sum = radius;
+
+		// Aggregated rows of the tile and of its vertical window
+		for (int k = 0; k < height + 2 * radius; k++)
+		{
+			const int y_aggregated = reflect101(y0 - radius + k, rows);
+			int needed[3] = { reflect101(y_aggregated - 1, rows), y_aggregated, reflect101(y_aggregated + 1, rows) };
+			int slots[3];
+
+			// Restore the rows of the gradient missing from the slots
+			barrier(CLK_LOCAL_MEM_FENCE);
+			for (int n = 0; n < 3; n++)
+			{
+				int slot = -1;
+				for (int s = 0; s < 3; s++)
+				{
+					if (tags[s] == needed[n])
+						slot = s;
+				}
+				if (slot < 0)
+				{
+					for (int s = 0; s < 3; s++)
+					{
+						if (tags[s] != needed[0] && tags[s] != needed[1] && tags[s] != needed[2])
+							slot = s;
+					}
+					tags[slot] = needed[n];
+					__global const uchar * row = src + mad24(needed[n], src_step, src_offset);
+					__local uchar * restored_row = restored + slot * 3 * restored_width;
+					for (int i = lid; i < restored_width; i += tile_cols)
+					{
+						int xr = restored_begin + i;
+						if (xr >= 0 && xr < cols)
+						{
+							for (int c = 0; c < 3; c++)
+								restored_row[c * restored_width + i] = restorePixel(row, cols, xr, c, d, lut);
+						}
+					}
+				}
+				slots[n] = slot;
+			}
+			barrier(CLK_LOCAL_MEM_FENCE);
+
+			// Grey gradient magnitude, 0 on the first and last columns as with filter2D
+			for (int i = lid; i < grey_width; i += tile_cols)
+			{
+				int xg = reflect101(x0 - radius + i, cols);
+				uchar value = 0;
+				if (xg > 0 && xg < cols - 1)
+				{
+					int j = xg - restored_begin, gradient[3];
+					for (int c = 0; c < 3; c++)
+					{
+						__local const uchar * prev = restored + slots[0] * 3 * restored_width + c * restored_width + j;
+						__local const uchar * curr = restored + slots[1] * 3 * restored_width + c * restored_width + j;
+						__local const uchar * next = restored + slots[2] * 3 * restored_width + c * restored_width + j;
+						gradient[c] = (int)min(abs(6 * (prev[1] - prev[-1]) + 20 * (curr[1] - curr[-1]) + 6 * (next[1] - next[-1])), 255u);
+					}
+					value = (uchar)((gradient[0] * 4899 + gradient[1] * 9617 + gradient[2] * 1868 + 8192) >> 14);
+				}
+				grey[i] = value;
+			}
+			barrier(CLK_LOCAL_MEM_FENCE);
+
+			for (int b = lid; b < block_count; b += tile_cols)
+			{
+				int sum = 0;
+				for (int i = b * BLOCK; i < min(grey_width, (b + 1) * BLOCK); i++)
+					sum += grey[i];
+				block_sum[b] = sum;
+			}
+			barrier(CLK_LOCAL_MEM_FENCE);
+
+			if (lid < width)
+			{
+				// Horizontal then vertical window means, rounded as the 8-bit box filters
+				uchar aggregated = (uchar)(int)((float)(radius + windowSum(grey, block_sum, lid, lid + win_size)) * inv_win_size);
+				__local uchar * ring_value = ring + (k % win_size) * tile_cols + lid;
+				col_sum += aggregated - (k >= win_size ? *ring_value : 0);
+				*ring_value = aggregated;
+				if (k >= 2 * radius)
+				{
+					// Winner selection, a later candidate wins ties
+					int p = (k - 2 * radius) * tile_cols + lid;
+					uchar cost = (uchar)(int)((float)col_sum * inv_win_size);
+					if (z == 0)
+					{
+						tile_min[p] = cost;
+						tile_max[p] = cost;
+						tile_label[p] = 1;
+						if (subpixel)
+						{
+							tile_lower[p] = -1;
+							tile_upper[p] = -1;
+						}
+					}
+					else
+					{
+						bool best = cost <= tile_min[p];
+						if (subpixel)
+						{
+							// The current candidate is above the pixels won by the previous one, 
+							// and a new winner has the previous candidate below it
+							if (tile_label[p] == z)
+								tile_upper[p] = cost;
+							if (best)
+							{
+								tile_lower[p] = tile_previous[p];
+								tile_upper[p] = -1;
+							}
+						}
+						if (best)
+						{
+							tile_min[p] = cost;
+							tile_label[p] = z + 1;
+						}
+						tile_max[p] = max(tile_max[p], cost);
+					}
+					if (subpixel)
+						tile_previous[p] = cost;
+				}
+			}
+		}
+	}
+
+	// Outputs of the column, with the colour restored once with the winner
+	if (lid < width)
+	{
+		for (int r = 0; r < height; r++)
+		{
+			int y = y0 + r, p = r * tile_cols + lid;
+			uchar label = tile_label[p];
+			labels[mad24(y, labels_step, labels_offset + x)] = label;
+			min_cost[mad24(y, min_step, min_offset + x)] = tile_min[p];
+			max_cost[mad24(y, max_step, max_offset + x)] = tile_max[p];
+			__global const uchar * row = src + mad24(y, src_step, src_offset);
+			__global uchar * colour = dst + mad24(y, dst_step, mad24(x, 3, dst_offset));
+			for (int c = 0; c < 3; c++)
+				colour[c] = restorePixel(row, cols, x, c, shifts[label - 1], lut);
+			if (subpixel)
+			{
+				*(__global short *)(lower_cost + mad24(y, lower_step, mad24(x, 2, lower_offset))) = tile_lower[p];
+				*(__global short *)(upper_cost + mad24(y, upper_step, mad24(x, 2, upper_offset))) = tile_upper[p];
+			}
+		}
+	}
+}
@@ -0,0 +1,1186 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include "cost_sweep.h"
+
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iterator>
+
+CostSweep::CostSweep(std::vector<float> const & disparities, float tau, int winSize) :
+	m_winSize(winSize),
+	m_radius(winSize / 2)
+{
+	CV_Assert(winSize % 2 == 1 && disparities.size() < 256);
+
+	// tauLocal *= tauLocal in restoreImage
+	setTauScale(tau, m_tauScale);
+	setTauScale(tau * tau, m_tau2Scale);
+
+	// Normalised 8-bit box filter. The window size is odd: the mean is never halfway between integers
+	// and the rounded mean is (sum + radius) / winSize. Find a float reciprocal that gives it by truncation
+	m_invWinSize = 1.f / float(m_winSize);
+	for (int pass(0); pass < 2; pass++)
+	{
+		for (int sum(m_radius); sum <= 255 * m_winSize + m_radius; sum++)
+		{
+			while (int(float(sum) * m_invWinSize) < sum / m_winSize)
+			{
+				m_invWinSize = std::nextafter(m_invWinSize, 1.f);
+			}
+		}
+	}
+	for (int sum(m_radius); sum <= 255 * m_winSize + m_radius; sum++)
+	{
+		CV_Assert(int(float(sum) * m_invWinSize) == sum / m_winSize);
+	}
+
+	m_restoredCount = m_radius + 3;
+	m_aggregatedCount = m_winSize + 1;
+	setDisparities(disparities);
+}
+
+void CostSweep::setDisparities(std::vector<float> const & disparities)
+{
+	CV_Assert(disparities.size() < 256);
+	m_disparities = disparities;
+
+	// The restoration of x reads x - d and x - 2d - d
+	m_minShift = 0;
+	m_maxShift = 0;
+	for (size_t zInd(0); zInd < m_disparities.size(); zInd++)
+	{
+		int d0(translation(m_disparities[zInd])), d1(translation(2.f * m_disparities[zInd]));
+		m_minShift = std::min(m_minShift, std::min(std::min(d0, d1), d0 + d1));
+		m_maxShift = std::max(m_maxShift, std::max(std::max(d0, d1), d0 + d1));
+	}
+
+	// Labels of the previous frame refer to the former candidates
+	resetTemporalSearch();
+	m_tileCandidates.clear();
+}
+
+int CostSweep::translation(float disparity)
+{
+	if (disparity < 0)
+		return int(disparity - 0.5);
+	return int(disparity + 0.5);
+}
+
+void CostSweep::getKernelTables(cv::Mat & translations, cv::Mat & tauScales, float & invWinSize) const
+{
+	translations.create(1, int(m_disparities.size()), CV_32SC2);
+	for (size_t zInd(0); zInd < m_disparities.size(); zInd++)
+	{
+		translations.at<cv::Vec2i>(0, int(zInd)) = cv::Vec2i(translation(m_disparities[zInd]), translation(2.f * m_disparities[zInd]));
+	}
+	tauScales.create(1, 512, CV_8UC1);
+	std::copy(m_tauScale.lut, m_tauScale.lut + 256, tauScales.ptr<uchar>());
+	std::copy(m_tau2Scale.lut, m_tau2Scale.lut + 256, tauScales.ptr<uchar>() + 256);
+	invWinSize = m_invWinSize;
+}
+
+void CostSweep::setTauScale(float tau, TauScale & scale)
+{
+	scale.tau = tau;
+	// Same rounding as cv::multiply on CV_8UC3 with a float scale
+	for (int i(0); i < 256; i++)
+	{
+		scale.lut[i] = cv::saturate_cast<uchar>(float(i) * tau);
+	}
+}
+
+void CostSweep::combineTranslated(const uchar * base, uchar * dst, int n, int shift, 
+	TauScale const & scale, bool add, int xBegin, int xEnd)
+{
+	// Columns covered by the translation
+	int begin(std::min(n, std::max(0, shift))), end(std::max(begin, std::min(n, n + shift)));
+	const uchar * lut(scale.lut);
+
+	// Areas the translation does not cover
+	if (xBegin < begin)
+		std::copy(base + xBegin, base + std::min(xEnd, begin), dst + xBegin);
+	if (xEnd > end)
+		std::copy(base + std::max(xBegin, end), base + xEnd, dst + std::max(xBegin, end));
+	begin = std::max(begin, xBegin);
+	end = std::min(end, xEnd);
+
+	int i(begin);
+#if CV_SIMD128
+	// Float product rounded to nearest even, saturated add and subtract, as the table
+	const cv::v_float32x4 tau(cv::v_setall_f32(scale.tau));
+	for (; i + 16 <= end; i += 16)
+	{
+		cv::v_uint16x8 t0, t1;
+		cv::v_uint32x4 t00, t01, t10, t11;
+		cv::v_expand(cv::v_load(base + i - shift), t0, t1);
+		cv::v_expand(t0, t00, t01);
+		cv::v_expand(t1, t10, t11);
+		cv::v_uint8x16 translated(cv::v_pack_u(
+			cv::v_pack(cv::v_round(cv::v_cvt_f32(cv::v_reinterpret_as_s32(t00)) * tau),
+				cv::v_round(cv::v_cvt_f32(cv::v_reinterpret_as_s32(t01)) * tau)),
+			cv::v_pack(cv::v_round(cv::v_cvt_f32(cv::v_reinterpret_as_s32(t10)) * tau),
+				cv::v_round(cv::v_cvt_f32(cv::v_reinterpret_as_s32(t11)) * tau))));
+		cv::v_uint8x16 current(cv::v_load(base + i));
+		cv::v_store(dst + i, add ? current + translated : current - translated);
+	}
+#endif
+	if (add)
+	{
+		for (; i < end; i++)
+		{
+			dst[i] = uchar(std::min(base[i] + lut[base[i - shift]], 255));
+		}
+	}
+	else
+	{
+		for (; i < end; i++)
+		{
+			dst[i] = uchar(std::max(base[i] - lut[base[i - shift]], 0));
+		}
+	}
+}
+
+void CostSweep::run(cv::Mat const & imgRectified, cv::Mat & fullDisparityMap,
+	cv::Mat & minCost, cv::Mat & maxCost, cv::Mat & reconsImgRectified, bool temporal)
+{
+	CV_Assert(imgRectified.type() == CV_8UC3 && !m_disparities.empty());
+	m_rows = imgRectified.rows;
+	m_cols = imgRectified.cols;
+	const int rows(m_rows), cols(m_cols), zCount(int(m_disparities.size()));
+
+	fullDisparityMap.create(imgRectified.size(), CV_8UC1);
+	minCost.create(imgRectified.size(), CV_8UC1);
+	maxCost.create(imgRectified.size(), CV_8UC1);
+	reconsImgRectified.create(imgRectified.size(), CV_8UC3);
+
+	// Rings hold the restored rows [y, y + radius + 2] 
+	// and the aggregated rows [y - radius, y + radius + 1] when processing the row y
+	int bandCount(std::max(1, std::min(rows, m_bandCount > 0 ? m_bandCount : cv::getNumThreads())));
+	m_bands.resize(bandCount);
+	for (int b(0); b < bandCount; b++)
+	{
+		m_bands[b].restored.resize(m_restoredCount * cols * m_costPlanes);
+		m_bands[b].firstStep.resize(cols);
+		m_bands[b].grey.resize(cols + 2 * m_radius + 1);
+		m_bands[b].rowSum.resize(cols);
+		m_bands[b].aggregated.resize(m_aggregatedCount * cols);
+		m_bands[b].colSum.resize(cols);
+		m_bands[b].best.resize(cols);
+		m_bands[b].candidateTicks.assign(m_profiling ? m_disparities.size() : 0, 0);
+	}
+
+	// Neighbour costs only come from the candidates of this run
+	if (m_subpixelFit != SUBPIXEL_NONE)
+	{
+		m_neighbours.lower.create(imgRectified.size(), CV_16SC1);
+		m_neighbours.upper.create(imgRectified.size(), CV_16SC1);
+		m_neighbours.lastCost.create(imgRectified.size(), CV_8UC1);
+		m_neighbours.lastLabel.create(imgRectified.size(), CV_8UC1);
+		m_neighbours.lastLabel.setTo(0);
+	}
+
+	// Channels are restored independently: keep them in separate rows
+	m_planar.resize(size_t(rows) * cols * m_planes);
+	cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range & range)
+	{
+		for (int y(range.start); y < range.end; y++)
+		{
+			const uchar * src(imgRectified.ptr<uchar>(y));
+			uchar * dst(&m_planar[size_t(y) * cols * m_planes]);
+			for (int x(0); x < cols; x++)
+			{
+				dst[x] = src[3 * x];
+				dst[x + cols] = src[3 * x + 1];
+				dst[x + 2 * cols] = src[3 * x + 2];
+			}
+			// Fixed-point cv::COLOR_RGB2GRAY, as the grey conversion of the colour cost
+			if (m_luma)
+			{
+				for (int x(0); x < cols; x++)
+				{
+					dst[x + 3 * cols] = uchar((src[3 * x] * 4899 + src[3 * x + 1] * 9617 + src[3 * x + 2] * 1868 
+						+ (1 << 13)) >> 14);
+				}
+			}
+		}
+	});
+
+	// Temporal search from the previous frame, unless a refresh is due
+	bool previous(temporal && m_temporalWindow > 0 && m_previousLabels.size() == imgRectified.size()
+		&& m_previousPlanar.size() == m_planar.size() 
+		&& (m_refreshPeriod <= 0 || m_framesSinceRefresh < m_refreshPeriod));
+	if (previous)
+	{
+		if (m_gateThresh >= 0)
+			computeGate();
+		selectTemporalTiles();
+		for (size_t r(0); r < m_regions.size(); r++)
+		{
+			// Stable tiles keep the worse cost of the candidates they skip
+			if (!m_regions[r].init)
+			{
+				cv::Rect const & tile(m_regions[r].area);
+				cv::Mat maxTile(maxCost(tile));
+				minCost(tile).setTo(255);
+				m_previousMaxCost(tile).copyTo(maxTile);
+			}
+		}
+		sweepRegions(fullDisparityMap, minCost, maxCost, reconsImgRectified);
+		m_framesSinceRefresh++;
+	}
+	else
+	{
+		// Full-width bands, with all candidates or the coarse ones
+		std::vector<int> candidates;
+		for (int zInd(0); zInd < zCount; zInd++)
+		{
+			if (m_stride == 1 || zInd % m_stride == 0 || zInd == zCount - 1)
+				candidates.push_back(zInd);
+		}
+		if (m_gateThresh >= 0)
+		{
+			// Flat tiles are only restored with the middle candidate
+			computeGate();
+			cv::Size tileGrid((cols + m_gateTileSize - 1) / m_gateTileSize, (rows + m_gateTileSize - 1) / m_gateTileSize);
+			double textured(0.);
+			std::vector<Region> tiles(tileGrid.area());
+			for (int t(0); t < tileGrid.area(); t++)
+			{
+				Region & region(tiles[t]);
+				region.area = cv::Rect((t % tileGrid.width) * m_gateTileSize, (t / tileGrid.width) * m_gateTileSize,
+					m_gateTileSize, m_gateTileSize) & cv::Rect(0, 0, cols, rows);
+				region.init = true;
+				region.coarse = m_stride > 1;
+				if (isTextured(region.area))
+				{
+					region.candidates = candidates;
+					textured += region.area.area();
+				}
+				else
+				{
+					region.candidates.assign(1, zCount / 2);
+				}
+			}
+			// Runs of textured tiles share their halo
+			mergeTiles(tiles, tileGrid, m_gateTileSize);
+			m_evaluatedShare = evaluatedShare(m_regions);
+			m_texturedShare = textured / (double(rows) * cols);
+		}
+		else
+		{
+			m_regions.resize(bandCount);
+			for (int b(0); b < bandCount; b++)
+			{
+				m_regions[b].area = cv::Rect(0, rows * b / bandCount, cols, rows * (b + 1) / bandCount - rows * b / bandCount);
+				m_regions[b].candidates = candidates;
+				m_regions[b].init = true;
+				m_regions[b].coarse = m_stride > 1;
+			}
+			m_evaluatedShare = evaluatedShare(m_regions);
+			m_texturedShare = 1.;
+		}
+		sweepRegions(fullDisparityMap, minCost, maxCost, reconsImgRectified);
+		m_changedShare = 1.;
+
+		if (m_stride > 1)
+		{
+			if (m_subpixelFit != SUBPIXEL_NONE)
+				keepCoarseNeighbours(fullDisparityMap);
+			refineTiles(fullDisparityMap);
+			sweepRegions(fullDisparityMap, minCost, maxCost, reconsImgRectified);
+			if (m_subpixelFit != SUBPIXEL_NONE)
+				useCoarseNeighbours(fullDisparityMap, candidates);
+		}
+		if (temporal)
+			m_framesSinceRefresh = 0;
+	}
+
+	if (m_deferredColour)
+		restoreLabels(imgRectified, fullDisparityMap, reconsImgRectified);
+	if (m_subpixelFit != SUBPIXEL_NONE)
+		fitSubpixel(fullDisparityMap, minCost, m_neighbours.lower, m_neighbours.upper, m_subpixelFit, m_subpixelLabels);
+	else
+		m_subpixelLabels.release();
+
+	// History of the next frame
+	if (temporal && m_temporalWindow > 0)
+	{
+		fullDisparityMap.copyTo(m_previousLabels);
+		minCost.copyTo(m_previousMinCost);
+		maxCost.copyTo(m_previousMaxCost);
+		m_previousPlanar.swap(m_planar);
+	}
+
+	// Bands run in parallel: their average is the wall time of a candidate
+	if (m_profiling)
+	{
+		m_candidateTimes.assign(m_disparities.size(), 0.);
+		for (int b(0); b < bandCount; b++)
+		{
+			for (size_t zInd(0); zInd < m_disparities.size(); zInd++)
+			{
+				m_candidateTimes[zInd] += 1000. * double(m_bands[b].candidateTicks[zInd]) 
+					/ (cv::getTickFrequency() * bandCount);
+			}
+		}
+	}
+}
+
+void CostSweep::refineTiles(cv::Mat const & fullDisparityMap)
+{
+	const int rows(m_rows), cols(m_cols), zCount(int(m_disparities.size()));
+	m_tileGrid = cv::Size((cols + m_tileSize - 1) / m_tileSize, (rows + m_tileSize - 1) / m_tileSize);
+	m_tileCandidates.assign(m_tileGrid.area(), std::vector<int>());
+	std::vector<Region> tiles(m_tileGrid.area());
+
+	std::vector<int> histogram(zCount + 1);
+	std::vector<uchar> selected(zCount);
+	for (int ty(0); ty < m_tileGrid.height; ty++)
+	{
+		for (int tx(0); tx < m_tileGrid.width; tx++)
+		{
+			cv::Rect tile(cv::Rect(tx * m_tileSize, ty * m_tileSize, m_tileSize, m_tileSize) & cv::Rect(0, 0, cols, rows));
+			tiles[ty * m_tileGrid.width + tx].area = tile;
+			tiles[ty * m_tileGrid.width + tx].init = false;
+			if (m_gateThresh >= 0 && !isTextured(tile))
+				continue;
+
+			// Coarse winners of the tile
+			std::fill(histogram.begin(), histogram.end(), 0);
+			for (int y(tile.y); y < tile.y + tile.height; y++)
+			{
+				const uchar * labels(fullDisparityMap.ptr<uchar>(y));
+				for (int x(tile.x); x < tile.x + tile.width; x++)
+				{
+					histogram[labels[x]]++;
+				}
+			}
+
+			// Fine candidates around the frequent winners, without the coarse ones already evaluated
+			std::fill(selected.begin(), selected.end(), 0);
+			for (int zInd(0); zInd < zCount; zInd++)
+			{
+				if (histogram[zInd + 1] == 0 || histogram[zInd + 1] < m_minTileShare * tile.area())
+					continue;
+				for (int z(std::max(0, zInd - m_stride + 1)); z <= std::min(zCount - 1, zInd + m_stride - 1); z++)
+				{
+					selected[z] = z % m_stride != 0 && z != zCount - 1;
+				}
+			}
+			std::vector<int> & candidates(m_tileCandidates[ty * m_tileGrid.width + tx]);
+			for (int zInd(0); zInd < zCount; zInd++)
+			{
+				if (selected[zInd])
+					candidates.push_back(zInd);
+			}
+			tiles[ty * m_tileGrid.width + tx].candidates = candidates;
+		}
+	}
+	mergeTiles(tiles, m_tileGrid, m_tileSize);
+	m_evaluatedShare += evaluatedShare(m_regions);
+}
+
+void CostSweep::keepCoarseNeighbours(cv::Mat const & fullDisparityMap)
+{
+	// The costs next to the coarse winners are those of the coarse candidates around it: 
+	// the refinement starts without neighbour
+	fullDisparityMap.copyTo(m_neighbours.coarseLabel);
+	std::swap(m_neighbours.lower, m_neighbours.coarseLower);
+	std::swap(m_neighbours.upper, m_neighbours.coarseUpper);
+	m_neighbours.lower.create(fullDisparityMap.size(), CV_16SC1);
+	m_neighbours.upper.create(fullDisparityMap.size(), CV_16SC1);
+	m_neighbours.lower.setTo(-1);
+	m_neighbours.upper.setTo(-1);
+}
+
+void CostSweep::useCoarseNeighbours(cv::Mat const & fullDisparityMap, std::vector<int> const & coarseCandidates)
+{
+	// Labels of the coarse candidates before and after each coarse label
+	const int zCount(int(m_disparities.size()));
+	std::vector<int> previous(zCount + 1, -1), next(zCount + 1, -1);
+	for (size_t c(0); c < coarseCandidates.size(); c++)
+	{
+		if (c > 0)
+			previous[coarseCandidates[c] + 1] = coarseCandidates[c - 1] + 1;
+		if (c + 1 < coarseCandidates.size())
+			next[coarseCandidates[c] + 1] = coarseCandidates[c + 1] + 1;
+	}
+
+	cv::parallel_for_(cv::Range(0, fullDisparityMap.rows), [&](const cv::Range & range)
+	{
+		for (int y(range.start); y < range.end; y++)
+		{
+			const uchar * labels(fullDisparityMap.ptr<uchar>(y)), * coarseLabels(m_neighbours.coarseLabel.ptr<uchar>(y));
+			const short * coarseLower(m_neighbours.coarseLower.ptr<short>(y)), * coarseUpper(m_neighbours.coarseUpper.ptr<short>(y));
+			short * lower(m_neighbours.lower.ptr<short>(y)), * upper(m_neighbours.upper.ptr<short>(y));
+			for (int x(0); x < fullDisparityMap.cols; x++)
+			{
+				int label(labels[x]), coarse(coarseLabels[x]);
+				if (lower[x] < 0 && label - 1 == previous[coarse])
+					lower[x] = coarseLower[x];
+				if (upper[x] < 0 && label + 1 == next[coarse])
+					upper[x] = coarseUpper[x];
+			}
+		}
+	});
+}
+
+void CostSweep::selectTemporalTiles()
+{
+	const int rows(m_rows), cols(m_cols), zCount(int(m_disparities.size()));
+	cv::Size tileGrid((cols + m_temporalTileSize - 1) / m_temporalTileSize, 
+		(rows + m_temporalTileSize - 1) / m_temporalTileSize);
+	std::vector<Region> tiles(tileGrid.area());
+
+	cv::parallel_for_(cv::Range(0, int(tiles.size())), [&](const cv::Range & range)
+	{
+		std::vector<uchar> centre(zCount + 1);
+		for (int t(range.start); t < range.end; t++)
+		{
+			Region & region(tiles[t]);
+			region.area = cv::Rect((t % tileGrid.width) * m_temporalTileSize, (t / tileGrid.width) * m_temporalTileSize, 
+				m_temporalTileSize, m_temporalTileSize) & cv::Rect(0, 0, cols, rows);
+			cv::Rect const & tile(region.area);
+
+			// Change detector: mean absolute difference with the previous rectified image
+			int64 difference(0);
+			for (int y(tile.y); y < tile.y + tile.height; y++)
+			{
+				for (int c(0); c < 3; c++)
+				{
+					const uchar * curr(&m_planar[(size_t(y) * m_planes + c) * cols]), 
+						* prev(&m_previousPlanar[(size_t(y) * m_planes + c) * cols]);
+					for (int x(tile.x); x < tile.x + tile.width; x++)
+					{
+						difference += std::abs(int(curr[x]) - int(prev[x]));
+					}
+				}
+			}
+			region.init = double(difference) > m_changeThresh * 3. * tile.area();
+			if (region.init && m_gateThresh >= 0 && !isTextured(tile))
+			{
+				region.candidates.assign(1, zCount / 2);
+				continue;
+			}
+			if (region.init)
+			{
+				for (int zInd(0); zInd < zCount; zInd++)
+				{
+					region.candidates.push_back(zInd);
+				}
+				continue;
+			}
+
+			// Window around the previous labels with a clear winner, or all of them when there is none
+			std::fill(centre.begin(), centre.end(), 0);
+			bool confident(false);
+			for (int pass(0); pass < 2 && !confident; pass++)
+			{
+				for (int y(tile.y); y < tile.y + tile.height; y++)
+				{
+					const uchar * labels(m_previousLabels.ptr<uchar>(y)), * minRow(m_previousMinCost.ptr<uchar>(y)), 
+						* maxRow(m_previousMaxCost.ptr<uchar>(y));
+					for (int x(tile.x); x < tile.x + tile.width; x++)
+					{
+						if (pass == 1 || maxRow[x] - minRow[x] > m_minConfidence)
+						{
+							centre[labels[x]] = 1;
+							confident = true;
+						}
+					}
+				}
+			}
+			for (int zInd(0); zInd < zCount; zInd++)
+			{
+				bool selected(false);
+				for (int z(std::max(0, zInd - m_temporalWindow)); z <= std::min(zCount - 1, zInd + m_temporalWindow); z++)
+				{
+					selected = selected || centre[z + 1];
+				}
+				if (selected)
+					region.candidates.push_back(zInd);
+			}
+		}
+	});
+
+	double changed(0.);
+	for (size_t t(0); t < tiles.size(); t++)
+	{
+		changed += tiles[t].init ? tiles[t].area.area() : 0.;
+	}
+	mergeTiles(tiles, tileGrid, m_temporalTileSize);
+	m_evaluatedShare = evaluatedShare(m_regions);
+	m_changedShare = changed / (double(rows) * cols);
+}
+
+void CostSweep::mergeTiles(std::vector<Region> const & tiles, cv::Size tileGrid, int tileSize)
+{
+	CV_Assert(int(tiles.size()) == tileGrid.area());
+	const int maxHeight(std::max(tileSize, (m_rows + int(m_bands.size()) - 1) / int(m_bands.size())));
+	std::vector<int> candidates;
+	// Sweeping a and b together evaluates the union of their candidates on their union, with a single halo
+	auto merge = [&](Region const & a, Region const & b)
+	{
+		candidates.clear();
+		std::set_union(a.candidates.begin(), a.candidates.end(), b.candidates.begin(), b.candidates.end(), 
+			std::back_inserter(candidates));
+		cv::Rect area(a.area | b.area);
+		// The neighbours of the coarse pass are those of the candidate list: it is kept as is
+		return a.init == b.init && a.coarse == b.coarse && (!a.coarse || a.candidates == b.candidates) 
+			&& sweptArea(area, candidates.size()) 
+			<= sweptArea(a.area, a.candidates.size()) + sweptArea(b.area, b.candidates.size());
+	};
+
+	m_regions.clear();
+	std::vector<size_t> open, grown; // Regions ending on the previous tile row, and on this one
+	for (int ty(0); ty < tileGrid.height; ty++)
+	{
+		// Spans of the tile row, growing while the next tile is cheaper with them
+		std::vector<Region> spans;
+		for (int tx(0); tx < tileGrid.width; tx++)
+		{
+			Region const & tile(tiles[ty * tileGrid.width + tx]);
+			if (tile.candidates.empty())
+				continue;
+			if (!spans.empty() && spans.back().area.x + spans.back().area.width == tile.area.x && merge(spans.back(), tile))
+			{
+				spans.back().area |= tile.area;
+				spans.back().candidates = candidates;
+			}
+			else
+				spans.push_back(tile);
+		}
+
+		// Stack each span on the region above it with the same columns
+		grown.clear();
+		for (size_t s(0); s < spans.size(); s++)
+		{
+			size_t r(m_regions.size());
+			for (size_t o(0); o < open.size() && r == m_regions.size(); o++)
+			{
+				Region const & region(m_regions[open[o]]);
+				if (region.area.x == spans[s].area.x && region.area.width == spans[s].area.width 
+					&& region.area.y + region.area.height == spans[s].area.y 
+					&& region.area.height + spans[s].area.height <= maxHeight && merge(region, spans[s]))
+					r = open[o];
+			}
+			if (r < m_regions.size())
+			{
+				m_regions[r].area |= spans[s].area;
+				m_regions[r].candidates = candidates;
+			}
+			else
+				m_regions.push_back(spans[s]);
+			grown.push_back(r);
+		}
+		open.swap(grown);
+	}
+}
+
+double CostSweep::sweptArea(cv::Rect const & area, size_t candidateCount) const
+{
+	// Restored rows and columns of the gradient and aggregation windows around the area
+	const int halo(m_radius + 1);
+	cv::Rect swept(cv::Rect(area.x - halo, area.y - halo, area.width + 2 * halo, area.height + 2 * halo) 
+		& cv::Rect(0, 0, m_cols, m_rows));
+	return double(candidateCount) * swept.area();
+}
+
+double CostSweep::evaluatedShare(std::vector<Region> const & regions) const
+{
+	// Relative to the full-width bands of the exhaustive sweep, with their own halo
+	const int rows(m_rows), cols(m_cols), bandCount(int(m_bands.size()));
+	double exhaustive(0.), evaluated(0.);
+	for (int b(0); b < bandCount; b++)
+	{
+		exhaustive += sweptArea(cv::Rect(0, rows * b / bandCount, cols, rows * (b + 1) / bandCount - rows * b / bandCount), 
+			m_disparities.size());
+	}
+	for (size_t r(0); r < regions.size(); r++)
+	{
+		evaluated += sweptArea(regions[r].area, regions[r].candidates.size());
+	}
+	return evaluated / exhaustive;
+}
+
+void CostSweep::computeGate()
+{
+	const int rows(m_rows), cols(m_cols);
+	m_gateSum.resize(size_t(rows + 1) * (cols + 1));
+	std::fill(m_gateSum.begin(), m_gateSum.begin() + cols + 1, 0);
+
+	// Row prefix sums of the pixels whose grey gradient reaches the threshold
+	cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range & range)
+	{
+		for (int y(range.start); y < range.end; y++)
+		{
+			// The colour gradient bounds the luma one: the gate is the same for both costs
+			const uchar * prev(&m_planar[size_t(cv::borderInterpolate(y - 1, rows, cv::BORDER_REFLECT_101)) * cols * m_planes]),
+				* curr(&m_planar[size_t(y) * cols * m_planes]),
+				* next(&m_planar[size_t(cv::borderInterpolate(y + 1, rows, cv::BORDER_REFLECT_101)) * cols * m_planes]);
+			int * sum(&m_gateSum[size_t(y + 1) * (cols + 1)]);
+			// The gradient is 0 on the first and last column
+			int border(0 >= m_gateThresh);
+			sum[0] = 0;
+			sum[1] = border;
+			for (int x(1); x < cols - 1; x++)
+			{
+				// Same operator as the cost: m_kernelGrad1 + m_kernelGrad2 and fixed-point grey
+				int g[3];
+				for (int c(0); c < 3; c++)
+				{
+					const uchar * p(prev + c * cols), * m(curr + c * cols), * n(next + c * cols);
+					g[c] = std::min(255, std::abs(6 * (p[x + 1] - p[x - 1]) + 20 * (m[x + 1] - m[x - 1]) 
+						+ 6 * (n[x + 1] - n[x - 1])));
+				}
+				int grey((g[0] * 4899 + g[1] * 9617 + g[2] * 1868 + (1 << 13)) >> 14);
+				sum[x + 1] = sum[x] + (grey >= m_gateThresh);
+			}
+			if (cols > 1)
+				sum[cols] = sum[cols - 1] + border;
+		}
+	});
+
+	// Column accumulation into the summed area table
+	cv::parallel_for_(cv::Range(0, cols + 1), [&](const cv::Range & range)
+	{
+		for (int y(1); y <= rows; y++)
+		{
+			const int * above(&m_gateSum[size_t(y - 1) * (cols + 1)]);
+			int * sum(&m_gateSum[size_t(y) * (cols + 1)]);
+			for (int x(range.start); x < range.end; x++)
+			{
+				sum[x] += above[x];
+			}
+		}
+	});
+}
+
+bool CostSweep::isTextured(cv::Rect const & area) const
+{
+	// Gradients that can reach the costs of the area through the restoration shifts, 
+	// the restored gradient, the aggregation window and the dilation
+	const int cols(m_cols), halo(m_radius + 1 + m_gateDilation);
+	cv::Rect reach(cv::Rect(cv::Point(area.x - m_maxShift - halo, area.y - halo),
+		cv::Point(area.x + area.width - m_minShift + halo, area.y + area.height + halo)) 
+		& cv::Rect(0, 0, m_cols, m_rows));
+	if (reach.area() == 0)
+		return false;
+	const int * top(&m_gateSum[size_t(reach.y) * (cols + 1)]), 
+		* bottom(&m_gateSum[size_t(reach.y + reach.height) * (cols + 1)]);
+	return bottom[reach.x + reach.width] - bottom[reach.x] - top[reach.x + reach.width] + top[reach.x] > 0;
+}
+
+void CostSweep::setTextureGate(int gradThresh, int dilation, int tileSize)
+{
+	CV_Assert(dilation >= 0 && tileSize >= 1);
+	m_gateThresh = gradThresh;
+	m_gateDilation = dilation;
+	m_gateTileSize = tileSize;
+}
+
+void CostSweep::setTemporalSearch(int window, int tileSize, float changeThresh, int minConfidence, int refreshPeriod)
+{
+	CV_Assert(window >= 0 && tileSize >= 1);
+	m_temporalWindow = window;
+	m_temporalTileSize = tileSize;
+	m_changeThresh = changeThresh;
+	m_minConfidence = minConfidence;
+	m_refreshPeriod = refreshPeriod;
+	resetTemporalSearch();
+}
+
+void CostSweep::resetTemporalSearch()
+{
+	m_previousLabels.release();
+	m_previousMinCost.release();
+	m_previousMaxCost.release();
+	m_previousPlanar.clear();
+	m_framesSinceRefresh = 0;
+}
+
+void CostSweep::setProfiling(bool profiling)
+{
+	m_profiling = profiling;
+	m_candidateTimes.clear();
+}
+
+void CostSweep::setLumaCost(bool luma)
+{
+	m_luma = luma;
+	m_planes = luma ? 4 : 3;
+	m_costPlane = luma ? 3 : 0;
+	m_costPlanes = luma ? 1 : 3;
+}
+
+void CostSweep::setDeferredColour(bool deferred)
+{
+	m_deferredColour = deferred;
+}
+
+void CostSweep::setSubpixelFit(SubpixelFit fit)
+{
+	m_subpixelFit = fit;
+	if (fit == SUBPIXEL_NONE)
+	{
+		m_neighbours = NeighbourCosts();
+		m_subpixelLabels.release();
+	}
+}
+
+void CostSweep::fitSubpixel(cv::Mat const & fullDisparityMap, cv::Mat const & minCost, 
+	cv::Mat const & lowerCost, cv::Mat const & upperCost, SubpixelFit fit, cv::Mat & subLabels)
+{
+	CV_Assert(fullDisparityMap.type() == CV_8UC1 && minCost.type() == CV_8UC1 
+		&& lowerCost.type() == CV_16SC1 && upperCost.type() == CV_16SC1
+		&& minCost.size() == fullDisparityMap.size() && lowerCost.size() == fullDisparityMap.size() 
+		&& upperCost.size() == fullDisparityMap.size());
+	subLabels.create(fullDisparityMap.size(), CV_32FC1);
+	const int cols(fullDisparityMap.cols);
+
+	cv::parallel_for_(cv::Range(0, fullDisparityMap.rows), [&](const cv::Range & range)
+	{
+		for (int y(range.start); y < range.end; y++)
+		{
+			const uchar * labels(fullDisparityMap.ptr<uchar>(y)), * minRow(minCost.ptr<uchar>(y));
+			const short * lowerRow(lowerCost.ptr<short>(y)), * upperRow(upperCost.ptr<short>(y));
+			float * dst(subLabels.ptr<float>(y));
+			for (int x(0); x < cols; x++)
+			{
+				float offset(0.f);
+				int lower(lowerRow[x]), upper(upperRow[x]), best(minRow[x]);
+				if (labels[x] && lower >= 0 && upper >= 0)
+				{
+					if (fit == SUBPIXEL_PARABOLA)
+					{
+						// Vertex of the parabola through (-1, lower), (0, best) and (1, upper)
+						int curvature(lower - 2 * best + upper);
+						if (curvature > 0)
+							offset = float(lower - upper) / float(2 * curvature);
+					}
+					else if (fit == SUBPIXEL_EQUIANGULAR)
+					{
+						// The steeper side gives the slope of both lines
+						int slope(std::max(lower, upper) - best);
+						if (slope > 0)
+							offset = float(lower - upper) / float(2 * slope);
+					}
+				}
+				dst[x] = labels[x] ? float(labels[x]) + std::min(0.5f, std::max(-0.5f, offset)) : 0.f;
+			}
+		}
+	});
+}
+
+void CostSweep::setBandCount(int bandCount)
+{
+	m_bandCount = bandCount;
+}
+
+void CostSweep::setHierarchicalSearch(int stride, int tileSize, float minTileShare)
+{
+	CV_Assert(stride >= 1 && tileSize >= 1);
+	m_stride = stride;
+	m_tileSize = tileSize;
+	m_minTileShare = minTileShare;
+	m_tileCandidates.clear();
+}
+
+CostSweep::SearchReport CostSweep::compareLabels(cv::Mat const & reference, cv::Mat const & labels)
+{
+	CV_Assert(reference.type() == CV_8UC1 && labels.type() == CV_8UC1 && reference.size() == labels.size());
+	SearchReport report;
+	double exact(0.), near(0.), error(0.);
+	for (int y(0); y < reference.rows; y++)
+	{
+		const uchar * referenceRow(reference.ptr<uchar>(y)), * labelRow(labels.ptr<uchar>(y));
+		for (int x(0); x < reference.cols; x++)
+		{
+			int difference(std::abs(int(referenceRow[x]) - int(labelRow[x])));
+			exact += difference == 0;
+			near += difference <= 1;
+			error += difference;
+		}
+	}
+	double total(std::max(1., double(reference.total())));
+	report.exactShare = exact / total;
+	report.nearShare = near / total;
+	report.meanError = error / total;
+	return report;
+}
+
+void CostSweep::sweepRegions(cv::Mat & fullDisparityMap, cv::Mat & minCost, cv::Mat & maxCost, 
+	cv::Mat & reconsImgRectified)
+{
+	// Each band buffer takes every bandCount-th region
+	const int bandCount(int(m_bands.size()));
+	cv::parallel_for_(cv::Range(0, bandCount), [&](const cv::Range & range)
+	{
+		for (int b(range.start); b < range.end; b++)
+		{
+			for (size_t r(b); r < m_regions.size(); r += bandCount)
+			{
+				sweepRegion(fullDisparityMap, minCost, maxCost, reconsImgRectified, m_regions[r], m_bands[b], m_neighbours);
+			}
+		}
+	}, bandCount);
+}
+
+void CostSweep::sweepRegion(cv::Mat & fullDisparityMap, cv::Mat & minCost, cv::Mat & maxCost, 
+	cv::Mat & reconsImgRectified, Region const & region, BandBuffers & buffers, NeighbourCosts & neighbours) const
+{
+	const int rows(m_rows), cols(m_cols);
+	const int rowBegin(region.area.y), rowEnd(region.area.y + region.area.height),
+		colBegin(region.area.x), colEnd(region.area.x + region.area.width);
+	const float invWinSize(m_invWinSize);
+	// Halo: aggregated rows used by the vertical window and restored rows used by their gradient
+	const int aggregatedBegin(std::max(0, rowBegin - m_radius)), restoredBegin(std::max(0, aggregatedBegin - 1));
+	buffers.colBegin = colBegin;
+	buffers.colEnd = colEnd;
+
+	// The first candidate wins everywhere
+	if (region.init)
+	{
+		minCost(region.area).setTo(255);
+		maxCost(region.area).setTo(0);
+	}
+
+	for (size_t c(0); c < region.candidates.size(); c++)
+	{
+		const int zInd(region.candidates[c]);
+		int64 candidateStart(m_profiling ? cv::getTickCount() : 0);
+		int d0(translation(m_disparities[zInd])), d1(translation(2.f * m_disparities[zInd]));
+		uchar label(uchar(zInd + 1));
+		// Neighbours of the label for the subpixel fit: the previous and next candidates of a coarse pass, 
+		// the adjacent labels otherwise
+		int lowerLabel(region.coarse ? (c > 0 ? region.candidates[c - 1] + 1 : -1) : label - 1),
+			upperLabel(region.coarse ? (c + 1 < region.candidates.size() ? region.candidates[c + 1] + 1 : -1) : label + 1);
+
+		// Vertical window sum for the first row
+		buffers.restoredLast = restoredBegin - 1;
+		buffers.aggregatedLast = aggregatedBegin - 1;
+		streamRows(std::min(rows - 1, rowBegin + m_radius), d0, d1, buffers);
+		std::fill(buffers.colSum.begin() + colBegin, buffers.colSum.begin() + colEnd, m_radius);
+		for (int i(-m_radius); i <= m_radius; i++)
+		{
+			const uchar * aggregated(&buffers.aggregated[
+				(cv::borderInterpolate(rowBegin + i, rows, cv::BORDER_REFLECT_101) % m_aggregatedCount) * cols]);
+			for (int x(colBegin); x < colEnd; x++)
+			{
+				buffers.colSum[x] += aggregated[x];
+			}
+		}
+
+		for (int y(rowBegin); y < rowEnd; y++)
+		{
+			const uchar * restored(&buffers.restored[(y % m_restoredCount) * cols * m_costPlanes]);
+			uchar * minRow(minCost.ptr<uchar>(y)), * maxRow(maxCost.ptr<uchar>(y)),
+				* disparityRow(fullDisparityMap.ptr<uchar>(y)), * reconsRow(reconsImgRectified.ptr<uchar>(y));
+			uchar * best(&buffers.best[0]);
+			const int * colSum(&buffers.colSum[0]);
+
+			// Depth selection: ties go to the latest candidate as with cv::CMP_GE
+			if (m_subpixelFit == SUBPIXEL_NONE)
+			{
+				for (int x(colBegin); x < colEnd; x++)
+				{
+					uchar c(uchar(int(float(colSum[x]) * invWinSize)));
+					uchar isBest(c <= minRow[x]);
+					best[x] = isBest;
+					minRow[x] = isBest ? c : minRow[x];
+					disparityRow[x] = isBest ? label : disparityRow[x];
+					maxRow[x] = std::max(maxRow[x], c);
+				}
+			}
+			else
+			{
+				// Same selection, keeping the costs of the candidates next to the winner. 
+				// A new winner takes its neighbours from the previous winner or the previous candidate
+				short * lowerRow(neighbours.lower.ptr<short>(y)), * upperRow(neighbours.upper.ptr<short>(y));
+				uchar * lastLabelRow(neighbours.lastLabel.ptr<uchar>(y)), * lastCostRow(neighbours.lastCost.ptr<uchar>(y));
+				for (int x(colBegin); x < colEnd; x++)
+				{
+					uchar c(uchar(int(float(colSum[x]) * invWinSize)));
+					uchar isBest(c <= minRow[x]);
+					int winner(lastLabelRow[x] ? disparityRow[x] : -1), last(lastLabelRow[x] ? lastLabelRow[x] : -1);
+					short lower(winner == lowerLabel ? short(minRow[x]) : last == lowerLabel ? short(lastCostRow[x]) : short(-1)),
+						upper(winner == upperLabel ? short(minRow[x]) : last == upperLabel ? short(lastCostRow[x]) : short(-1));
+					lowerRow[x] = isBest ? lower : winner == upperLabel ? short(c) : lowerRow[x];
+					upperRow[x] = isBest ? upper : winner == lowerLabel ? short(c) : upperRow[x];
+					lastLabelRow[x] = label;
+					lastCostRow[x] = c;
+
+					best[x] = isBest;
+					minRow[x] = isBest ? c : minRow[x];
+					disparityRow[x] = isBest ? label : disparityRow[x];
+					maxRow[x] = std::max(maxRow[x], c);
+				}
+			}
+
+			// Merge reconstructions, unless restored after the sweep. The luma cost did not restore the colour
+			if (m_luma && !m_deferredColour)
+			{
+				const uchar * src(&m_planar[size_t(y) * cols * m_planes]);
+				for (int x(colBegin); x < colEnd; x++)
+				{
+					if (best[x])
+					{
+						reconsRow[3 * x] = restorePixel(src, 1, cols, x, d0, d1);
+						reconsRow[3 * x + 1] = restorePixel(src + cols, 1, cols, x, d0, d1);
+						reconsRow[3 * x + 2] = restorePixel(src + 2 * cols, 1, cols, x, d0, d1);
+					}
+				}
+			}
+			else if (!m_deferredColour)
+			{
+				for (int x(colBegin); x < colEnd; x++)
+				{
+					if (best[x])
+					{
+						reconsRow[3 * x] = restored[x];
+						reconsRow[3 * x + 1] = restored[x + cols];
+						reconsRow[3 * x + 2] = restored[x + 2 * cols];
+					}
+				}
+			}
+
+			// Slide the vertical window
+			if (y + 1 < rowEnd)
+			{
+				streamRows(std::min(rows - 1, y + m_radius + 1), d0, d1, buffers);
+				const uchar * in(&buffers.aggregated[(cv::borderInterpolate(y + m_radius + 1, rows, 
+					cv::BORDER_REFLECT_101) % m_aggregatedCount) * cols]);
+				const uchar * out(&buffers.aggregated[(cv::borderInterpolate(y - m_radius, rows, 
+					cv::BORDER_REFLECT_101) % m_aggregatedCount) * cols]);
+				int * colSumNext(&buffers.colSum[0]);
+				for (int x(colBegin); x < colEnd; x++)
+				{
+					colSumNext[x] += int(in[x]) - int(out[x]);
+				}
+			}
+		}
+
+		if (m_profiling)
+			buffers.candidateTicks[zInd] += cv::getTickCount() - candidateStart;
+	}
+}
+
+void CostSweep::streamRows(int y, int d0, int d1, BandBuffers & buffers) const
+{
+	const int rows(m_rows), cols(m_cols);
+	// Columns of the aggregated rows, of their grey gradient and of the restored rows
+	const int greyBegin(std::max(0, buffers.colBegin - m_radius)), greyEnd(std::min(cols, buffers.colEnd + m_radius)),
+		restoredBegin(std::max(0, greyBegin - 1)), restoredEnd(std::min(cols, greyEnd + 1));
+
+	while (buffers.aggregatedLast < y)
+	{
+		int yAggregated(++buffers.aggregatedLast);
+
+		// The gradient needs the next restored row
+		while (buffers.restoredLast < std::min(rows - 1, yAggregated + 1))
+		{
+			buffers.restoredLast++;
+			restoreRow(&m_planar[size_t(buffers.restoredLast) * cols * m_planes],
+				&buffers.restored[(buffers.restoredLast % m_restoredCount) * cols * m_costPlanes], 
+				d0, d1, restoredBegin, restoredEnd, buffers);
+		}
+
+		int yPrev(cv::borderInterpolate(yAggregated - 1, rows, cv::BORDER_REFLECT_101)),
+			yNext(cv::borderInterpolate(yAggregated + 1, rows, cv::BORDER_REFLECT_101));
+		aggregateRow(&buffers.restored[(yPrev % m_restoredCount) * cols * m_costPlanes],
+			&buffers.restored[(yAggregated % m_restoredCount) * cols * m_costPlanes],
+			&buffers.restored[(yNext % m_restoredCount) * cols * m_costPlanes],
+			&buffers.aggregated[(yAggregated % m_aggregatedCount) * cols], greyBegin, greyEnd, buffers);
+	}
+}
+
+void CostSweep::restoreRow(const uchar * src, uchar * dst, int d0, int d1, 
+	int colBegin, int colEnd, BandBuffers & buffers) const
+{
+	const int cols(m_cols);
+	// The second step reads the first one translated by d1
+	const int firstBegin(std::max(0, std::min(colBegin, colBegin - d1))), 
+		firstEnd(std::min(cols, std::max(colEnd, colEnd - d1)));
+
+	// I - tau * I translated by d, then + tau^2 * (first step) translated by 2d
+	for (int c(0); c < m_costPlanes; c++)
+	{
+		combineTranslated(src + (m_costPlane + c) * cols, &buffers.firstStep[0], cols, d0, m_tauScale, false, 
+			firstBegin, firstEnd);
+		combineTranslated(&buffers.firstStep[0], dst + c * cols, cols, d1, m_tau2Scale, true, colBegin, colEnd);
+	}
+}
+
+inline uchar CostSweep::restorePixel(const uchar * src, int step, int cols, int x, int d0, int d1) const
+{
+	// First step at x and at x - d1, where the translations are defined
+	const int xShifted(x - d1);
+	uchar first(x - d0 >= 0 && x - d0 < cols ? 
+		uchar(std::max(src[x * step] - m_tauScale.lut[src[(x - d0) * step]], 0)) : src[x * step]);
+	if (xShifted < 0 || xShifted >= cols)
+		return first;
+	uchar firstShifted(xShifted - d0 >= 0 && xShifted - d0 < cols ? 
+		uchar(std::max(src[xShifted * step] - m_tauScale.lut[src[(xShifted - d0) * step]], 0)) : src[xShifted * step]);
+	return uchar(std::min(first + m_tau2Scale.lut[firstShifted], 255));
+}
+
+void CostSweep::restoreLabels(cv::Mat const & imgRectified, cv::Mat const & fullDisparityMap, 
+	cv::Mat & reconsImgRectified) const
+{
+	CV_Assert(imgRectified.type() == CV_8UC3 && fullDisparityMap.type() == CV_8UC1 
+		&& fullDisparityMap.size() == imgRectified.size());
+	reconsImgRectified.create(imgRectified.size(), CV_8UC3);
+	const int cols(imgRectified.cols);
+
+	// Translations of each label, none for 0
+	std::vector<int> d0(m_disparities.size() + 1, 0), d1(m_disparities.size() + 1, 0);
+	for (size_t zInd(0); zInd < m_disparities.size(); zInd++)
+	{
+		d0[zInd + 1] = translation(m_disparities[zInd]);
+		d1[zInd + 1] = translation(2.f * m_disparities[zInd]);
+	}
+
+	cv::parallel_for_(cv::Range(0, imgRectified.rows), [&](const cv::Range & range)
+	{
+		for (int y(range.start); y < range.end; y++)
+		{
+			const uchar * src(imgRectified.ptr<uchar>(y)), * labels(fullDisparityMap.ptr<uchar>(y));
+			uchar * dst(reconsImgRectified.ptr<uchar>(y));
+			for (int x(0); x < cols; x++)
+			{
+				size_t label(labels[x]);
+				if (label == 0 || label >= d0.size())
+				{
+					dst[3 * x] = src[3 * x];
+					dst[3 * x + 1] = src[3 * x + 1];
+					dst[3 * x + 2] = src[3 * x + 2];
+					continue;
+				}
+				for (int c(0); c < 3; c++)
+				{
+					dst[3 * x + c] = restorePixel(src + c, 3, cols, x, d0[label], d1[label]);
+				}
+			}
+		}
+	});
+}
+
+void CostSweep::aggregateRow(const uchar * prev, const uchar * curr, const uchar * next,
+	uchar * dst, int greyBegin, int greyEnd, BandBuffers & buffers) const
+{
+	const int cols(m_cols), colBegin(buffers.colBegin), colEnd(buffers.colEnd);
+	uchar * grey(&buffers.grey[m_radius]);
+	int * rowSum(&buffers.rowSum[0]);
+	const float invWinSize(m_invWinSize);
+	const int greyFirst(std::max(1, greyBegin)), greyLast(std::min(cols - 1, greyEnd));
+
+	// m_kernelGrad1 + m_kernelGrad2 with saturation gives the clamped absolute gradient
+	// The reflected border makes it 0 on the first and last column
+	if (greyBegin == 0)
+		grey[0] = 0;
+	if (greyEnd == cols)
+		grey[cols - 1] = 0;
+	if (m_costPlanes == 1)
+	{
+		// The gradient of the luma is the grey value
+		for (int x(greyFirst); x < greyLast; x++)
+		{
+			grey[x] = uchar(std::min(255, std::abs(6 * (prev[x + 1] - prev[x - 1]) + 20 * (curr[x + 1] - curr[x - 1]) 
+				+ 6 * (next[x + 1] - next[x - 1]))));
+		}
+	}
+	else
+	{
+		const uchar * p0(prev), * p1(prev + cols), * p2(prev + 2 * cols), 
+			* c0(curr), * c1(curr + cols), * c2(curr + 2 * cols),
+			* n0(next), * n1(next + cols), * n2(next + 2 * cols);
+		for (int x(greyFirst); x < greyLast; x++)
+		{
+			int g0(std::min(255, std::abs(6 * (p0[x + 1] - p0[x - 1]) + 20 * (c0[x + 1] - c0[x - 1]) 
+					+ 6 * (n0[x + 1] - n0[x - 1])))),
+				g1(std::min(255, std::abs(6 * (p1[x + 1] - p1[x - 1]) + 20 * (c1[x + 1] - c1[x - 1])
+					+ 6 * (n1[x + 1] - n1[x - 1])))),
+				g2(std::min(255, std::abs(6 * (p2[x + 1] - p2[x - 1]) + 20 * (c2[x + 1] - c2[x - 1])
+					+ 6 * (n2[x + 1] - n2[x - 1]))));
+			// Fixed-point cv::COLOR_RGB2GRAY
+			grey[x] = uchar((g0 * 4899 + g1 * 9617 + g2 * 1868 + (1 << 13)) >> 14);
+		}
+	}
+
+	// Horizontal box filter with reflected borders
+	for (int i(1); i <= m_radius; i++)
+	{
+		if (greyBegin == 0)
+			grey[-i] = grey[cv::borderInterpolate(-i, cols, cv::BORDER_REFLECT_101)];
+		if (greyEnd == cols)
+			grey[cols - 1 + i] = grey[cv::borderInterpolate(cols - 1 + i, cols, cv::BORDER_REFLECT_101)];
+	}
+	int sum(m_radius);
+	for (int i(-m_radius); i <= m_radius; i++)
+	{
+		sum += grey[colBegin + i];
+	}
+	for (int x(colBegin); x < colEnd; x++)
+	{
+		rowSum[x] = sum;
+		sum += int(grey[x + m_radius + 1]) - int(grey[x - m_radius]);
+	}
+	for (int x(colBegin); x < colEnd; x++)
+	{
+		dst[x] = uchar(int(float(rowSum[x]) * invWinSize));
+	}
+}
+
+size_t CostSweep::getBytes() const
+{
+	size_t bytes(m_planar.capacity() + m_previousPlanar.capacity() + m_gateSum.capacity() * sizeof(int));
+	for (size_t b(0); b < m_bands.size(); b++)
+	{
+		BandBuffers const & buffers(m_bands[b]);
+		bytes += buffers.restored.capacity() + buffers.firstStep.capacity() + buffers.grey.capacity() 
+			+ buffers.aggregated.capacity() + buffers.best.capacity() 
+			+ (buffers.rowSum.capacity() + buffers.colSum.capacity()) * sizeof(int)
+			+ buffers.candidateTicks.capacity() * sizeof(int64);
+	}
+	cv::Mat const * images[] = { &m_neighbours.lower, &m_neighbours.upper, &m_neighbours.lastLabel, 
+		&m_neighbours.lastCost, &m_neighbours.coarseLabel, &m_neighbours.coarseLower, &m_neighbours.coarseUpper, 
+		&m_subpixelLabels, &m_previousLabels, &m_previousMinCost, &m_previousMaxCost };
+	for (size_t i(0); i < sizeof(images) / sizeof(images[0]); i++)
+	{
+		bytes += images[i]->total() * images[i]->elemSize();
+	}
+	return bytes;
+}
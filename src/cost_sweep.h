@@ -0,0 +1,475 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#ifndef COSTSWEEP_H
+#define COSTSWEEP_H
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+/* @class CostSweep
+@brief Fused CPU implementation of the depth candidate sweep of DepthEstimator.
+For each candidate, every rectified row is streamed once: translation, tau-weighted restoration,
+horizontal gradient, grey conversion, box aggregation and winner selection are done
+with row-sized ring buffers instead of full-image intermediate results.
+The image is split in horizontal bands processed in parallel, each running the full candidate loop.
+Only the vertical aggregation couples rows: bands recompute a winSize / 2 + 1 halo above and below.
+With a hierarchical search, a coarse subset of the candidates is swept first,
+then each tile only evaluates the candidates around its frequent coarse winners.
+With a texture gate, tiles too far from any strong gradient of the input are only restored with one candidate.
+With a temporal search, tiles whose image did not change since the previous frame only evaluate
+the candidates around their previous labels.
+With a luma cost, a single luma plane converted once from the input is restored and matched instead of 
+the three channels, and the colour is only restored at the pixels where a candidate wins.
+With a deferred colour restoration, the sweep only keeps the labels and costs, 
+and the restored image is computed once from the winning labels.
+With a subpixel fit, the costs of the candidates on each side of the winner are kept 
+and a curve through the three costs gives a fractional label.
+The outputs of the exhaustive search are the same as the cv:: based DepthEstimator::reconstructDepthAndColour.
+*/
+class CostSweep
+{
+public:
+	/* Agreement of a disparity map with a reference one */
+	struct SearchReport
+	{
+		double exactShare = 0.; // Share of identical labels
+		double nearShare = 0.; // Share of labels within one candidate
+		double meanError = 0.; // Mean absolute label difference
+	};
+
+	/* Curve fitted through the best cost and its neighbours for fractional labels */
+	enum SubpixelFit
+	{
+		SUBPIXEL_NONE, // Integer labels only
+		SUBPIXEL_PARABOLA, // Minimum of the parabola through the three costs
+		SUBPIXEL_EQUIANGULAR // Intersection of two lines of opposite slopes, suited to absolute differences
+	};
+
+	CostSweep() {}
+
+	/* @brief Set the sweep parameters
+	@param disparities disparity candidates
+	@param tau intensity proportion between e-ray and o-ray
+	@param winSize window size for cost aggregation (odd)
+	*/
+	CostSweep(std::vector<float> const & disparities, float tau, int winSize);
+
+	/* @brief Evaluate all candidates and keep the best one for each pixel
+	@param imgRectified rectified uneven birefractive image (CV_8UC3)
+	@param fullDisparityMap index + 1 of the best candidate (CV_8UC1)
+	@param minCost best cost (CV_8UC1)
+	@param maxCost worse cost (CV_8UC1)
+	@param reconsImgRectified image restored with the best candidate (CV_8UC3)
+	@param temporal false to neither use nor update the temporal search history, e.g. for a crop of the stream
+	*/
+	void run(cv::Mat const & imgRectified, cv::Mat & fullDisparityMap, 
+		cv::Mat & minCost, cv::Mat & maxCost, cv::Mat & reconsImgRectified, bool temporal = true);
+
+	/* @brief Replace the disparity candidates, keeping the other parameters. The temporal search starts over
+	@param disparities disparity candidates
+	*/
+	void setDisparities(std::vector<float> const & disparities);
+
+	/* @brief Set the number of row bands processed in parallel
+	@param bandCount number of bands, 0 for one band per cv::getNumThreads() thread
+	*/
+	void setBandCount(int bandCount);
+
+	/* @brief Use a coarse-to-fine candidate search instead of the exhaustive sweep
+	@param stride one candidate every stride in the coarse pass, 1 for the exhaustive sweep
+	@param tileSize side in pixels of the tiles selecting their fine candidates
+	@param minTileShare minimum share of a tile won by a coarse candidate to refine around it
+	*/
+	void setHierarchicalSearch(int stride, int tileSize = 256, float minTileShare = 0.02f);
+
+	/* @brief Get the fine candidates of each tile during the last hierarchical run
+	@return candidate indices of each tile, row-major over getTileGrid()
+	*/
+	inline std::vector<std::vector<int> > const & getTileCandidates() const;
+
+	/* @brief Get the number of tiles in each direction during the last hierarchical run */
+	inline cv::Size getTileGrid() const;
+
+	/* @brief Get the share of the (pixel, candidate) pairs evaluated during the last run, 
+	including the halo each swept region recomputes around itself
+	@return 1 for the exhaustive sweep
+	*/
+	inline double getEvaluatedShare() const;
+
+	/* @brief Only sweep the tiles close to textured areas of the rectified input, 
+	the others being restored with the middle candidate
+	@param gradThresh grey gradient of the input (same operator as the cost) of a textured pixel, -1 to disable
+	@param dilation distance in pixels around textured pixels still swept, 
+	in addition to the restoration shifts and the aggregation window
+	@param tileSize side in pixels of the gated tiles
+	*/
+	void setTextureGate(int gradThresh, int dilation, int tileSize = 32);
+
+	/* @brief Get the share of the image swept with all candidates by the texture gate in the last run
+	@return 1 without gate
+	*/
+	inline double getTexturedShare() const;
+
+	/* @brief Get the extreme column offsets read by the restoration over all candidates
+	@param minShift smallest offset, x reads up to x - minShift
+	@param maxShift largest offset, x reads down to x - maxShift
+	*/
+	inline void getShiftRange(int & minShift, int & maxShift) const;
+
+	/* @brief Get the tables of the sweep for the OpenCL kernel of DepthEstimator::SWEEP_OPENCL, 
+	giving the same restoration and window means
+	@param translations translations by the disparity and by twice the disparity of each candidate (1 x count, CV_32SC2)
+	@param tauScales x * tau followed by x * tau^2, with saturation (1 x 512, CV_8UC1)
+	@param invWinSize reciprocal giving the rounded window mean by truncation
+	*/
+	void getKernelTables(cv::Mat & translations, cv::Mat & tauScales, float & invWinSize) const;
+
+	/* @brief Reuse the previous frame in video streams: tiles whose rectified image is unchanged
+	only evaluate the candidates close to their previous labels, and keep their previous worse cost
+	@param window candidates evaluated on each side of a previous label, 0 to disable
+	@param tileSize side in pixels of the tiles
+	@param changeThresh mean absolute intensity difference above which a tile is swept with all candidates
+	@param minConfidence difference between the worse and best cost above which a previous label is used
+	@param refreshPeriod number of frames between full sweeps, 0 for never
+	*/
+	void setTemporalSearch(int window, int tileSize = 64, float changeThresh = 4.f, 
+		int minConfidence = 2, int refreshPeriod = 30);
+
+	/* @brief Forget the previous frame: the next run sweeps all candidates, e.g. after a scene cut */
+	void resetTemporalSearch();
+
+	/* @brief Get the share of the image swept with all candidates by the change detector in the last run
+	@return 1 for a full sweep
+	*/
+	inline double getChangedShare() const;
+
+	/* @brief Compare disparity maps, e.g. a hierarchical result to the exhaustive one
+	@param reference reference labels (CV_8UC1)
+	@param labels compared labels (CV_8UC1)
+	@return agreement of the labels
+	*/
+	static SearchReport compareLabels(cv::Mat const & reference, cv::Mat const & labels);
+
+	/* @brief Compute the cost on a luma plane instead of the colour channels. 
+	The luma has the weights of the grey conversion of the colour cost, which it approximates: 
+	gradients and grey conversion commute up to the absolute value, saturation and rounding
+	@param luma true for the luma cost, false for the colour cost
+	*/
+	void setLumaCost(bool luma);
+
+	/* @brief Get whether the cost is computed on a luma plane */
+	inline bool getLumaCost() const;
+
+	/* @brief Restore the colour after the sweep from the winning labels 
+	instead of merging the restored image of every candidate. The output is the same
+	@param deferred true to restore after the sweep
+	*/
+	void setDeferredColour(bool deferred);
+
+	/* @brief Get whether the colour is restored after the sweep */
+	inline bool getDeferredColour() const;
+
+	/* @brief Restore each pixel with its label, the same two-step restoration as DepthEstimator::restoreImage
+	@param imgRectified rectified uneven birefractive image (CV_8UC3)
+	@param fullDisparityMap index + 1 of the candidate of each pixel, 0 to keep the input (CV_8UC1)
+	@param reconsImgRectified restored image (CV_8UC3)
+	*/
+	void restoreLabels(cv::Mat const & imgRectified, cv::Mat const & fullDisparityMap, 
+		cv::Mat & reconsImgRectified) const;
+
+	/* @brief Keep the costs of the neighbouring candidates of the winner and fit a curve through them after the sweep.
+	Fractional labels need both neighbours to be evaluated: labels at the ends of the candidate range 
+	and of gated tiles stay integer. With a hierarchical search, the refined labels take the costs of the coarse candidates 
+	around the coarse winner; labels whose neighbour was evaluated by neither pass, e.g. coarse winners of a tile 
+	left unrefined, stay integer
+	@param fit fitted curve, SUBPIXEL_NONE to only keep the integer labels
+	*/
+	void setSubpixelFit(SubpixelFit fit);
+
+	/* @brief Get the curve fitted for fractional labels */
+	inline SubpixelFit getSubpixelFit() const;
+
+	/* @brief Get the fractional labels of the last run, with a subpixel fit
+	@return index + 1 of the best candidate refined between its neighbours, 0 where the label is 0 (CV_32FC1)
+	*/
+	inline cv::Mat const & getSubpixelLabels() const;
+
+	/* @brief Refine labels with the costs of their neighbouring candidates. 
+	The offset from the integer label is within [-0.5, 0.5]
+	@param fullDisparityMap index + 1 of the best candidate (CV_8UC1)
+	@param minCost best cost (CV_8UC1)
+	@param lowerCost cost of the candidate below the best one, -1 if unknown (CV_16SC1)
+	@param upperCost cost of the candidate above the best one, -1 if unknown (CV_16SC1)
+	@param fit fitted curve
+	@param subLabels fractional labels, 0 where the label is 0 (CV_32FC1)
+	*/
+	static void fitSubpixel(cv::Mat const & fullDisparityMap, cv::Mat const & minCost, 
+		cv::Mat const & lowerCost, cv::Mat const & upperCost, SubpixelFit fit, cv::Mat & subLabels);
+
+	/* @brief Measure the time spent on each candidate
+	@param profiling true to measure
+	*/
+	void setProfiling(bool profiling);
+
+	/* @brief Get the time spent on each candidate during the last run, with profiling enabled
+	@return time in ms of each candidate, averaged over the bands
+	*/
+	inline std::vector<double> const & getCandidateTimes() const;
+
+	/* @brief Get the bytes of the buffers of the sweep: planar image, band rings, 
+	neighbour costs and the previous frame of the temporal search
+	@return bytes allocated by the last runs
+	*/
+	size_t getBytes() const;
+
+	/* @brief Integer translation used by DepthEstimator::restoreImage for a disparity */
+	static int translation(float disparity);
+
+private:
+	/* Ring buffers of a band, sized for a few rows to stay in L2. Rows are stored planar */
+	struct BandBuffers
+	{
+		int restoredLast, aggregatedLast; // Last rows written in the rings
+		int colBegin, colEnd; // Output columns of the current region
+		std::vector<uchar> restored; // Restored rows
+		std::vector<uchar> firstStep; // Row after the first restoration step
+		std::vector<uchar> grey; // Padded grey gradient row
+		std::vector<int> rowSum; // Horizontal window sums
+		std::vector<uchar> aggregated; // Horizontally aggregated cost rows
+		std::vector<int> colSum; // Vertical window sum for the current row
+		std::vector<uchar> best; // Pixels of the current row where the candidate is the best
+		std::vector<int64> candidateTicks; // Time spent on each candidate when profiling
+	};
+
+	/* x * tau rounded and saturated as cv::multiply */
+	struct TauScale
+	{
+		float tau;
+		uchar lut[256];
+	};
+
+	/* Image area swept with its own candidates */
+	struct Region
+	{
+		cv::Rect area;
+		std::vector<int> candidates; // Candidate indices, in evaluation order
+		bool init; // Reset the costs before the first candidate
+		bool coarse = false; // Coarse pass: the neighbours of a candidate for the subpixel fit are the previous and next ones
+	};
+
+	/* Costs around the winner of each pixel, for the subpixel fit */
+	struct NeighbourCosts
+	{
+		cv::Mat lower, upper; // Costs of the candidates below and above the winner, -1 if unknown (CV_16SC1)
+		cv::Mat lastLabel, lastCost; // Last candidate evaluated on the pixel in this run, 0 if none (CV_8UC1)
+		// Coarse winner and costs of the coarse candidates before and after it, -1 if unknown, for the refinement
+		cv::Mat coarseLabel; // CV_8UC1
+		cv::Mat coarseLower, coarseUpper; // CV_16SC1
+	};
+
+	/* Run m_regions in parallel, each band buffer taking every m_bands.size()-th region */
+	void sweepRegions(cv::Mat & fullDisparityMap, cv::Mat & minCost, cv::Mat & maxCost, 
+		cv::Mat & reconsImgRectified);
+
+	/* Run the candidates of a region */
+	void sweepRegion(cv::Mat & fullDisparityMap, cv::Mat & minCost, cv::Mat & maxCost, 
+		cv::Mat & reconsImgRectified, Region const & region, BandBuffers & buffers, NeighbourCosts & neighbours) const;
+
+	/* Select the fine candidates of each tile from the coarse labels and set them as m_regions */
+	void refineTiles(cv::Mat const & fullDisparityMap);
+
+	/* Keep the coarse winners and the costs next to them, then reset the neighbour costs for the refinement */
+	void keepCoarseNeighbours(cv::Mat const & fullDisparityMap);
+
+	/* Take the neighbour costs of the refined winners from the coarse pass where the refinement did not evaluate them
+	@param fullDisparityMap refined labels
+	@param coarseCandidates candidates of the coarse pass, in increasing order
+	*/
+	void useCoarseNeighbours(cv::Mat const & fullDisparityMap, std::vector<int> const & coarseCandidates);
+
+	/* Select the candidates of each tile from the previous frame and set them as m_regions */
+	void selectTemporalTiles();
+
+	/* Merge neighbouring tiles of a grid into the regions m_regions when sweeping them together costs less,
+	each region recomputing its own halo. Regions stay at most a band high so that the band buffers share them
+	*/
+	void mergeTiles(std::vector<Region> const & tiles, cv::Size tileGrid, int tileSize);
+
+	/* (pixel, candidate) pairs restored and aggregated to sweep a region, its halo included */
+	double sweptArea(cv::Rect const & area, size_t candidateCount) const;
+
+	/* Swept (pixel, candidate) pairs of regions, halos included, relative to the exhaustive sweep */
+	double evaluatedShare(std::vector<Region> const & regions) const;
+
+	/* Summed area table of the textured pixels of the planar image */
+	void computeGate();
+
+	/* Whether textured pixels can affect an area */
+	bool isTextured(cv::Rect const & area) const;
+
+	/* Two-step restoration of the cost planes on the columns [colBegin, colEnd) of a planar row, 
+	as in DepthEstimator::restoreImage */
+	void restoreRow(const uchar * src, uchar * dst, int d0, int d1, 
+		int colBegin, int colEnd, BandBuffers & buffers) const;
+
+	/* Grey gradient magnitude of the middle row on [greyBegin, greyEnd) 
+	and horizontal box filter on the region columns */
+	void aggregateRow(const uchar * prev, const uchar * curr, const uchar * next, 
+		uchar * dst, int greyBegin, int greyEnd, BandBuffers & buffers) const;
+
+	/* Two-step restoration of one pixel of a row, as restoreRow. 
+	The cols pixels of the row are step bytes apart: 1 for a plane, 3 for a channel of an interleaved row */
+	inline uchar restorePixel(const uchar * src, int step, int cols, int x, int d0, int d1) const;
+
+	/* Produce the restored and horizontally aggregated rows up to the row y */
+	void streamRows(int y, int d0, int d1, BandBuffers & buffers) const;
+
+	/* Initialise a tau scaling */
+	static void setTauScale(float tau, TauScale & scale);
+
+	/* dst = base -/+ tau * (base translated by shift) on [xBegin, xEnd), 
+	the translated row being 0 where undefined */
+	static void combineTranslated(const uchar * base, uchar * dst, int n, int shift, 
+		TauScale const & scale, bool add, int xBegin, int xEnd);
+
+	/// Parameters
+	std::vector<float> m_disparities; // disparity candidates
+	int m_winSize = 1, m_radius = 0; // Window for cost computation
+	float m_invWinSize = 1.f; // Reciprocal giving the rounded window mean by truncation
+	TauScale m_tauScale, m_tau2Scale; // x * tau and x * tau^2 with saturation
+	int m_restoredCount = 0, m_aggregatedCount = 0; // Ring sizes
+	int m_minShift = 0, m_maxShift = 0; // Extreme column offsets of the restoration
+	bool m_luma = false; // Cost on the luma plane
+	bool m_deferredColour = false; // Restore the colour after the sweep
+	SubpixelFit m_subpixelFit = SUBPIXEL_NONE; // Curve fitted for fractional labels
+
+	/// Parallel execution
+	int m_bandCount = 0; // Number of bands, 0 for the number of threads
+	int m_rows = 0, m_cols = 0; // Size of the current image
+	std::vector<uchar> m_planar; // Planar copy of the rectified image, followed by its luma with a luma cost
+	int m_planes = 3; // Planes of m_planar per row
+	int m_costPlane = 0, m_costPlanes = 3; // First plane and number of planes restored for the cost
+	std::vector<BandBuffers> m_bands; // Buffers of each band
+	std::vector<Region> m_regions; // Regions of the current pass
+	NeighbourCosts m_neighbours; // Costs around the winners with a subpixel fit
+	cv::Mat m_subpixelLabels; // Fractional labels of the last run
+
+	/// Hierarchical search
+	int m_stride = 1; // Coarse candidate stride, 1 for the exhaustive sweep
+	int m_tileSize = 256; // Side of the refined tiles
+	float m_minTileShare = 0.02f; // Minimum share of a tile to refine around a coarse winner
+	cv::Size m_tileGrid; // Tiles in each direction
+	std::vector<std::vector<int> > m_tileCandidates; // Fine candidates of each tile
+	double m_evaluatedShare = 1.; // Share of the evaluated (pixel, candidate) pairs
+
+	/// Texture gate
+	int m_gateThresh = -1; // Gradient of a textured pixel, -1 when disabled
+	int m_gateDilation = 0; // Distance to textured pixels of swept pixels
+	int m_gateTileSize = 32; // Side of the gated tiles
+	double m_texturedShare = 1.; // Share of the swept tiles
+	std::vector<int> m_gateSum; // Summed area table of the textured pixels
+
+	/// Temporal search
+	int m_temporalWindow = 0; // Candidates on each side of the previous labels, 0 when disabled
+	int m_temporalTileSize = 64; // Side of the tiles
+	float m_changeThresh = 4.f; // Mean absolute difference of a changed tile
+	int m_minConfidence = 2; // Cost difference of a reliable previous label
+	int m_refreshPeriod = 30; // Frames between full sweeps
+	int m_framesSinceRefresh = 0; // Frames since the last full sweep
+	double m_changedShare = 1.; // Share of the changed tiles
+	cv::Mat m_previousLabels, m_previousMinCost, m_previousMaxCost; // Outputs of the previous frame
+	std::vector<uchar> m_previousPlanar; // Planar rectified image of the previous frame
+
+	/// Profiling
+	bool m_profiling = false;
+	std::vector<double> m_candidateTimes; // Time of each candidate in ms
+};
+
+
+inline std::vector<double> const & CostSweep::getCandidateTimes() const
+{
+	return m_candidateTimes;
+}
+
+inline bool CostSweep::getLumaCost() const
+{
+	return m_luma;
+}
+
+inline bool CostSweep::getDeferredColour() const
+{
+	return m_deferredColour;
+}
+
+inline CostSweep::SubpixelFit CostSweep::getSubpixelFit() const
+{
+	return m_subpixelFit;
+}
+
+inline cv::Mat const & CostSweep::getSubpixelLabels() const
+{
+	return m_subpixelLabels;
+}
+
+inline std::vector<std::vector<int> > const & CostSweep::getTileCandidates() const
+{
+	return m_tileCandidates;
+}
+
+inline cv::Size CostSweep::getTileGrid() const
+{
+	return m_tileGrid;
+}
+
+inline double CostSweep::getEvaluatedShare() const
+{
+	return m_evaluatedShare;
+}
+
+inline double CostSweep::getTexturedShare() const
+{
+	return m_texturedShare;
+}
+
+inline void CostSweep::getShiftRange(int & minShift, int & maxShift) const
+{
+	minShift = m_minShift;
+	maxShift = m_maxShift;
+}
+
+inline double CostSweep::getChangedShare() const
+{
+	return m_changedShare;
+}
+#endif // COSTSWEEP_H
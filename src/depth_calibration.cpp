@@ -0,0 +1,222 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include "depth_calibration.h"
+#include "depth_estimator.h"
+#include "bilateral_filter_source.h"
+#include "cost_sweep_source.h"
+
+#include <opencv2/core/utils/filesystem.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace
+{
+	const char PROGRAM_CACHE_MAGIC[8] = { 'U', 'R', 'G', 'B', 'D', 'O', 'C', 'L' };
+
+	// FNV-1a, naming the cache file of a key
+	uint64_t hashKey(std::string const & key)
+	{
+		uint64_t hash(14695981039346656037ull);
+		for (size_t i(0); i < key.size(); i++)
+		{
+			hash = (hash ^ uint64_t(uchar(key[i]))) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	/* Read a program binary written by writeProgramBinary: the magic, the key it was compiled for and the binary. 
+	Fails if the file is missing or was compiled for another key */
+	bool readProgramBinary(std::string const & path, std::string const & key, std::vector<char> & binary)
+	{
+		std::ifstream file(path, std::ios::binary);
+		char magic[sizeof(PROGRAM_CACHE_MAGIC)];
+		uint64_t keySize, binarySize;
+		if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, PROGRAM_CACHE_MAGIC, sizeof(magic)) != 0 || 
+			!file.read(reinterpret_cast<char *>(&keySize), sizeof(keySize)) || keySize != key.size())
+		{
+			return false;
+		}
+		std::string fileKey(size_t(keySize), '\0');
+		if (!file.read(&fileKey[0], std::streamsize(keySize)) || fileKey != key || 
+			!file.read(reinterpret_cast<char *>(&binarySize), sizeof(binarySize)) || binarySize == 0 || binarySize > (1u << 30))
+		{
+			return false;
+		}
+		binary.resize(size_t(binarySize));
+		return bool(file.read(binary.data(), std::streamsize(binarySize)));
+	}
+
+	/* Write a program binary with its key. The file is written under a temporary name then renamed, 
+	so that processes starting concurrently never read a partial file */
+	bool writeProgramBinary(std::string const & path, std::string const & key, std::vector<char> const & binary)
+	{
+		std::string temporary(path + "." + std::to_string(cv::getTickCount()) + ".tmp");
+		{
+			std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+			uint64_t keySize(key.size()), binarySize(binary.size());
+			file.write(PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC));
+			file.write(reinterpret_cast<const char *>(&keySize), sizeof(keySize));
+			file.write(key.data(), std::streamsize(keySize));
+			file.write(reinterpret_cast<const char *>(&binarySize), sizeof(binarySize));
+			file.write(binary.data(), std::streamsize(binarySize));
+			if (!file.flush())
+			{
+				file.close();
+				std::remove(temporary.c_str());
+				return false;
+			}
+		}
+		// Another process may have written the same binary in the meantime
+		if (std::rename(temporary.c_str(), path.c_str()) != 0)
+		{
+			std::remove(temporary.c_str());
+			return false;
+		}
+		return true;
+	}
+}
+
+DepthCalibration::DepthCalibration(std::shared_ptr<RectificationCache> const & tables,
+	float minZ, float maxZ, float disparityCoef, float tau,
+	int winSize, unsigned char threshGrad, unsigned char threshCost, int deviceTypes) :
+	m_tables(tables),
+	m_disparityCoef(tables->getUpsampling() * disparityCoef),
+	m_tau(tau),
+	m_winSize(int(tables->getUpsampling() * winSize) + 1 - (int(tables->getUpsampling() * winSize) % 2)),
+	m_threshGrad(threshGrad),
+	m_threshCost(threshCost)
+{
+	CV_Assert(!m_tables->empty());
+
+	// The UMat headers share the memory of the tables
+	for (int t(0); t < RectificationCache::TABLE_COUNT; t++)
+	{
+		m_tableImages[t] = m_tables->getTable(RectificationCache::Table(t)).getUMat(cv::ACCESS_READ);
+	}
+
+	// Create the depth candidates 
+	m_disparities = DepthEstimator::depthCandidates(minZ, maxZ, m_disparityCoef);
+
+	/// Bilateral filter with confidence map
+	m_bilateralFilter = SparseBilateralFilter(m_filterRadius, 5.f, 20.f);
+
+	// The kernels run on the images of the default context, whatever its device type if accepted
+	cv::ocl::Context & context(cv::ocl::Context::getDefault());
+	if (!cv::ocl::useOpenCL() || context.ndevices() == 0 || !(context.device(0).type() & deviceTypes))
+	{
+		std::cout << "No OpenCL device, depth filtering will run on the CPU" << std::endl;
+		return;
+	}
+	m_deviceType = context.device(0).type();
+	compileFilter(context);
+	m_programSweep = buildProgram(context, "cost_sweep", 
+		std::string(reinterpret_cast<const char *>(COST_SWEEP_SOURCE), sizeof(COST_SWEEP_SOURCE) - 1), "");
+}
+
+void DepthCalibration::compileFilter(cv::ocl::Context & context)
+{
+	// Filter and indices shared with the CPU implementation, 
+	// for the continuous sparse disparity map of the full frame
+	size_t step(size_t(m_tableImages[RectificationCache::TABLE_INV_MASK1].cols));
+	int index(m_bilateralFilter.getSize());
+	std::vector<float> space_weight(m_bilateralFilter.getSpaceWeights());
+	std::vector<int> space_ofs1(m_bilateralFilter.getOffsets(step, 1)), 
+		space_ofs3(m_bilateralFilter.getOffsets(step, 3));
+
+	// Create the kernel and index matrices
+	cv::Mat(1, index, CV_32FC1, &space_weight[0]).copyTo(m_spaceWeight);
+	cv::Mat(1, index, CV_32SC1, &space_ofs1[0]).copyTo(m_filterIndCn1);
+	cv::Mat(1, index, CV_32SC1, &space_ofs3[0]).copyTo(m_filterIndCn3);
+
+	// Source embedded at build time
+	std::string source(reinterpret_cast<const char *>(BILATERAL_FILTER_SOURCE), sizeof(BILATERAL_FILTER_SOURCE) - 1);
+	std::string options(" -D FILTER_SIZE=" + std::to_string(index)
+		+ " -D RADIUS=" + std::to_string(m_filterRadius)
+		+ " -D GUIDE_COEFF=" + std::to_string(m_bilateralFilter.getGuideCoeff()));
+	m_programBilateral = buildProgram(context, "bilateral_filter", source, options);
+}
+
+cv::ocl::Program DepthCalibration::buildProgram(cv::ocl::Context & context, std::string const & name, 
+	std::string const & source, std::string const & options)
+{
+	// A binary is only valid for the device, driver, options and source it was compiled for
+	cv::ocl::Device const & device(context.device(0));
+	std::string key(device.vendorName() + "\n" + device.name() + "\n" + device.version() + "\n" 
+		+ device.driverVersion() + "\n" + options + "\n" + source);
+	std::string directory(cv::utils::fs::getCacheDirectory("uneven_rgbd_opencl", "UNEVEN_RGBD_OPENCL_CACHE_DIR")), path;
+	if (!directory.empty() && directory != "disabled")
+	{
+		char file[64];
+		std::snprintf(file, sizeof(file), "%s_%016llx.bin", name.c_str(), (unsigned long long)hashKey(key));
+		path = cv::utils::fs::join(directory, file);
+	}
+
+	// Cached binary of an earlier start
+	cv::String errmsg;
+	std::vector<char> binary;
+	if (!path.empty() && readProgramBinary(path, key, binary))
+	{
+		cv::ocl::Program program(context.getProg(cv::ocl::ProgramSource::fromBinary("uneven_rgbd", name, 
+			reinterpret_cast<const uchar *>(binary.data()), binary.size(), options), options, errmsg));
+		if (!program.empty())
+			return program;
+	}
+
+	// Compile the kernel code and cache its binary
+	cv::ocl::Program program(context.getProg(cv::ocl::ProgramSource(source), options, errmsg));
+	std::cout << errmsg;
+	if (!path.empty() && !program.empty() && program.getBinary(binary) && !binary.empty())
+	{
+		if (!cv::utils::fs::exists(directory))
+			cv::utils::fs::createDirectories(directory);
+		writeProgramBinary(path, key, binary);
+	}
+	return program;
+}
+
+size_t DepthCalibration::getBytes() const
+{
+	size_t bytes(0);
+	for (int t(0); t < RectificationCache::TABLE_COUNT; t++)
+	{
+		cv::Mat const & table(m_tables->getTable(RectificationCache::Table(t)));
+		bytes += table.total() * table.elemSize();
+	}
+	return bytes + m_spaceWeight.total() * m_spaceWeight.elemSize() 
+		+ m_filterIndCn1.total() * m_filterIndCn1.elemSize() + m_filterIndCn3.total() * m_filterIndCn3.elemSize();
+}
@@ -0,0 +1,262 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#ifndef DEPTHCALIBRATION_H
+#define DEPTHCALIBRATION_H
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/ocl.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rectification_cache.h"
+#include "sparse_bilateral_filter.h"
+
+/* @class DepthCalibration
+@brief Read-only data of a camera shared by the DepthEstimator instances processing its frames: 
+rectification tables, depth candidates and thresholds, bilateral filter weights and the compiled OpenCL programs.
+Built once, then handed to each estimator through a std::shared_ptr; the estimators only hold 
+headers on its images and allocate their per-frame buffers, so that many of them, 
+e.g. one per stream or worker thread, share the memory of the tables and skip the OpenCL compilation.
+Nothing is modified after construction: estimators on different threads can read it concurrently.
+*/
+class DepthCalibration
+{
+public:
+	/* @brief Set the parameters shared by the estimators, create the depth candidates and compile the filter
+	@param tables fixed-point rectification tables, giving upsampling and scaleMask
+	@param minZ Lowest depth candidate
+	@param maxZ Largest depth candidate
+	@param disparityCoef f * baseline such as disparity_{o->e} = disparityCoef * 1 / depth
+	in the horizontal direction. 
+	@param tau intensity proportion between e-ray and o-ray: I_captured = tau * I_e + I_o, 0 < tau < 1
+	@param winSize Window size for cost computation
+	@param threshGrad Mask out in the disparity map areas with lower gradient in the reconstructed image
+	@param threshCost Mask out in the disparity map areas with lower cost difference between the minimum and maximum
+	@param deviceTypes cv::ocl::Device types the programs are compiled for. They are built for the default 
+	OpenCL device of OpenCV, where the UMat images live, selected with the OPENCV_OPENCL_DEVICE variable: 
+	e.g. ":CPU:" on nodes without GPU, with a CPU runtime such as PoCL
+	*/
+	DepthCalibration(std::shared_ptr<RectificationCache> const & tables,
+		float minZ, float maxZ, float disparityCoef, float tau,
+		int winSize = 61, unsigned char threshGrad = 190, unsigned char threshCost = 4,
+		int deviceTypes = cv::ocl::Device::TYPE_ALL);
+
+	// Not copyable, shared through std::shared_ptr
+	DepthCalibration(DepthCalibration const &) = delete;
+	DepthCalibration & operator=(DepthCalibration const &) = delete;
+
+	/* @brief Get the rectification tables
+	@return tables the images of getTable() are headers on
+	*/
+	inline std::shared_ptr<RectificationCache> const & getTables() const;
+
+	/* @brief Get a rectification table as an image shared by the estimators
+	@param table table index
+	@return read-only header on the table
+	*/
+	inline cv::UMat const & getTable(RectificationCache::Table table) const;
+
+	/* @brief Get the disparity candidates, at the upsampled resolution */
+	inline std::vector<float> const & getDisparities() const;
+
+	/* @brief Get f * baseline at the upsampled resolution */
+	inline float getDisparityCoef() const;
+
+	/* @brief Get the intensity proportion between e-ray and o-ray */
+	inline float getTau() const;
+
+	/* @brief Get the window size for cost computation at the upsampled resolution (odd) */
+	inline int getWinSize() const;
+
+	/* @brief Get the gradient threshold of the mask computation */
+	inline unsigned char getThreshGrad() const;
+
+	/* @brief Get the cost difference threshold of the mask computation */
+	inline unsigned char getThreshCost() const;
+
+	/* @brief Get the weights of the bilateral filter, copied by the estimators for their CPU filtering */
+	inline SparseBilateralFilter const & getBilateralFilter() const;
+
+	/* @brief Get the type of the OpenCL device the programs are compiled for
+	@return cv::ocl::Device type, 0 without OpenCL device of the accepted types
+	*/
+	inline int getDeviceType() const;
+
+	/* @brief Get whether an OpenCL device was found and the bilateral filter compiled */
+	inline bool hasOpenCLFilter() const;
+
+	/* @brief Get the compiled "bilateral_filter.cl" program, empty without OpenCL device. 
+	The source is embedded at build time, and the binary cached on disk after the first compilation for a device */
+	inline cv::ocl::Program const & getBilateralProgram() const;
+
+	/* @brief Get whether an OpenCL device was found and the candidate sweep compiled */
+	inline bool hasOpenCLSweep() const;
+
+	/* @brief Get the compiled "cost_sweep.cl" program, empty without OpenCL device. 
+	Embedded and cached as the bilateral filter */
+	inline cv::ocl::Program const & getSweepProgram() const;
+
+	/* @brief Get the spatial weights of the bilateral filter for the OpenCL kernel (CV_32FC1) */
+	inline cv::UMat const & getSpaceWeight() const;
+
+	/* @brief Get the neighbour offsets of the bilateral filter in the full frame disparity map (CV_32SC1) */
+	inline cv::UMat const & getFilterIndCn1() const;
+
+	/* @brief Get the neighbour offsets of the bilateral filter in the full frame guide image (CV_32SC1) */
+	inline cv::UMat const & getFilterIndCn3() const;
+
+	/* @brief Get the bytes of the tables and filter weights, shared by the estimators */
+	size_t getBytes() const;
+
+private:
+	/* Compile the embedded "bilateral_filter.cl" code for disparity map filtering */
+	void compileFilter(cv::ocl::Context & context);
+
+	/* Compile an embedded program, or load its binary from the cache of an earlier compilation 
+	for the same device, driver, options and source
+	@param name name of the program, prefix of its cache files
+	@return compiled program, empty on failure
+	*/
+	static cv::ocl::Program buildProgram(cv::ocl::Context & context, std::string const & name, 
+		std::string const & source, std::string const & options);
+
+	static const int m_filterSize = 21, m_filterRadius = m_filterSize / 2;
+
+	std::shared_ptr<RectificationCache> m_tables;
+	cv::UMat m_tableImages[RectificationCache::TABLE_COUNT]; // Headers sharing the memory of m_tables
+	std::vector<float> m_disparities; // disparity candidates
+	float m_disparityCoef; // Horizontal f*baseline at the upsampled resolution
+	float m_tau; // intensity proportion between e-ray and o-ray
+	int m_winSize; // Window for cost computation
+	unsigned char m_threshGrad; // Threshold for vertical edges in mask computation
+	unsigned char m_threshCost; // Threshold for clear winner in mask computation
+
+	int m_deviceType = 0; // Type of the OpenCL device of the programs, 0 without
+
+	/// Disparity map filtering
+	SparseBilateralFilter m_bilateralFilter; // Filter weights
+	cv::ocl::Program m_programBilateral; // Compiled filter, empty without OpenCL device
+	// weights and indices for disparity map filtering
+	cv::UMat m_spaceWeight, m_filterIndCn1, m_filterIndCn3;
+
+	cv::ocl::Program m_programSweep; // Compiled candidate sweep, empty without OpenCL device
+};
+
+
+inline std::shared_ptr<RectificationCache> const & DepthCalibration::getTables() const
+{
+	return m_tables;
+}
+
+inline cv::UMat const & DepthCalibration::getTable(RectificationCache::Table table) const
+{
+	return m_tableImages[table];
+}
+
+inline std::vector<float> const & DepthCalibration::getDisparities() const
+{
+	return m_disparities;
+}
+
+inline float DepthCalibration::getDisparityCoef() const
+{
+	return m_disparityCoef;
+}
+
+inline float DepthCalibration::getTau() const
+{
+	return m_tau;
+}
+
+inline int DepthCalibration::getWinSize() const
+{
+	return m_winSize;
+}
+
+inline unsigned char DepthCalibration::getThreshGrad() const
+{
+	return m_threshGrad;
+}
+
+inline unsigned char DepthCalibration::getThreshCost() const
+{
+	return m_threshCost;
+}
+
+inline SparseBilateralFilter const & DepthCalibration::getBilateralFilter() const
+{
+	return m_bilateralFilter;
+}
+
+inline int DepthCalibration::getDeviceType() const
+{
+	return m_deviceType;
+}
+
+inline bool DepthCalibration::hasOpenCLFilter() const
+{
+	return !m_programBilateral.empty();
+}
+
+inline cv::ocl::Program const & DepthCalibration::getBilateralProgram() const
+{
+	return m_programBilateral;
+}
+
+inline bool DepthCalibration::hasOpenCLSweep() const
+{
+	return !m_programSweep.empty();
+}
+
+inline cv::ocl::Program const & DepthCalibration::getSweepProgram() const
+{
+	return m_programSweep;
+}
+
+inline cv::UMat const & DepthCalibration::getSpaceWeight() const
+{
+	return m_spaceWeight;
+}
+
+inline cv::UMat const & DepthCalibration::getFilterIndCn1() const
+{
+	return m_filterIndCn1;
+}
+
+inline cv::UMat const & DepthCalibration::getFilterIndCn3() const
+{
+	return m_filterIndCn3;
+}
+#endif // DEPTHCALIBRATION_H
@@ -33,17 +33,77 @@ SOFTWARE.
 
 #include "depth_estimator.h"
 
-#include <iostream>
-#include <fstream>
+#include <opencv2/core/hal/intrin.hpp>
+
+#include <algorithm>
+#include <cfloat>
+
+namespace
+{
+	std::shared_ptr<RectificationCache> buildTables(cv::UMat const & tformInd, cv::UMat const & invInd,
+		float upsampling, double scaleMask)
+	{
+		std::shared_ptr<RectificationCache> tables(std::make_shared<RectificationCache>());
+		tables->build(tformInd, invInd, upsampling, scaleMask);
+		return tables;
+	}
+
+	// Steps of a candidate of the cv:: sweep, giving the live ranges of its images
+	enum SweepStep
+	{
+		SWEEP_RESTORE, // Restoration of the candidate
+		SWEEP_GRADIENT, // Gradient cost
+		SWEEP_AGGREGATE, // Window aggregation
+		SWEEP_SELECT // Winner selection and merging
+	};
+
+	// Steps of the unwarp, mask and filter stages, giving the live ranges of their images
+	enum TailStep
+	{
+		TAIL_UNWARP, // Reverse rectification
+		TAIL_CONFIDENCE, // Cost difference threshold
+		TAIL_DISPLACE, // Map displacement
+		TAIL_EDGES, // Edges of the restored image
+		TAIL_FILTER // Filtering
+	};
+
+	size_t imageBytes(cv::UMat const & img)
+	{
+		return img.total() * img.elemSize();
+	}
+
+	// Images allocated by initFrame and the stages, the input image belongs to the caller
+	size_t frameBytes(DepthEstimator::FrameBuffers const & frame)
+	{
+		return imageBytes(frame.imgRectified) + imageBytes(frame.reconsImgRectified) + imageBytes(frame.fullDisparityMap)
+			+ imageBytes(frame.minCost) + imageBytes(frame.maxCost) + imageBytes(frame.reconsImg) 
+			+ imageBytes(frame.sparseDisparityMap) + imageBytes(frame.subDisparityMap) + imageBytes(frame.sparseSubDisparityMap)
+			+ frame.points.capacity() * sizeof(DepthEstimator::SparsePoint);
+	}
+}
 
 DepthEstimator::DepthEstimator(cv::UMat const & tformInd, cv::UMat const & invInd, 
 	float minZ, float maxZ, float disparityCoef, float tau, float upsampling,
 	double scaleMask, int winSize, unsigned char threshGrad, unsigned char threshCost):
-	m_tau(tau),
-	m_winSize(int(upsampling * winSize) + 1 - (int(upsampling * winSize) % 2)),
-	m_threshGrad(threshGrad),
-	m_threshCost(threshCost),
-	m_disparityCoef(upsampling * disparityCoef),
+	DepthEstimator(buildTables(tformInd, invInd, upsampling, scaleMask), 
+		minZ, maxZ, disparityCoef, tau, winSize, threshGrad, threshCost)
+{
+}
+
+DepthEstimator::DepthEstimator(std::shared_ptr<RectificationCache> const & tables,
+	float minZ, float maxZ, float disparityCoef, float tau,
+	int winSize, unsigned char threshGrad, unsigned char threshCost):
+	DepthEstimator(std::make_shared<DepthCalibration>(tables, 
+		minZ, maxZ, disparityCoef, tau, winSize, threshGrad, threshCost))
+{
+}
+
+DepthEstimator::DepthEstimator(std::shared_ptr<const DepthCalibration> const & calibration):
+	m_tau(calibration->getTau()),
+	m_winSize(calibration->getWinSize()),
+	m_threshGrad(calibration->getThreshGrad()),
+	m_threshCost(calibration->getThreshCost()),
+	m_disparityCoef(calibration->getDisparityCoef()),
 	m_kernelGrad1((cv::Mat_<float>(3, 3) << 
 		-6, 0, 6,
 		-20, 0, 20,
@@ -51,74 +111,193 @@ DepthEstimator::DepthEstimator(cv::UMat const & tformInd, cv::UMat const & invIn
 	m_kernelGrad2((cv::Mat_<float>(3, 3) << 
 		6, 0, -6,
 		20, 0, -20,
-		6, 0, -6))
-{
-	// Resize and optimise LuTs
-	cv::UMat invIndMask, invIndHandle, tformIndHandle;
-	cv::multiply(invInd, upsampling, invIndHandle);
-	cv::resize(invIndHandle, invIndMask, cv::Size(), scaleMask, scaleMask);
-	cv::resize(tformInd, tformIndHandle, cv::Size(), double(upsampling), double(upsampling));
-
-	cv::convertMaps(invIndHandle, cv::noArray(), m_invInd1, m_invInd2, CV_16SC2);
-	cv::convertMaps(tformIndHandle, cv::noArray(), m_tformInd1, m_tformInd2, CV_16SC2);
-	cv::convertMaps(invIndMask, cv::noArray(), m_invIndMask1, m_invIndMask2, CV_16SC2);
-
-	// Create the depth candidates 
-	float a(m_disparityCoef / maxZ), b(m_disparityCoef / minZ);
-	m_zCount = a - b + 1.5;
-	float step((b - a) / (m_zCount - 1));
-	m_disparities.resize(m_zCount);
-	for (int i(0); i < m_zCount; i++)
-	{
-		m_disparities[i] = a + i * step;
-	}
-
-	// Initialise the restored images and cost
-	m_img = cv::UMat::zeros(m_invInd1.size(), CV_8UC3);
-	m_imgRectified = cv::UMat::zeros(m_tformInd1.size(), CV_8UC3);
-	m_reconsImg = cv::UMat::zeros(m_invInd1.size(), CV_8UC3);
-	m_reconsImgRectified = cv::UMat::zeros(m_tformInd1.size(), CV_8UC3);
-	m_translatedImg = cv::UMat::zeros(m_tformInd1.size(), CV_8UC3);
-	m_reconsImgCandidate = cv::UMat::zeros(m_tformInd1.size(), CV_8UC3);
-
-	m_cost = cv::UMat::zeros(m_tformInd1.size(), CV_8UC1);
-	m_costHandle = cv::UMat::zeros(m_tformInd1.size(), CV_8UC1);
-	m_costrgb1 = cv::UMat::zeros(m_tformInd1.size(), CV_8UC3);
-	m_costrgb2 = cv::UMat::zeros(m_tformInd1.size(), CV_8UC3);
-	m_minCost = cv::UMat::zeros(m_tformInd1.size(), CV_8UC1);
-	m_maxCost = cv::UMat::zeros(m_tformInd1.size(), CV_8UC1);
-	m_maskBest = cv::UMat::zeros(m_tformInd1.size(), CV_8UC1);
-
-	m_fullDisparityMap = cv::UMat::zeros(m_tformInd1.size(), CV_8UC1);
-	m_sparseDisparityMap = cv::UMat::zeros(m_invIndMask1.size(), CV_8UC1);
-	m_fullDisparityMapConf = cv::UMat::zeros(m_invIndMask1.size(), CV_8UC1);
-
-	m_confidence = cv::UMat::zeros(m_invIndMask1.size(), CV_8UC1);
-	m_reconsImgConf = cv::UMat::zeros(m_invIndMask1.size(), CV_8UC3);
-	m_minCostConf = cv::UMat::zeros(m_invIndMask1.size(), CV_8UC1);
-	m_edges1Conf = cv::UMat::zeros(m_invIndMask1.size(), CV_8UC3);
-	m_edges2Conf = cv::UMat::zeros(m_invIndMask1.size(), CV_8UC3);
-	m_edgesGreyConf = cv::UMat::zeros(m_invIndMask1.size(), CV_8UC1);
-	m_handle = cv::UMat::zeros(m_invIndMask1.size(), CV_8UC1);
-	m_maskConfidence = cv::UMat::zeros(m_invIndMask1.size(), CV_8UC1);
-
-	/// Bilateral filter with confidence map
-	cv::ocl::Context context;
-	if (!context.create(cv::ocl::Device::TYPE_GPU))
-	{
-		std::cout << "Failed creating the context, depth filtering will be skipped" << std::endl;
-		m_disparityFiltering = false;
+		6, 0, -6)),
+	m_kernelErode(cv::Mat::ones(2, 2, CV_8UC1)),
+	m_calibration(calibration)
+{
+	// Headers on the tables of the calibration, shared by its estimators
+	m_tformInd1 = m_calibration->getTable(RectificationCache::TABLE_TFORM1);
+	m_tformInd2 = m_calibration->getTable(RectificationCache::TABLE_TFORM2);
+	m_invInd1 = m_calibration->getTable(RectificationCache::TABLE_INV1);
+	m_invInd2 = m_calibration->getTable(RectificationCache::TABLE_INV2);
+	m_invIndMask1 = m_calibration->getTable(RectificationCache::TABLE_INV_MASK1);
+	m_invIndMask2 = m_calibration->getTable(RectificationCache::TABLE_INV_MASK2);
+
+	// Depth candidates of the calibration, until setCandidateSpacing
+	m_disparities = m_calibration->getDisparities();
+	m_zCount = int(m_disparities.size());
+	m_costSweep = CostSweep(m_disparities, m_tau, m_winSize);
+	m_costSweep.getShiftRange(m_minShift, m_maxShift);
+	updateOutputTables();
+	updateSweepTables();
+
+	m_fullGeometry.roi = cv::Rect(cv::Point(), m_invInd1.size());
+	m_fullGeometry.roiMask = cv::Rect(cv::Point(), m_invIndMask1.size());
+	m_fullGeometry.rectified = cv::Rect(cv::Point(), m_tformInd1.size());
+	m_fullGeometry.tformInd1 = m_tformInd1;
+	m_fullGeometry.tformInd2 = m_tformInd2;
+	m_fullGeometry.invInd1 = m_invInd1;
+	m_fullGeometry.invInd2 = m_invInd2;
+	m_fullGeometry.invIndMask1 = m_invIndMask1;
+	m_fullGeometry.invIndMask2 = m_invIndMask2;
+
+	// Initialise the restored images and cost. The temporary images of the stages are planned 
+	// with the engines below and allocated by the first frame
+	initFrame(m_frame);
+
+	/// Bilateral filter with confidence map and OpenCL sweep, compiled once by the calibration. 
+	// On a CPU OpenCL device, the CPU implementations are selected by default
+	m_bilateralFilter = m_calibration->getBilateralFilter();
+	m_filterEngine = FILTER_CPU;
+	if (m_calibration->hasOpenCLFilter())
+	{
+		m_kernelBilateral = cv::ocl::Kernel("bilateralFilter", m_calibration->getBilateralProgram());
+		m_spaceWeight = m_calibration->getSpaceWeight();
+		m_fullGeometry.filterIndCn1 = m_calibration->getFilterIndCn1();
+		m_fullGeometry.filterIndCn3 = m_calibration->getFilterIndCn3();
+		if (m_calibration->getDeviceType() & cv::ocl::Device::TYPE_GPU)
+			m_filterEngine = FILTER_OPENCL;
 	}
-	else
+	if (m_calibration->hasOpenCLSweep())
+		m_kernelSweep = cv::ocl::Kernel("costSweep", m_calibration->getSweepProgram());
+
+	// Without GPU, the fused sweep avoids the memory traffic of the cv:: calls
+	m_sweepEngine = m_filterEngine == FILTER_OPENCL ? SWEEP_OPENCV : SWEEP_CPU_FUSED;
+	planScratch();
+}
+
+void DepthEstimator::planScratch()
+{
+	// Images of the cv:: chain at the rectified size, the fused sweep has its own buffers. 
+	// Candidates are evaluated one after the other: images of different steps share memory
+	cv::Size rectified(m_tformInd1.size()), conf(m_invIndMask1.size());
+	bool fit(m_subpixelFit != CostSweep::SUBPIXEL_NONE);
+	Scratch & s(m_sweepScratch);
+	s.arena.clear();
+	s.views.clear();
+	if (m_sweepEngine == SWEEP_OPENCV)
+	{
+		if (m_costMode == COST_RGB || !m_deferredColour)
+		{
+			addScratch(s, &DepthEstimator::m_translatedImg, CV_8UC3, rectified, SWEEP_RESTORE, SWEEP_RESTORE);
+			addScratch(s, &DepthEstimator::m_reconsImgCandidate, CV_8UC3, rectified, 
+				SWEEP_RESTORE, m_deferredColour ? SWEEP_GRADIENT : SWEEP_SELECT);
+		}
+		if (m_costMode == COST_LUMA)
+		{
+			// The luma of the rectified image is converted once before the candidates
+			addScratch(s, &DepthEstimator::m_imgLuma, CV_8UC1, rectified, SWEEP_RESTORE, SWEEP_SELECT);
+			addScratch(s, &DepthEstimator::m_translatedLuma, CV_8UC1, rectified, SWEEP_RESTORE, SWEEP_RESTORE);
+			addScratch(s, &DepthEstimator::m_reconsLumaCandidate, CV_8UC1, rectified, SWEEP_RESTORE, SWEEP_GRADIENT);
+		}
+		else
+		{
+			addScratch(s, &DepthEstimator::m_costrgb1, CV_8UC3, rectified, SWEEP_GRADIENT, SWEEP_GRADIENT);
+			addScratch(s, &DepthEstimator::m_costrgb2, CV_8UC3, rectified, SWEEP_GRADIENT, SWEEP_GRADIENT);
+		}
+		addScratch(s, &DepthEstimator::m_cost, CV_8UC1, rectified, SWEEP_GRADIENT, SWEEP_SELECT);
+		addScratch(s, &DepthEstimator::m_costHandle, CV_8UC1, rectified, SWEEP_GRADIENT, SWEEP_AGGREGATE);
+		addScratch(s, &DepthEstimator::m_maskBest, CV_8UC1, rectified, SWEEP_SELECT, SWEEP_SELECT);
+		if (fit)
+		{
+			// Kept from one candidate to the next
+			addScratch(s, &DepthEstimator::m_lowerCost, CV_16SC1, rectified, SWEEP_RESTORE, SWEEP_SELECT);
+			addScratch(s, &DepthEstimator::m_upperCost, CV_16SC1, rectified, SWEEP_RESTORE, SWEEP_SELECT);
+			addScratch(s, &DepthEstimator::m_cost16, CV_16SC1, rectified, SWEEP_RESTORE, SWEEP_SELECT);
+			addScratch(s, &DepthEstimator::m_previousCost16, CV_16SC1, rectified, SWEEP_RESTORE, SWEEP_SELECT);
+			addScratch(s, &DepthEstimator::m_maskNeighbour, CV_8UC1, rectified, SWEEP_SELECT, SWEEP_SELECT);
+		}
+	}
+	else if (m_sweepEngine == SWEEP_OPENCL && fit)
+	{
+		// Written by the kernel, the only images of its sweep
+		addScratch(s, &DepthEstimator::m_lowerCost, CV_16SC1, rectified, SWEEP_SELECT, SWEEP_SELECT);
+		addScratch(s, &DepthEstimator::m_upperCost, CV_16SC1, rectified, SWEEP_SELECT, SWEEP_SELECT);
+	}
+	s.arena.plan();
+
+	// Images of the confidence estimation, at the size of the mask
+	Scratch & t(m_tailScratch);
+	t.arena.clear();
+	t.views.clear();
+	addScratch(t, &DepthEstimator::m_reconsImgConf, CV_8UC3, conf, TAIL_UNWARP, TAIL_FILTER);
+	addScratch(t, &DepthEstimator::m_fullDisparityMapConf, CV_8UC1, conf, TAIL_UNWARP, TAIL_FILTER);
+	addScratch(t, &DepthEstimator::m_confidence, CV_8UC1, conf, TAIL_UNWARP, TAIL_EDGES);
+	addScratch(t, &DepthEstimator::m_minCostConf, CV_8UC1, conf, TAIL_UNWARP, TAIL_CONFIDENCE);
+	addScratch(t, &DepthEstimator::m_maskConfidence, CV_8UC1, conf, TAIL_CONFIDENCE, TAIL_FILTER);
+	addScratch(t, &DepthEstimator::m_handle, CV_8UC1, conf, TAIL_DISPLACE, TAIL_DISPLACE);
+	addScratch(t, &DepthEstimator::m_edges1Conf, CV_8UC3, conf, TAIL_EDGES, TAIL_EDGES);
+	addScratch(t, &DepthEstimator::m_edges2Conf, CV_8UC3, conf, TAIL_EDGES, TAIL_EDGES);
+	addScratch(t, &DepthEstimator::m_edgesGreyConf, CV_8UC1, conf, TAIL_EDGES, TAIL_EDGES);
+	if (fit)
+	{
+		addScratch(t, &DepthEstimator::m_subDisparityMapConf, CV_32FC1, conf, TAIL_UNWARP, TAIL_FILTER);
+		addScratch(t, &DepthEstimator::m_subHandle, CV_32FC1, conf, TAIL_DISPLACE, TAIL_DISPLACE);
+	}
+	t.arena.plan();
+}
+
+void DepthEstimator::addScratch(Scratch & scratch, cv::UMat DepthEstimator::* image, int type, cv::Size size, int first, int last)
+{
+	scratch.views.push_back(std::make_pair(scratch.arena.add(type, size, first, last), image));
+}
+
+void DepthEstimator::bindScratch(Scratch & scratch, cv::Size size)
+{
+	scratch.arena.allocate();
+	for (size_t i(0); i < scratch.views.size(); i++)
+	{
+		scratch.arena.bind(scratch.views[i].first, size, this->*scratch.views[i].second);
+	}
+}
+
+void DepthEstimator::releaseScratch()
+{
+	m_sweepScratch.arena.release();
+	m_tailScratch.arena.release();
+	// The views hold the memory too
+	Scratch * scratches[2] = { &m_sweepScratch, &m_tailScratch };
+	for (int s(0); s < 2; s++)
+	{
+		for (size_t i(0); i < scratches[s]->views.size(); i++)
+		{
+			(this->*scratches[s]->views[i].second).release();
+		}
+	}
+}
+
+DepthEstimator::MemoryFootprint DepthEstimator::getMemoryFootprint() const
+{
+	MemoryFootprint footprint;
+	footprint.frames = frameBytes(m_frame);
+	for (size_t i(0); i < m_roiFrames.size(); i++)
 	{
-		readAndCompileFilter(context);
+		footprint.frames += frameBytes(m_roiFrames[i]);
 	}
+	footprint.scratch = m_sweepScratch.arena.getBytes() + m_tailScratch.arena.getBytes();
+	footprint.scratchUnaliased = m_sweepScratch.arena.getUnaliasedBytes() + m_tailScratch.arena.getUnaliasedBytes();
+	footprint.outputs = imageBytes(m_depth) + imageBytes(m_subpixelDepth) + imageBytes(m_outputMask) 
+		+ imageBytes(m_disparityMap);
+	for (size_t i(0); i < m_roiDepths.size(); i++)
+	{
+		footprint.outputs += imageBytes(m_roiDepths[i]);
+	}
+	footprint.cpu = m_costSweep.getBytes() + m_bilateralFilter.getBytes();
+	for (size_t b(0); b < m_pointBands.size(); b++)
+	{
+		footprint.cpu += m_pointBands[b].capacity() * sizeof(SparsePoint);
+	}
+	footprint.shared = m_calibration->getBytes();
+	footprint.steady = footprint.frames + footprint.outputs + footprint.cpu;
+	footprint.peak = footprint.steady + footprint.scratch;
+	return footprint;
 }
 
 void DepthEstimator::restoreImage(float disparity, float tauLocal, cv::UMat const & imgRectified, 
 	cv::UMat & translatedImg, cv::UMat & reconsImgCandidate)
 {
 	imgRectified.copyTo(reconsImgCandidate);
+	translatedImg.create(imgRectified.size(), imgRectified.type());
 
 	for (int k(0); k < 2; k++)
 	{
@@ -128,16 +307,19 @@ void DepthEstimator::restoreImage(float disparity, float tauLocal, cv::UMat cons
 			int d(disparity - 0.5);
 			reconsImgCandidate(cv::Rect(-d, 0, reconsImgCandidate.cols + d, reconsImgCandidate.rows))
 				.copyTo(translatedImg(cv::Rect(0, 0, reconsImgCandidate.cols + d, reconsImgCandidate.rows)));
+			// Do not keep values of the previous translation in the uncovered area
+			translatedImg(cv::Rect(reconsImgCandidate.cols + d, 0, -d, reconsImgCandidate.rows)).setTo(0);
 		}
 		else
 		{
 			int d(disparity + 0.5);
 			reconsImgCandidate(cv::Rect(0, 0, reconsImgCandidate.cols - d, reconsImgCandidate.rows))
 				.copyTo(translatedImg(cv::Rect(d, 0, reconsImgCandidate.cols - d, reconsImgCandidate.rows)));
+			translatedImg(cv::Rect(0, 0, d, reconsImgCandidate.rows)).setTo(0);
 		}
 
 		// Multiply by tau
-		cv::multiply(translatedImg, tauLocal, translatedImg, 1., CV_8UC3);
+		cv::multiply(translatedImg, tauLocal, translatedImg, 1., imgRectified.type());
 
 		// Reconstruct
 		if (k == 0)
@@ -150,110 +332,623 @@ void DepthEstimator::restoreImage(float disparity, float tauLocal, cv::UMat cons
 	}
 }
 
-void DepthEstimator::readAndCompileFilter(cv::ocl::Context &context)
+std::vector<float> DepthEstimator::depthCandidates(float minZ, float maxZ, float disparityCoef, float spacing)
+{
+	float a(disparityCoef / maxZ), b(disparityCoef / minZ);
+	int zCount = (a - b) / spacing + 1.5;
+	float step((b - a) / (zCount - 1));
+	std::vector<float> disparities(zCount);
+	for (int i(0); i < zCount; i++)
+	{
+		disparities[i] = a + i * step;
+	}
+	return disparities;
+}
+
+void DepthEstimator::setCandidateSpacing(float spacing)
+{
+	CV_Assert(spacing > 0.f);
+	// Same range: the first and last candidates are kept
+	float a(m_disparities.front()), b(m_disparities.back());
+	m_disparities = depthCandidates(m_disparityCoef / b, m_disparityCoef / a, m_disparityCoef, spacing);
+	m_disparities.front() = a;
+	m_disparities.back() = b;
+	m_zCount = int(m_disparities.size());
+	m_costSweep.setDisparities(m_disparities);
+	m_costSweep.getShiftRange(m_minShift, m_maxShift);
+	updateOutputTables();
+	updateSweepTables();
+}
+
+void DepthEstimator::updateSweepTables()
+{
+	cv::Mat translations, tauScales;
+	m_costSweep.getKernelTables(translations, tauScales, m_sweepInvWinSize);
+	translations.copyTo(m_sweepTranslations);
+	tauScales.copyTo(m_sweepTauScales);
+}
+
+void DepthEstimator::updateOutputTables()
+{
+	// Same float operations as the conversion of the whole map: 
+	// the sparse disparity v is mapped to the [0, 1] range, then to the [1. / maxDepth, 1. / minDepth] range
+	double minDepth(1. / (m_disparities[m_zCount - 1] / m_disparityCoef)), maxDepth(1. / (m_disparities[0] / m_disparityCoef));
+	float scale(float(1. / 255.)), offset(float(-1. / m_zCount)), 
+		range(float(1. / minDepth - 1. / maxDepth)), inverseMax(float(1. / maxDepth));
+	m_depthTables[DEPTH_32F].create(1, 256, CV_32FC1);
+	m_depthTables[DEPTH_16U].create(1, 256, CV_16UC1);
+	for (int v(0); v < 256; v++)
+	{
+		float depth(v == 0 ? 0.f : 1.f / ((float(v) * scale + offset) * range + inverseMax));
+		m_depthTables[DEPTH_32F].at<float>(0, v) = depth;
+		m_depthTables[DEPTH_16U].at<ushort>(0, v) = cv::saturate_cast<ushort>(depth);
+	}
+	// The same mapping for fractional labels, whose sparse disparity would be label * 255 / zCount
+	m_inverseDepthScale = range / float(m_zCount);
+	m_inverseDepthOffset = inverseMax - m_inverseDepthScale;
+	for (int format(0); format < 2; format++)
+	{
+		m_depthTables[format].copyTo(m_depthTablesDevice[format]);
+	}
+
+	// Shift of the sparse visualisation, then colour map
+	cv::Mat disparities(1, 256, CV_8UC1), shifted;
+	for (int v(0); v < 256; v++)
+	{
+		disparities.at<uchar>(0, v) = uchar(v);
+	}
+	cv::multiply(disparities, 0.8, shifted);
+	cv::add(shifted, 0.25 * 255., shifted, shifted);
+	cv::applyColorMap(shifted, m_disparityColours, cv::COLORMAP_MAGMA);
+}
+
+void DepthEstimator::initFrame(FrameBuffers & frame) const
+{
+	Geometry const & geometry(getGeometry(frame));
+	// Regions of interest read the input image in place
+	if (!frame.geometry)
+		frame.img = cv::UMat::zeros(m_invInd1.size(), CV_8UC3);
+	frame.imgRectified = cv::UMat::zeros(geometry.rectified.size(), CV_8UC3);
+	frame.reconsImg = cv::UMat::zeros(geometry.roi.size(), CV_8UC3);
+	frame.reconsImgRectified = cv::UMat::zeros(geometry.rectified.size(), CV_8UC3);
+	frame.minCost = cv::UMat::zeros(geometry.rectified.size(), CV_8UC1);
+	frame.maxCost = cv::UMat::zeros(geometry.rectified.size(), CV_8UC1);
+	frame.fullDisparityMap = cv::UMat::zeros(geometry.rectified.size(), CV_8UC1);
+	frame.sparseDisparityMap = cv::UMat::zeros(geometry.roiMask.size(), CV_8UC1);
+}
+
+void DepthEstimator::setRawFrame(RawRectifier::Frame const & raw)
+{
+	CV_Assert(raw.data && raw.size == m_invInd1.size());
+	m_frame.raw = raw;
+	for (int stage(0); stage < STAGE_COUNT; stage++)
+	{
+		runStage(Stage(stage), m_frame);
+	}
+	// The buffer belongs to the camera and is not valid after the call
+	m_frame.raw = RawRectifier::Frame();
+}
+
+void DepthEstimator::setFrame(const cv::UMat & img, std::vector<cv::Rect> const & rois)
+{
+	m_roiGeometries.resize(rois.size());
+	m_roiFrames.resize(rois.size());
+	m_roiOutputs.resize(rois.size());
+	m_roiDepths.resize(rois.size());
+	for (size_t i(0); i < rois.size(); i++)
+	{
+		Geometry & geometry(m_roiGeometries[i]);
+		FrameBuffers & frame(m_roiFrames[i]);
+		cv::Rect roi(rois[i] & m_fullGeometry.roi);
+		CV_Assert(roi.area() > 0);
+
+		// Tables and buffers are kept while the region does not change
+		if (roi != geometry.roi || frame.geometry != &geometry)
+		{
+			setRoiGeometry(roi, geometry);
+			frame.geometry = &geometry;
+			initFrame(frame);
+		}
+
+		frame.img = img;
+		frame.raw = RawRectifier::Frame();
+		for (int stage(0); stage < STAGE_COUNT; stage++)
+		{
+			runStage(Stage(stage), frame);
+		}
+
+		// Depth of the region without the halo of the filter
+		RoiOutput & output(m_roiOutputs[i]);
+		double scaleX(double(m_invIndMask1.cols) / m_invInd1.cols), scaleY(double(m_invIndMask1.rows) / m_invInd1.rows);
+		cv::Point maskBegin(int(roi.x * scaleX), int(roi.y * scaleY)),
+			maskEnd(int(std::ceil(roi.br().x * scaleX)), int(std::ceil(roi.br().y * scaleY)));
+		output.roi = roi;
+		output.roiMask = cv::Rect(maskBegin, maskEnd) & geometry.roiMask;
+		getDepth(frame, m_roiDepths[i]);
+		output.depth = m_roiDepths[i](output.roiMask - geometry.roiMask.tl());
+		output.reconsImg = frame.reconsImg;
+	}
+}
+
+void DepthEstimator::setRoiGeometry(cv::Rect const & roi, Geometry & geometry) const
+{
+	// Confidence estimation area, with the halo of the mask displacement, of its filters and of the bilateral filter
+	double scaleX(double(m_invIndMask1.cols) / m_invInd1.cols), scaleY(double(m_invIndMask1.rows) / m_invInd1.rows);
+	int halo(m_bilateralFilter.getRadius() + 1 + int(float(m_winSize * m_invIndMask1.cols) / (m_tformInd1.cols * 2)) + 2);
+	cv::Point maskBegin(int(roi.x * scaleX) - halo, int(roi.y * scaleY) - halo),
+		maskEnd(int(std::ceil(roi.br().x * scaleX)) + halo, int(std::ceil(roi.br().y * scaleY)) + halo);
+	geometry.roi = roi;
+	geometry.roiMask = cv::Rect(maskBegin, maskEnd) & m_fullGeometry.roiMask;
+
+	// Rectified pixels read by the reverse rectification of both areas
+	cv::Mat invInd, invIndMask;
+	cv::convertMaps(m_invInd1(roi), m_invInd2(roi), invInd, cv::noArray(), CV_32FC2);
+	cv::convertMaps(m_invIndMask1(geometry.roiMask), m_invIndMask2(geometry.roiMask), invIndMask, cv::noArray(), CV_32FC2);
+	cv::Point2f minPos(FLT_MAX, FLT_MAX), maxPos(-FLT_MAX, -FLT_MAX);
+	for (int k(0); k < 2; k++)
+	{
+		cv::Mat const & table(k == 0 ? invInd : invIndMask);
+		for (int y(0); y < table.rows; y++)
+		{
+			const cv::Point2f * row(table.ptr<cv::Point2f>(y));
+			for (int x(0); x < table.cols; x++)
+			{
+				minPos.x = std::min(minPos.x, row[x].x);
+				minPos.y = std::min(minPos.y, row[x].y);
+				maxPos.x = std::max(maxPos.x, row[x].x);
+				maxPos.y = std::max(maxPos.y, row[x].y);
+			}
+		}
+	}
+
+	// Rectified area, with the rows of the cost window and the columns read by the restoration
+	int radius(m_winSize / 2 + 2);
+	geometry.rectified = cv::Rect(
+		cv::Point(int(std::floor(minPos.x)) - radius - m_maxShift, int(std::floor(minPos.y)) - radius),
+		cv::Point(int(std::floor(maxPos.x)) + 2 + radius - m_minShift, int(std::floor(maxPos.y)) + 2 + radius))
+		& m_fullGeometry.rectified;
+	geometry.tformInd1 = m_tformInd1(geometry.rectified);
+	geometry.tformInd2 = m_tformInd2(geometry.rectified);
+
+	// Reverse tables relative to the rectified area
+	cv::Scalar offset(geometry.rectified.x, geometry.rectified.y);
+	cv::subtract(invInd, offset, invInd);
+	cv::subtract(invIndMask, offset, invIndMask);
+	cv::convertMaps(invInd, cv::noArray(), geometry.invInd1, geometry.invInd2, CV_16SC2);
+	cv::convertMaps(invIndMask, cv::noArray(), geometry.invIndMask1, geometry.invIndMask2, CV_16SC2);
+
+	if (!m_kernelBilateral.empty())
+	{
+		// Offsets for images of the width of roiMask
+		std::vector<int> ofs1(m_bilateralFilter.getOffsets(size_t(geometry.roiMask.width), 1)),
+			ofs3(m_bilateralFilter.getOffsets(size_t(geometry.roiMask.width) * 3, 3));
+		cv::Mat(1, int(ofs1.size()), CV_32SC1, &ofs1[0]).copyTo(geometry.filterIndCn1);
+		cv::Mat(1, int(ofs3.size()), CV_32SC1, &ofs3[0]).copyTo(geometry.filterIndCn3);
+	}
+}
+
+void DepthEstimator::setTextureGate(bool enable)
+{
+	if (!enable)
+	{
+		m_costSweep.setTextureGate(-1, 0);
+		return;
+	}
+
+	// Rectified pixels per pixel of the mask resolution
+	double ratio(std::max(double(m_tformInd1.cols) / m_invIndMask1.cols, double(m_tformInd1.rows) / m_invIndMask1.rows));
+	// Restoration of a ramp multiplies its gradient by at most 1 + tau + tau^2 + tau^3, 
+	// the colour fix of unwarpAndFixColour and the resizing to the mask resolution add their gain
+	double colourGain((1. + m_tau) / (1. + std::pow(m_tau, 4)));
+	double gain((1. + m_tau + std::pow(m_tau, 2) + std::pow(m_tau, 3)) * colourGain * ratio);
+	// The mask reads rounded pixels: the two restoration steps, the colour fix and the remapping leave each 
+	// at most colourGain + 1 off, which the gradient kernels (absolute weights summing to 64) and the rounded 
+	// filter and grey outputs turn into a grey gradient error. The gate grey itself is rounded too
+	double rounding(64. * (colourGain + 1.) + 1.);
+	int gradThresh(std::max(0, int((m_threshGrad - rounding) / gain) - 1));
+
+	// A valid pixel reads the gradient, erosion and displaced disparity of its neighbours
+	int displacement(int(float(m_winSize * m_invIndMask1.cols) / (m_tformInd1.cols * 2)));
+	int dilation(int(std::ceil(2. * ratio * (displacement + 2))) + 1);
+	m_costSweep.setTextureGate(gradThresh, dilation);
+}
+
+void DepthEstimator::runStage(Stage stage, FrameBuffers & frame)
 {
-	float sigmaGuide(20.f), guideCoeff(-0.5f / (sigmaGuide*sigmaGuide));
-	float sigmaSpace(5.f), gaussSpaceCoeff = -0.5 / (sigmaSpace*sigmaSpace);
-	std::vector<float> space_weight(m_filterSize * m_filterSize);
-	std::vector<int> space_ofs1(m_filterSize * m_filterSize), space_ofs3(m_filterSize * m_filterSize);
+	int64 start(m_profiling ? cv::getTickCount() : 0);
+	switch (stage)
+	{
+	case STAGE_RECTIFY:
+		rectify(frame);
+		break;
+	case STAGE_SWEEP:
+		reconstructDepthAndColour(frame);
+		break;
+	case STAGE_UNWARP:
+		unwarpAndFixColour(frame);
+		break;
+	case STAGE_MASK:
+		maskDisparityMap(frame);
+		break;
+	case STAGE_FILTER:
+		filterDisparity(frame);
+		break;
+	default:
+		CV_Error(cv::Error::StsBadArg, "Unknown stage");
+	}
+	if (m_profiling)
+		profileStage(stage, frame, start);
+}
+
+void DepthEstimator::profileStage(Stage stage, FrameBuffers const & frame, int64 start)
+{
+	cv::ocl::finish();
+	std::string name(getStageName(stage));
+	double bytes(stageBytes(stage, frame));
+	m_profiler.addEvent(name, start, cv::getTickCount(), bytes);
+	m_profiler.addValue(name + "_bytes", bytes);
 
-	// Fill-in the filter and indices
-	int index = 0;
-	for (int i = -m_filterRadius; i <= m_filterRadius; i++)
+	if (stage == STAGE_SWEEP && m_sweepEngine == SWEEP_CPU_FUSED)
 	{
-		for (int j = -m_filterRadius; j <= m_filterRadius; j++)
+		std::vector<double> const & candidateTimes(m_costSweep.getCandidateTimes());
+		for (size_t zInd(0); zInd < candidateTimes.size(); zInd++)
 		{
-			float r = std::sqrt((float)i * i + (float)j * j);
-			if (r > m_filterRadius)
-				continue;
-			space_weight[index] = (float)std::exp(r * r * gaussSpaceCoeff);
-			space_ofs3[index] = (int)((i * m_sparseDisparityMap.step + j) * 3);
-			space_ofs1[index++] = (int)(i * m_sparseDisparityMap.step + j);
+			m_profiler.addValue("candidate_" + std::to_string(zInd), candidateTimes[zInd]);
 		}
 	}
+	else if (stage == STAGE_FILTER)
+	{
+		m_profiler.addValue("valid_pixels", double(cv::countNonZero(frame.sparseDisparityMap)));
+	}
+}
 
-	// Create the kernel and index matrices
-	cv::Mat(1, index, CV_32FC1, &space_weight[0]).copyTo(m_spaceWeight);
-	cv::Mat(1, index, CV_32SC1, &space_ofs1[0]).copyTo(m_filterIndCn1);
-	cv::Mat(1, index, CV_32SC1, &space_ofs3[0]).copyTo(m_filterIndCn3);
+double DepthEstimator::stageBytes(Stage stage, FrameBuffers const & frame) const
+{
+	// Image sizes: input, rectified and confidence estimation. The confidence size comes from the frame: 
+	// the scratch images of the tail stages are rebound by another pipeline thread
+	double full(double(frame.img.total())), rectified(double(frame.imgRectified.total())),
+		conf(double(getGeometry(frame).roiMask.area()));
+	switch (stage)
+	{
+	case STAGE_RECTIFY:
+		// Input, 16-bit tables and output. Raw frames are read without a converted copy
+		return (frame.raw.data ? RawRectifier::getBytesPerPixel(frame.raw.format) : 3.) * full + 
+			(4. + 2. + 3.) * rectified;
+	case STAGE_SWEEP:
+	{
+		// The cv:: chain reads the image and writes a restored image and a cost per candidate, 
+		// the fused sweep and the OpenCL kernel only read the image. All write the disparity, the costs and the restored image.
+		// The luma cost converts the image once and works on one plane, 
+		// the cv:: chain restores the colour in addition unless deferred. 
+		// The deferred restoration reads the image and the disparity once
+		double planes(m_costMode == COST_LUMA ? 1. : 3.),
+			candidate(m_sweepEngine == SWEEP_OPENCV ? 2. * planes + 1. : planes);
+		if (m_sweepEngine == SWEEP_OPENCV && m_costMode == COST_LUMA && !m_deferredColour)
+			candidate += 6.;
+		// The subpixel fit reads and writes 16-bit neighbour costs, then writes the fractional labels
+		if (m_subpixelFit != CostSweep::SUBPIXEL_NONE)
+			candidate += m_sweepEngine == SWEEP_OPENCV ? 9. : 0.;
+		return candidate * m_zCount * rectified + 6. * rectified 
+			+ (m_costMode == COST_LUMA ? 4. : 0.) * rectified + (m_deferredColour ? 4. : 0.) * rectified
+			+ (m_subpixelFit != CostSweep::SUBPIXEL_NONE ? 2. + 2. * 2. + 4. : 0.) * rectified;
+	}
+	case STAGE_UNWARP:
+		// Intensity fix and remapping of the restored image, disparity and costs, and of the fractional labels
+		return 12. * rectified + (3. + 6. + 3.) * full + (3. + 1. + 1. + 1. + 6.) * conf
+			+ (m_subpixelFit != CostSweep::SUBPIXEL_NONE ? 4. * rectified + 6. * conf : 0.);
+	case STAGE_MASK:
+		// Confidence, costs, disparity and restored image in, disparity and confidence out, 
+		// and the displaced fractional labels
+		return 8. * conf + (m_subpixelFit != CostSweep::SUBPIXEL_NONE ? 16. * conf : 0.);
+	case STAGE_FILTER:
+		// Disparity and guide in, sparse disparity out, the fractional labels and the points of the valid pixels
+		return 5. * conf + (m_subpixelFit != CostSweep::SUBPIXEL_NONE ? 10. * conf : 0.) 
+			+ double(frame.points.size() * sizeof(SparsePoint));
+	default:
+		return 0.;
+	}
+}
 
-	// Read ocl code
-	std::ifstream ifs("bilateral_filter.cl");
-	std::string kernelSourceBilateral((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-	cv::ocl::ProgramSource programSourceBilateral(kernelSourceBilateral);
+const char * DepthEstimator::getStageName(Stage stage)
+{
+	static const char * names[STAGE_COUNT] = { "rectify", "sweep", "unwarp", "mask", "filter" };
+	CV_Assert(stage >= 0 && stage < STAGE_COUNT);
+	return names[stage];
+}
 
-	// Compile the kernel code
-	cv::String errmsg;
-	cv::ocl::Program programBilateral = context.getProg(programSourceBilateral,
-		" -D FILTER_SIZE=" + std::to_string(index)
-		+ " -D RADIUS=" + std::to_string(m_filterRadius)
-		+ " -D GUIDE_COEFF=" + std::to_string(guideCoeff), errmsg);
-	m_kernelBilateral = cv::ocl::Kernel("bilateralFilter", programBilateral);
-	std::cout << errmsg;
+void DepthEstimator::rectify(FrameBuffers & frame)
+{
+	Geometry const & geometry(getGeometry(frame));
+	if (frame.raw.data)
+	{
+		// Demosaicing or YUV conversion of the pixels read by the remapping only
+		cv::Mat imgRectified(frame.imgRectified.getMat(cv::ACCESS_WRITE));
+		RawRectifier::rectify(frame.raw, geometry.tformInd1.getMat(cv::ACCESS_READ), 
+			geometry.tformInd2.getMat(cv::ACCESS_READ), imgRectified);
+	}
+	else
+		cv::remap(frame.img, frame.imgRectified, geometry.tformInd1, geometry.tformInd2, cv::INTER_LINEAR);
 }
 
-void DepthEstimator::reconstructDepthAndColour()
+void DepthEstimator::reconstructDepthAndColour(FrameBuffers & frame)
 {
+	if (m_sweepEngine == SWEEP_CPU_FUSED)
+	{
+		cv::Mat imgRectified(frame.imgRectified.getMat(cv::ACCESS_READ)),
+			fullDisparityMap(frame.fullDisparityMap.getMat(cv::ACCESS_WRITE)),
+			minCost(frame.minCost.getMat(cv::ACCESS_WRITE)), maxCost(frame.maxCost.getMat(cv::ACCESS_WRITE)),
+			reconsImgRectified(frame.reconsImgRectified.getMat(cv::ACCESS_WRITE));
+		// Regions of interest do not follow the temporal search of the full frames
+		m_costSweep.run(imgRectified, fullDisparityMap, minCost, maxCost, reconsImgRectified, !frame.geometry);
+		if (m_subpixelFit != CostSweep::SUBPIXEL_NONE)
+			m_costSweep.getSubpixelLabels().copyTo(frame.subDisparityMap);
+		return;
+	}
+
+	bindScratch(m_sweepScratch, frame.imgRectified.size());
+	if (m_sweepEngine == SWEEP_OPENCL)
+	{
+		runSweepKernel(frame);
+		if (m_subpixelFit != CostSweep::SUBPIXEL_NONE)
+			fitSubpixelLabels(frame);
+		return;
+	}
+
+	// Same channel weights as the grey conversion of the colour cost
+	if (m_costMode == COST_LUMA)
+		cv::cvtColor(frame.imgRectified, m_imgLuma, cv::COLOR_RGB2GRAY);
+
 	for (int zInd(0); zInd < m_zCount; zInd++)
 	{
-		// Reconstruction for each depth candidates
-		restoreImage(m_disparities[zInd], m_tau, m_imgRectified, m_translatedImg, m_reconsImgCandidate);
+		int64 candidateStart(m_profiling ? cv::getTickCount() : 0);
+		// Reconstruction for each depth candidates, only needed by the colour cost when deferred
+		if (m_costMode == COST_RGB || !m_deferredColour)
+			restoreImage(m_disparities[zInd], m_tau, frame.imgRectified, m_translatedImg, m_reconsImgCandidate);
 
 		// Cost computation
-		cv::filter2D(m_reconsImgCandidate, m_costrgb1, -1, m_kernelGrad1);
-		cv::filter2D(m_reconsImgCandidate, m_costrgb2, -1, m_kernelGrad2);
+		if (m_costMode == COST_LUMA)
+		{
+			restoreImage(m_disparities[zInd], m_tau, m_imgLuma, m_translatedLuma, m_reconsLumaCandidate);
+			cv::filter2D(m_reconsLumaCandidate, m_costHandle, -1, m_kernelGrad1);
+			cv::filter2D(m_reconsLumaCandidate, m_cost, -1, m_kernelGrad2);
+			cv::add(m_costHandle, m_cost, m_cost);
+		}
+		else
+		{
+			cv::filter2D(m_reconsImgCandidate, m_costrgb1, -1, m_kernelGrad1);
+			cv::filter2D(m_reconsImgCandidate, m_costrgb2, -1, m_kernelGrad2);
 
-		cv::add(m_costrgb2, m_costrgb1, m_costrgb1);
-		cv::cvtColor(m_costrgb1, m_cost, cv::COLOR_RGB2GRAY);
+			cv::add(m_costrgb2, m_costrgb1, m_costrgb1);
+			cv::cvtColor(m_costrgb1, m_cost, cv::COLOR_RGB2GRAY);
+		}
 
 		cv::boxFilter(m_cost, m_costHandle, -1, cv::Size(m_winSize, 1));
 		cv::boxFilter(m_costHandle, m_cost, -1, cv::Size(1, m_winSize));
 
 		// Depth selection and reconstruction merging
+		if (m_subpixelFit != CostSweep::SUBPIXEL_NONE)
+			m_cost.convertTo(m_cost16, CV_16S);
 		if (zInd == 0)
 		{
-			m_cost.copyTo(m_minCost);
-			m_cost.copyTo(m_maxCost);
+			m_cost.copyTo(frame.minCost);
+			m_cost.copyTo(frame.maxCost);
+			if (m_subpixelFit != CostSweep::SUBPIXEL_NONE)
+			{
+				m_lowerCost.setTo(-1);
+				m_upperCost.setTo(-1);
+			}
 
-			m_fullDisparityMap.setTo(1);
-			m_reconsImgCandidate.copyTo(m_reconsImgRectified);
+			frame.fullDisparityMap.setTo(1);
+			if (!m_deferredColour)
+				m_reconsImgCandidate.copyTo(frame.reconsImgRectified);
 		}
 		else
 		{
 			// Get best depth and update masks
-			cv::compare(m_minCost, m_cost, m_maskBest, cv::CMP_GE);
-			m_cost.copyTo(m_minCost, m_maskBest);
+			cv::compare(frame.minCost, m_cost, m_maskBest, cv::CMP_GE);
+			m_cost.copyTo(frame.minCost, m_maskBest);
 
-			cv::max(m_maxCost, m_cost, m_maxCost);
-			m_fullDisparityMap.setTo(zInd + 1, m_maskBest);
+			cv::max(frame.maxCost, m_cost, frame.maxCost);
+
+			// Candidates are evaluated in order: a new winner has the previous candidate below it, 
+			// and the current candidate is above the pixels won by the previous one
+			if (m_subpixelFit != CostSweep::SUBPIXEL_NONE)
+			{
+				cv::compare(frame.fullDisparityMap, zInd, m_maskNeighbour, cv::CMP_EQ);
+				m_cost16.copyTo(m_upperCost, m_maskNeighbour);
+				m_previousCost16.copyTo(m_lowerCost, m_maskBest);
+				m_upperCost.setTo(-1, m_maskBest);
+			}
+			frame.fullDisparityMap.setTo(zInd + 1, m_maskBest);
 
 			// Merge reconstructions
-			cv::copyTo(m_reconsImgCandidate, m_reconsImgRectified, m_maskBest);
+			if (!m_deferredColour)
+				cv::copyTo(m_reconsImgCandidate, frame.reconsImgRectified, m_maskBest);
+		}
+
+		if (m_subpixelFit != CostSweep::SUBPIXEL_NONE)
+			cv::swap(m_cost16, m_previousCost16);
+
+		if (m_profiling)
+		{
+			cv::ocl::finish();
+			m_profiler.addEvent("candidate_" + std::to_string(zInd), candidateStart, cv::getTickCount());
 		}
 	}
+
+	if (m_subpixelFit != CostSweep::SUBPIXEL_NONE)
+		fitSubpixelLabels(frame);
+
+	// Single restoration with the winning disparities
+	if (m_deferredColour)
+	{
+		cv::Mat imgRectified(frame.imgRectified.getMat(cv::ACCESS_READ)),
+			fullDisparityMap(frame.fullDisparityMap.getMat(cv::ACCESS_READ)),
+			reconsImgRectified(frame.reconsImgRectified.getMat(cv::ACCESS_WRITE));
+		m_costSweep.restoreLabels(imgRectified, fullDisparityMap, reconsImgRectified);
+	}
+}
+
+void DepthEstimator::runSweepKernel(FrameBuffers & frame)
+{
+	// One column per work-item, and as many rows per tile as the winners fit in local memory 
+	// next to the rows of the candidate being aggregated
+	bool fit(m_subpixelFit != CostSweep::SUBPIXEL_NONE);
+	cv::Size size(frame.imgRectified.size());
+	int radius(m_winSize / 2), tileCols(int(std::min<size_t>(64, m_kernelSweep.workGroupSize())));
+	size_t restoredBytes(3 * 3 * size_t(tileCols + 2 * radius + 2)), greyBytes(size_t(tileCols + 2 * radius + 7) / 8 * 8),
+		blockBytes(greyBytes / 8 * sizeof(int)), ringBytes(size_t(m_winSize * tileCols)),
+		fixedBytes(restoredBytes + greyBytes + blockBytes + ringBytes + m_kernelSweep.localMemSize()),
+		pixelBytes(fit ? 4 + 2 * sizeof(short) : 3), localBytes(cv::ocl::Device::getDefault().localMemSize());
+	CV_Assert(localBytes >= fixedBytes + pixelBytes * tileCols);
+	int tileRows(int(std::min<size_t>((localBytes - fixedBytes) / (pixelBytes * tileCols), 128)));
+	tileRows = std::min(tileRows, size.height);
+
+	// Without subpixel fit, the neighbour costs are never written
+	cv::UMat & lowerCost(fit ? m_lowerCost : frame.minCost), & upperCost(fit ? m_upperCost : frame.minCost);
+	size_t tileSize(size_t(tileRows * tileCols));
+	m_kernelSweep.args(
+		cv::ocl::KernelArg::ReadOnlyNoSize(frame.imgRectified),
+		cv::ocl::KernelArg::WriteOnly(frame.fullDisparityMap),
+		cv::ocl::KernelArg::WriteOnlyNoSize(frame.minCost),
+		cv::ocl::KernelArg::WriteOnlyNoSize(frame.maxCost),
+		cv::ocl::KernelArg::WriteOnlyNoSize(frame.reconsImgRectified),
+		cv::ocl::KernelArg::WriteOnlyNoSize(lowerCost),
+		cv::ocl::KernelArg::WriteOnlyNoSize(upperCost),
+		m_sweepTranslations.handle(cv::ACCESS_READ), m_zCount, m_sweepTauScales.handle(cv::ACCESS_READ), 
+		m_sweepInvWinSize, radius, tileRows, int(fit),
+		cv::ocl::KernelArg::Local(restoredBytes), cv::ocl::KernelArg::Local(greyBytes), 
+		cv::ocl::KernelArg::Local(blockBytes), cv::ocl::KernelArg::Local(ringBytes),
+		cv::ocl::KernelArg::Local((fit ? 4 : 3) * tileSize), cv::ocl::KernelArg::Local((fit ? 2 * tileSize : 1) * sizeof(short))
+	);
+	size_t globalThreads[2] = { size_t((size.width + tileCols - 1) / tileCols * tileCols), size_t((size.height + tileRows - 1) / tileRows) };
+	size_t localThreads[2] = { size_t(tileCols), 1 };
+	CV_Assert(m_kernelSweep.run(2, globalThreads, localThreads, true));
+}
+
+void DepthEstimator::fitSubpixelLabels(FrameBuffers & frame)
+{
+	frame.subDisparityMap.create(frame.fullDisparityMap.size(), CV_32FC1);
+	cv::Mat fullDisparityMap(frame.fullDisparityMap.getMat(cv::ACCESS_READ)), 
+		minCost(frame.minCost.getMat(cv::ACCESS_READ)), lowerCost(m_lowerCost.getMat(cv::ACCESS_READ)), 
+		upperCost(m_upperCost.getMat(cv::ACCESS_READ)), subDisparityMap(frame.subDisparityMap.getMat(cv::ACCESS_WRITE));
+	CostSweep::fitSubpixel(fullDisparityMap, minCost, lowerCost, upperCost, m_subpixelFit, subDisparityMap);
+}
+
+const cv::UMat DepthEstimator::getDepth(FrameBuffers const & frame) const
+{
+	cv::UMat depth;
+	getDepth(frame, depth);
+	return depth;
+}
+
+void DepthEstimator::getDepth(FrameBuffers const & frame, cv::UMat & depth, DepthFormat format) const
+{
+	cv::LUT(frame.sparseDisparityMap, m_depthTablesDevice[format], depth);
+}
+
+void DepthEstimator::getDepth(FrameBuffers const & frame, cv::Mat & depth, DepthFormat format) const
+{
+	cv::LUT(frame.sparseDisparityMap.getMat(cv::ACCESS_READ), m_depthTables[format], depth);
+}
+
+void DepthEstimator::getDisparityMap(FrameBuffers const & frame, cv::Mat & colour) const
+{
+	colourDisparity(frame.sparseDisparityMap.getMat(cv::ACCESS_READ), colour);
+}
+
+void DepthEstimator::getDisparityMap(FrameBuffers const & frame, cv::UMat & colour) const
+{
+	colour.create(frame.sparseDisparityMap.size(), CV_8UC3);
+	cv::Mat colourMap(colour.getMat(cv::ACCESS_WRITE));
+	colourDisparity(frame.sparseDisparityMap.getMat(cv::ACCESS_READ), colourMap);
 }
 
-void DepthEstimator::unwarpAndFixColour()
+void DepthEstimator::colourDisparity(cv::Mat const & sparseDisparityMap, cv::Mat & colour) const
+{
+	colour.create(sparseDisparityMap.size(), CV_8UC3);
+	if (sparseDisparityMap.empty())
+		return;
+
+	// The 3x3 dilation commutes with the shift, which keeps the order of the disparities: 
+	// the colour of the maximum of the neighbours is looked up in the table
+	const cv::Vec3b * table(m_disparityColours.ptr<cv::Vec3b>(0));
+	int rows(sparseDisparityMap.rows), cols(sparseDisparityMap.cols);
+	cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range & range)
+	{
+		for (int y(range.start); y < range.end; y++)
+		{
+			// Rows outside the map repeat the border row, which does not change the maximum
+			const uchar * above(sparseDisparityMap.ptr<uchar>(std::max(y - 1, 0))), 
+				* row(sparseDisparityMap.ptr<uchar>(y)), * below(sparseDisparityMap.ptr<uchar>(std::min(y + 1, rows - 1)));
+			cv::Vec3b * dst(colour.ptr<cv::Vec3b>(y));
+			// Maxima of the columns left, at and right of x
+			uchar left(0), centre(std::max(std::max(above[0], row[0]), below[0]));
+			for (int x(0); x < cols; x++)
+			{
+				uchar right(x + 1 < cols ? std::max(std::max(above[x + 1], row[x + 1]), below[x + 1]) : uchar(0));
+				dst[x] = table[std::max(std::max(left, centre), right)];
+				left = centre;
+				centre = right;
+			}
+		}
+	});
+}
+
+const cv::UMat DepthEstimator::getSubpixelDepth(FrameBuffers const & frame) const
+{
+	cv::UMat depth, mask;
+	computeSubpixelDepth(frame, depth, mask);
+	return depth;
+}
+
+void DepthEstimator::computeSubpixelDepth(FrameBuffers const & frame, cv::UMat & depth, cv::UMat & mask) const
+{
+	CV_Assert(m_subpixelFit != CostSweep::SUBPIXEL_NONE && !frame.sparseSubDisparityMap.empty());
+
+	// Mapping of the depth tables: the inverse depth is linear in the fractional label
+	frame.sparseSubDisparityMap.convertTo(depth, CV_32F, m_inverseDepthScale, m_inverseDepthOffset);
+	cv::divide(1., depth, depth);
+	// Mask out unreliable areas
+	cv::compare(frame.sparseSubDisparityMap, 0, mask, cv::CMP_EQ);
+	depth.setTo(0., mask);
+}
+
+void DepthEstimator::unwarpAndFixColour(FrameBuffers & frame)
 {
 	// Account for the intensity drop of the restoration algorithm and of the e-ray removal
-	cv::multiply(m_reconsImgRectified, (1.f + m_tau) / (1.f + std::pow(m_tau, 4)), m_reconsImgRectified);
+	cv::multiply(frame.reconsImgRectified, (1.f + m_tau) / (1.f + std::pow(m_tau, 4)), frame.reconsImgRectified);
 
-	// Reverse rectification
-	cv::remap(m_reconsImgRectified, m_reconsImg, m_invInd1, m_invInd2, cv::INTER_LINEAR);
-	cv::remap(m_reconsImgRectified, m_reconsImgConf, m_invIndMask1, m_invIndMask2, cv::INTER_LINEAR);
-	cv::remap(m_fullDisparityMap, m_fullDisparityMapConf, m_invIndMask1, cv::noArray(), cv::INTER_NEAREST);
-	cv::remap(m_maxCost, m_confidence, m_invIndMask1, cv::noArray(), cv::INTER_NEAREST);
-	cv::remap(m_minCost, m_minCostConf, m_invIndMask1, cv::noArray(), cv::INTER_NEAREST);
+	// Reverse rectification, into the images of the confidence estimation of the area
+	Geometry const & geometry(getGeometry(frame));
+	bindScratch(m_tailScratch, geometry.roiMask.size());
+	cv::remap(frame.reconsImgRectified, frame.reconsImg, geometry.invInd1, geometry.invInd2, cv::INTER_LINEAR);
+	cv::remap(frame.reconsImgRectified, m_reconsImgConf, geometry.invIndMask1, geometry.invIndMask2, cv::INTER_LINEAR);
+	cv::remap(frame.fullDisparityMap, m_fullDisparityMapConf, geometry.invIndMask1, cv::noArray(), cv::INTER_NEAREST);
+	if (m_subpixelFit != CostSweep::SUBPIXEL_NONE)
+		cv::remap(frame.subDisparityMap, m_subDisparityMapConf, geometry.invIndMask1, cv::noArray(), cv::INTER_NEAREST);
+	cv::remap(frame.maxCost, m_confidence, geometry.invIndMask1, cv::noArray(), cv::INTER_NEAREST);
+	cv::remap(frame.minCost, m_minCostConf, geometry.invIndMask1, cv::noArray(), cv::INTER_NEAREST);
 
 	// Use the original image at the boundary as our restoration cannot handle those areas
-	m_img(cv::Rect(0, 0, m_img.cols, 5)).copyTo(m_reconsImg(cv::Rect(0, 0, m_img.cols, 5)));
-	m_img(cv::Rect(0, m_img.rows - 5, m_img.cols, 5))
-		.copyTo(m_reconsImg(cv::Rect(0, m_img.rows - 5, m_img.cols, 5)));
-	m_img(cv::Rect(m_img.cols - 40, 0, 40, m_img.rows))
-		.copyTo(m_reconsImg(cv::Rect(m_img.cols - 40, 0, 40, m_img.rows)));
+	cv::Rect boundaries[3] = { cv::Rect(0, 0, frame.img.cols, 5), cv::Rect(0, frame.img.rows - 5, frame.img.cols, 5),
+		cv::Rect(frame.img.cols - 40, 0, 40, frame.img.rows) };
+	for (int i(0); i < 3; i++)
+	{
+		cv::Rect boundary(boundaries[i] & geometry.roi);
+		if (boundary.area() <= 0)
+			continue;
+		if (frame.raw.data)
+		{
+			cv::Mat reconsBoundary(frame.reconsImg(boundary - geometry.roi.tl()).getMat(cv::ACCESS_WRITE));
+			RawRectifier::convert(frame.raw, boundary, reconsBoundary);
+		}
+		else
+			frame.img(boundary).copyTo(frame.reconsImg(boundary - geometry.roi.tl()));
+	}
 }
 
-void DepthEstimator::maskDisparityMap()
+void DepthEstimator::maskDisparityMap(FrameBuffers & frame)
 {	
 	// Build the confidence map using the difference between the best and worse cost
 	cv::subtract(m_confidence, m_minCostConf, m_minCostConf);
@@ -265,13 +960,19 @@ void DepthEstimator::maskDisparityMap()
 
 	// Map displacement to account for the position of the artefacts 
 	// when the image is reconstructed with a wrong depth candidate
-	int displacement = int(float(m_winSize * m_fullDisparityMapConf.cols) / (m_fullDisparityMap.cols  * 2));
+	int displacement = int(float(m_winSize * m_invIndMask1.cols) / (m_tformInd1.cols  * 2));
 	m_fullDisparityMapConf.copyTo(m_handle);
 	m_handle(cv::Rect(0, 0, m_handle.cols - displacement, m_handle.rows))
 		.copyTo(m_fullDisparityMapConf(cv::Rect(displacement, 0, m_handle.cols - displacement, m_handle.rows)));
 	m_confidence.copyTo(m_handle);
 	m_handle(cv::Rect(0, 0, m_handle.cols - displacement, m_handle.rows))
 		.copyTo(m_confidence(cv::Rect(displacement, 0, m_handle.cols - displacement, m_handle.rows)));
+	if (m_subpixelFit != CostSweep::SUBPIXEL_NONE)
+	{
+		m_subDisparityMapConf.copyTo(m_subHandle);
+		m_subHandle(cv::Rect(0, 0, m_subHandle.cols - displacement, m_subHandle.rows))
+			.copyTo(m_subDisparityMapConf(cv::Rect(displacement, 0, m_subHandle.cols - displacement, m_subHandle.rows)));
+	}
 
 	// Refine the confidence map using the edge structure in the restored image
 	cv::filter2D(m_reconsImgConf, m_edges1Conf, -1, m_kernelGrad1);
@@ -280,39 +981,177 @@ void DepthEstimator::maskDisparityMap()
 	cv::cvtColor(m_edges1Conf, m_edgesGreyConf, cv::COLOR_RGB2GRAY);
 	cv::compare(m_edgesGreyConf, m_threshGrad, m_maskConfidence, cv::CMP_LT);
 	m_confidence.setTo(0, m_maskConfidence);
-	cv::erode(m_confidence, m_confidence, cv::UMat::ones(2, 2, CV_8UC1));
+	cv::erode(m_confidence, m_confidence, m_kernelErode);
 	
 	cv::compare(m_confidence, 0, m_maskConfidence, cv::CMP_EQ);
 	m_fullDisparityMapConf.setTo(0, m_maskConfidence);
 }
 
-void DepthEstimator::filterDisparity()
+void DepthEstimator::filterDisparity(FrameBuffers & frame)
 {
-	if (m_disparityFiltering)
+	int64 start(cv::getTickCount());
+	if (m_filterEngine == FILTER_OPENCL)
 	{
 		// Run filter
 		size_t globalThreads[2] = { size_t(m_fullDisparityMapConf.cols), size_t(m_fullDisparityMapConf.rows) };
 		size_t localThreads[2] = { 32, 32 };
 
 		cv::multiply(m_fullDisparityMapConf, 255. / m_zCount, m_fullDisparityMapConf);
-		m_sparseDisparityMap.setTo(0);
+		frame.sparseDisparityMap.setTo(0);
 
 		m_kernelBilateral.args(
 			cv::ocl::KernelArg::ReadOnlyNoSize(m_fullDisparityMapConf),
 			cv::ocl::KernelArg::ReadOnlyNoSize(m_reconsImgConf),
-			cv::ocl::KernelArg::WriteOnly(m_sparseDisparityMap),
+			cv::ocl::KernelArg::WriteOnly(frame.sparseDisparityMap),
 			m_spaceWeight.handle(cv::ACCESS_READ),
-			m_filterIndCn1.handle(cv::ACCESS_READ), m_filterIndCn3.handle(cv::ACCESS_READ)
+			getGeometry(frame).filterIndCn1.handle(cv::ACCESS_READ), getGeometry(frame).filterIndCn3.handle(cv::ACCESS_READ)
 		);
 		m_kernelBilateral.run(2, globalThreads, localThreads, true);
 
 		// Outlier removal
-		cv::absdiff(m_fullDisparityMapConf, m_sparseDisparityMap, m_fullDisparityMapConf);
-		cv::compare(m_fullDisparityMapConf, 8, m_maskConfidence, cv::CMP_GT);
-		m_sparseDisparityMap.setTo(0, m_maskConfidence);
+		cv::absdiff(m_fullDisparityMapConf, frame.sparseDisparityMap, m_fullDisparityMapConf);
+		cv::compare(m_fullDisparityMapConf, m_outlierThresh, m_maskConfidence, cv::CMP_GT);
+		frame.sparseDisparityMap.setTo(0, m_maskConfidence);
+	}
+	else if (m_filterEngine == FILTER_CPU)
+	{
+		cv::multiply(m_fullDisparityMapConf, 255. / m_zCount, m_fullDisparityMapConf);
+
+		// Filter and outlier removal in one pass
+		cv::Mat fullDisparityMapConf(m_fullDisparityMapConf.getMat(cv::ACCESS_READ)),
+			reconsImgConf(m_reconsImgConf.getMat(cv::ACCESS_READ)),
+			sparseDisparityMap(frame.sparseDisparityMap.getMat(cv::ACCESS_WRITE));
+		if (m_pointFormat == POINTS_NONE)
+			m_bilateralFilter.run(fullDisparityMapConf, reconsImgConf, sparseDisparityMap, m_outlierThresh);
+		else
+		{
+			// Each row is collected right after it is filtered
+			cv::Mat subDisparityMap;
+			if (m_subpixelFit != CostSweep::SUBPIXEL_NONE)
+				subDisparityMap = m_subDisparityMapConf.getMat(cv::ACCESS_READ);
+			m_bilateralFilter.setGuide(fullDisparityMapConf, reconsImgConf);
+			sparseDisparityMap.setTo(0);
+			collectBands(frame, sparseDisparityMap, reconsImgConf, subDisparityMap, [&](int y)
+			{
+				m_bilateralFilter.filterRows(fullDisparityMapConf, reconsImgConf, sparseDisparityMap, 
+					cv::Range(y, y + 1), m_outlierThresh);
+			});
+		}
 	}
 	else
 	{
-		cv::multiply(m_fullDisparityMapConf, 255. / m_zCount, m_sparseDisparityMap);
+		cv::multiply(m_fullDisparityMapConf, 255. / m_zCount, frame.sparseDisparityMap);
 	}
-}
\ No newline at end of file
+	m_filterTime = 1000. * double(cv::getTickCount() - start) / cv::getTickFrequency();
+
+	// The map of the other filters is final after their cv:: calls: one pass over it
+	if (m_pointFormat != POINTS_NONE && m_filterEngine != FILTER_CPU)
+	{
+		cv::Mat sparseDisparityMap(frame.sparseDisparityMap.getMat(cv::ACCESS_READ)),
+			reconsImgConf(m_reconsImgConf.getMat(cv::ACCESS_READ)), subDisparityMap;
+		if (m_subpixelFit != CostSweep::SUBPIXEL_NONE)
+			subDisparityMap = m_subDisparityMapConf.getMat(cv::ACCESS_READ);
+		collectBands(frame, sparseDisparityMap, reconsImgConf, subDisparityMap, std::function<void(int)>());
+	}
+	else if (m_pointFormat == POINTS_NONE)
+		frame.points.clear();
+
+	// Fitted disparities of the pixels kept by the filter
+	if (m_subpixelFit != CostSweep::SUBPIXEL_NONE)
+	{
+		cv::compare(frame.sparseDisparityMap, 0, m_maskConfidence, cv::CMP_EQ);
+		m_subDisparityMapConf.copyTo(frame.sparseSubDisparityMap);
+		frame.sparseSubDisparityMap.setTo(0, m_maskConfidence);
+	}
+}
+
+void DepthEstimator::setPointFormat(PointFormat format, Intrinsics const & intrinsics)
+{
+	CV_Assert(format != POINTS_XYZ || (intrinsics.fx != 0.f && intrinsics.fy != 0.f));
+	m_pointFormat = format;
+	m_intrinsics = intrinsics;
+}
+
+void DepthEstimator::collectBands(FrameBuffers & frame, cv::Mat const & sparseDisparityMap, cv::Mat const & reconsImgConf, 
+	cv::Mat const & subDisparityMap, std::function<void(int)> const & rowReady)
+{
+	// Contiguous rows per band, the points of the bands are in row order
+	int rows(sparseDisparityMap.rows), bandCount(std::max(1, std::min(rows, 4 * cv::getNumThreads())));
+	if (int(m_pointBands.size()) < bandCount)
+		m_pointBands.resize(bandCount);
+	cv::Point origin(getGeometry(frame).roiMask.tl());
+	cv::parallel_for_(cv::Range(0, bandCount), [&](const cv::Range & range)
+	{
+		for (int b(range.start); b < range.end; b++)
+		{
+			std::vector<SparsePoint> & points(m_pointBands[b]);
+			points.clear();
+			for (int y(b * rows / bandCount); y < (b + 1) * rows / bandCount; y++)
+			{
+				if (rowReady)
+					rowReady(y);
+				collectPoints(sparseDisparityMap, reconsImgConf, subDisparityMap, origin, y, points);
+			}
+		}
+	});
+
+	size_t count(0);
+	for (int b(0); b < bandCount; b++)
+	{
+		count += m_pointBands[b].size();
+	}
+	frame.points.resize(count);
+	SparsePoint * dst(frame.points.data());
+	for (int b(0); b < bandCount; b++)
+	{
+		dst = std::copy(m_pointBands[b].begin(), m_pointBands[b].end(), dst);
+	}
+}
+
+void DepthEstimator::collectPoints(cv::Mat const & sparseDisparityMap, cv::Mat const & reconsImgConf, 
+	cv::Mat const & subDisparityMap, cv::Point origin, int y, std::vector<SparsePoint> & points) const
+{
+	const uchar * row(sparseDisparityMap.ptr<uchar>(y)), * colour(reconsImgConf.ptr<uchar>(y));
+	const float * subRow(subDisparityMap.empty() ? nullptr : subDisparityMap.ptr<float>(y)),
+		* depthTable(m_depthTables[DEPTH_32F].ptr<float>(0));
+	int cols(sparseDisparityMap.cols);
+
+	// Rays through the centres of the pixels at the resolution of the input image
+	bool xyz(m_pointFormat == POINTS_XYZ);
+	float scaleX(float(m_invInd1.cols) / m_invIndMask1.cols), scaleY(float(m_invInd1.rows) / m_invIndMask1.rows),
+		rayY(((float(y + origin.y) + 0.5f) * scaleY - 0.5f - m_intrinsics.cy) / m_intrinsics.fy);
+
+	for (int x(0); x < cols; x++)
+	{
+#if CV_SIMD128
+		// Most of the map is 0: skip 16 pixels at a time
+		if (x + 16 <= cols && !cv::v_check_any(cv::v_load(row + x) != cv::v_setall_u8(0)))
+		{
+			x += 15;
+			continue;
+		}
+#endif
+		if (!row[x])
+			continue;
+
+		SparsePoint point;
+		float depth(subRow ? 1.f / (subRow[x] * m_inverseDepthScale + m_inverseDepthOffset) : depthTable[row[x]]);
+		if (xyz)
+		{
+			float rayX(((float(x + origin.x) + 0.5f) * scaleX - 0.5f - m_intrinsics.cx) / m_intrinsics.fx);
+			point.x = rayX * depth;
+			point.y = rayY * depth;
+		}
+		else
+		{
+			point.x = float(x + origin.x);
+			point.y = float(y + origin.y);
+		}
+		point.z = depth;
+		point.colour[0] = colour[3 * x];
+		point.colour[1] = colour[3 * x + 1];
+		point.colour[2] = colour[3 * x + 2];
+		point.disparity = row[x];
+		points.push_back(point);
+	}
+}
@@ -37,8 +37,18 @@ SOFTWARE.
 #include <opencv2/core/core.hpp>
 #include <opencv2/core/ocl.hpp>
 #include <opencv2/imgproc.hpp>
+#include <functional>
+#include <memory>
 #include <vector>
 
+#include "cost_sweep.h"
+#include "depth_calibration.h"
+#include "raw_rectifier.h"
+#include "rectification_cache.h"
+#include "scratch_arena.h"
+#include "sparse_bilateral_filter.h"
+#include "stage_profiler.h"
+
 /* @class  DepthEstimator
 @brief  DepthEstimator is a class to estimate the depth 
 and reconstruct the image for uneven birefractive stereo.
@@ -46,6 +56,126 @@ and reconstruct the image for uneven birefractive stereo.
 class DepthEstimator
 {
 public:
+	/* Implementations of the depth candidate sweep */
+	enum SweepEngine
+	{
+		SWEEP_OPENCV, // Chain of cv:: calls, runs on the OpenCL device when available
+		SWEEP_CPU_FUSED, // Single pass per candidate on the CPU (see CostSweep)
+		SWEEP_OPENCL // Single OpenCL kernel evaluating all the candidates of a tile in local memory (see cost_sweep.cl)
+	};
+
+	/* Image planes the candidate costs are computed on */
+	enum CostMode
+	{
+		COST_RGB, // Restoration and gradient of the three channels, then grey conversion
+		COST_LUMA // Restoration and gradient of a luma plane converted once from the rectified image
+	};
+
+	/* Implementations of the sparse disparity map filtering */
+	enum FilterEngine
+	{
+		FILTER_NONE, // No filtering
+		FILTER_OPENCL, // "bilateral_filter.cl" kernel on the GPU
+		FILTER_CPU // Multithreaded CPU version of the kernel (see SparseBilateralFilter)
+	};
+
+	/* Formats of the depth maps written into caller buffers */
+	enum DepthFormat
+	{
+		DEPTH_32F, // Depth in mm (CV_32FC1)
+		DEPTH_16U // Depth rounded to mm, saturated at 65535 (CV_16UC1)
+	};
+
+	/* Contents of the sparse output of the valid pixels, see setPointFormat */
+	enum PointFormat
+	{
+		POINTS_NONE, // No sparse output
+		POINTS_PIXEL, // Position in getDepth() coordinates and depth
+		POINTS_XYZ // Position in mm in the camera frame, back-projected with the Intrinsics of setPointFormat
+	};
+
+	/* Valid pixel of the sparse output, packed in 16 bytes */
+	struct SparsePoint
+	{
+		// POINTS_PIXEL: column, row and depth in mm. POINTS_XYZ: position in mm, z along the optical axis
+		float x, y, z;
+		unsigned char colour[3]; // Restored colour, in the channel order of the input image
+		unsigned char disparity; // Value of the sparse disparity map
+	};
+
+	/* Pinhole intrinsics of the input image, for the back-projection of the sparse output */
+	struct Intrinsics
+	{
+		Intrinsics(float fx = 1.f, float fy = 1.f, float cx = 0.f, float cy = 0.f) : fx(fx), fy(fy), cx(cx), cy(cy) {}
+
+		float fx, fy; // Focal lengths in pixels
+		float cx, cy; // Principal point in pixels
+	};
+
+	/* Processed area of the input image with its rectification tables:
+	the full frame or a region of interest (see setFrame with regions of interest) */
+	struct Geometry
+	{
+		cv::Rect roi; // Area of the input image
+		cv::Rect roiMask; // Area of the confidence estimation images
+		cv::Rect rectified; // Area of the rectified image
+		cv::UMat tformInd1, tformInd2; // Rectification tables of the rectified area
+		// Reverse rectification tables of roi and roiMask, relative to the rectified area
+		cv::UMat invInd1, invInd2, invIndMask1, invIndMask2;
+		cv::UMat filterIndCn1, filterIndCn3; // Bilateral filter offsets for the roiMask width
+	};
+
+	/* Depth and restored colour of a region of interest */
+	struct RoiOutput
+	{
+		cv::Rect roi; // Area of the input image
+		cv::Rect roiMask; // Area of the depth in getDepth() coordinates
+		cv::UMat depth; // Depth of roiMask, 0 where unreliable (CV_32F)
+		cv::UMat reconsImg; // Restored image of roi (CV_8UC3)
+	};
+
+	/* Images of one frame passed between the processing stages. 
+	Several frames can be processed at different stages at the same time (see DepthPipeline) */
+	struct FrameBuffers
+	{
+		const Geometry * geometry = nullptr; // Processed area, the full frame if null
+		cv::UMat img; // Input image
+		RawRectifier::Frame raw; // Raw camera buffer read in place of img when set (see setRawFrame)
+		cv::UMat imgRectified; // Rectified input image
+		cv::UMat reconsImgRectified; // Rectified restored image
+		cv::UMat fullDisparityMap; // Disparity map after winner-takes all on all pixels
+		cv::UMat minCost, maxCost; // Best and worse cost
+		cv::UMat reconsImg; // Restored image
+		cv::UMat sparseDisparityMap; // Disparity map with unreliable areas filtered out
+		cv::UMat subDisparityMap; // Fractional labels of the subpixel fit on all pixels (CV_32FC1)
+		cv::UMat sparseSubDisparityMap; // Fractional labels of the valid pixels of sparseDisparityMap (CV_32FC1)
+		std::vector<SparsePoint> points; // Valid pixels of sparseDisparityMap in row order, with a point format
+	};
+
+	/* Bytes of the images and buffers held by an estimator, see getMemoryFootprint */
+	struct MemoryFootprint
+	{
+		size_t frames = 0; // Images of the frames of setFrame and of the regions of interest, without the input images
+		size_t scratch = 0; // Temporary images of the stages, sharing memory when their live ranges do not overlap
+		size_t scratchUnaliased = 0; // Temporary images of the stages if each had its own memory
+		size_t outputs = 0; // Images returned by getDepth, getSubpixelDepth, getDisparityMap and getRoiOutputs
+		size_t cpu = 0; // Buffers of the fused CPU sweep, including the previous frame of the temporal search, and of the CPU filter
+		size_t shared = 0; // Tables and filter weights of the calibration, shared with other estimators and not counted below
+		size_t steady = 0; // Held from one frame to the next: frames, outputs and cpu
+		size_t peak = 0; // Held while processing a frame: steady and scratch
+	};
+
+	/* Processing stages of setFrame, in order */
+	enum Stage
+	{
+		STAGE_RECTIFY, // Rectification of the input image
+		STAGE_SWEEP, // Restoration and cost for all candidates, winner selection
+		STAGE_UNWARP, // Reverse rectification and colour fix
+		STAGE_MASK, // Confidence and masking of the disparity map
+		STAGE_FILTER, // Sparse disparity map filtering
+		STAGE_COUNT
+	};
+
 	/* @brief Set parameters, read LuTs and initialise variables
 	@param tformInd of the rectification remapping table
 	@param invInd the table to reverse rectification
@@ -65,54 +195,410 @@ public:
 		float upsampling = 1.f, double scaleMask = 0.3,
 		int winSize = 61, unsigned char threshGrad = 190, unsigned char threshCost = 4);
 
+	/* @brief Set parameters and use rectification tables already converted, 
+	e.g. memory-mapped from a binary cache. The tables are shared, not copied
+	@param tables fixed-point rectification tables, giving upsampling and scaleMask
+	@param minZ Lowest depth candidate
+	@param maxZ Largest depth candidate
+	@param disparityCoef f * baseline such as disparity_{o->e} = disparityCoef * 1 / depth
+	in the horizontal direction. 
+	@param tau intensity proportion between e-ray and o-ray: I_captured = tau * I_e + I_o, 0 < tau < 1
+	@param winSize Window size for cost computation
+	@param threshGrad Mask out in the disparity map areas with lower gradient in the reconstructed image
+	@param threshCost Mask out in the disparity map areas with lower cost difference between the minimum and maximum
+	*/
+	DepthEstimator(std::shared_ptr<RectificationCache> const & tables,
+		float minZ, float maxZ, float disparityCoef, float tau,
+		int winSize = 61, unsigned char threshGrad = 190, unsigned char threshCost = 4);
+
+	/* @brief Use the tables, depth candidates and compiled filter of a calibration shared with other estimators.
+	Only the buffers of the frames are allocated: many estimators, e.g. one per stream or worker thread, 
+	are created cheaply from one calibration
+	@param calibration read-only data of the camera
+	*/
+	explicit DepthEstimator(std::shared_ptr<const DepthCalibration> const & calibration);
+
+	/* @brief Get the calibration the estimator was created from
+	@return read-only data of the camera
+	*/
+	inline std::shared_ptr<const DepthCalibration> const & getCalibration() const;
+
 	/* @brief set a new uneven birefractive image and run the restoration algorithm
 	@param img uneven birefractive image (CV_8UC3)
 	*/
 	inline void setFrame(const cv::UMat & img);
 
+	/* @brief Set a new uneven birefractive image straight from the camera buffer and run the restoration algorithm.
+	The demosaicing or YUV conversion is fused with the rectification, without a converted copy of the frame.
+	The buffer is only read during the call
+	@param raw camera buffer of the full frame size
+	*/
+	void setRawFrame(RawRectifier::Frame const & raw);
+
+	/* @brief Set a new uneven birefractive image and run the restoration algorithm 
+	only around regions of interest. Each region is processed on its rectified area expanded by the window 
+	and disparity range, so that the cost depends on the region sizes instead of the frame size.
+	The results are in getRoiOutputs(), the full frame outputs are not updated
+	@param img uneven birefractive image (CV_8UC3)
+	@param rois regions of interest in img
+	*/
+	void setFrame(const cv::UMat & img, std::vector<cv::Rect> const & rois);
+
+	/* @brief Get the results of the last setFrame with regions of interest
+	@return depth and restored image of each region
+	*/
+	inline std::vector<RoiOutput> const & getRoiOutputs() const;
+
 	/* @brief Restore a rectified birefractive image for a given disparity and tau value
 	@param disparity disparity candidate between e-ray and o-ray
 	@param tau intensity proportion in uneven double refraction (I_captured = tau * I_e + I_o, 0 < tau < 1)
-	@param imgRectified Rectified uneven birefractive image (CV_8UC3)
+	@param imgRectified Rectified uneven birefractive image (CV_8UC3, or CV_8UC1 for its luma)
 	@param translatedImg Handle for image translation. Must be initialised 
-	and have the same size as imgRectified (CV_8UC3)
-	@param reconsImgCandidate Output restored image (CV_8UC3)
+	and have the same size and type as imgRectified
+	@param reconsImgCandidate Output restored image, of the type of imgRectified
 	*/
 	static void restoreImage(float disparity, float tau, cv::UMat const & imgRectified, cv::UMat & translatedImg, cv::UMat & reconsImgCandidate);
 
-	/* @brief Convert the disparity map computed in setFrame to depth 
+	/* @brief Depth candidates as evenly spaced disparities, about spacing pixels apart
+	@param minZ Lowest depth candidate
+	@param maxZ Largest depth candidate
+	@param disparityCoef f * baseline such as disparity = disparityCoef * 1 / depth
+	@param spacing disparity step in pixels between candidates
+	@return disparity candidates
+	*/
+	static std::vector<float> depthCandidates(float minZ, float maxZ, float disparityCoef, float spacing = 1.f);
+
+	/* @brief Space the depth candidates further apart, over the same depth range. 
+	Together with a subpixel fit, fewer candidates can keep the precision of the depth 
+	(see the benchmark --mode subpixel)
+	@param spacing disparity step in pixels between candidates, 1 by default
+	*/
+	void setCandidateSpacing(float spacing);
+
+	/* @brief Allocate the images of a frame, for the area of frame.geometry
+	@param frame images of a frame
+	*/
+	void initFrame(FrameBuffers & frame) const;
+
+	/* @brief Run one stage of setFrame. 
+	Stages of different frames can run concurrently, but each stage on one frame at a time
+	@param stage stage to run, after the previous ones
+	@param frame images of the frame, initialised with initFrame. The rectification reads frame.img
+	*/
+	void runStage(Stage stage, FrameBuffers & frame);
+
+	/* @brief Get the name of a stage
+	@param stage processing stage
+	@return name in lower case
+	*/
+	static const char * getStageName(Stage stage);
+
+	/* @brief Convert the disparity map computed in setFrame to depth. 
+	The image is kept by the estimator and overwritten by the next call: copy it to keep it
 	@return depth map in mm (CV_32FC1)
 	*/
 	inline const cv::UMat getDepth();
 
-	/* @brief Get the coloured disparity map after being computed in setFrame
+	/* @brief Convert the disparity map of a frame processed with runStage to depth
+	@param frame images of the frame
+	@return depth map in mm (CV_32FC1), a new image owned by the caller
+	*/
+	const cv::UMat getDepth(FrameBuffers const & frame) const;
+
+	/* @brief Convert the disparity map of a frame to depth into a caller buffer, in a single pass: 
+	each of the 256 values of the sparse disparity map is looked up in a table of depths. 
+	No allocation once depth has the size and type of the output
+	@param frame images of the frame
+	@param depth output depth map, 0 where unreliable, on the OpenCL device when available
+	@param format type of the depth map
+	*/
+	void getDepth(FrameBuffers const & frame, cv::UMat & depth, DepthFormat format = DEPTH_32F) const;
+
+	/* @brief Convert the disparity map of a frame to depth into a caller buffer on the host, as the cv::UMat version
+	@param frame images of the frame
+	@param depth output depth map, 0 where unreliable
+	@param format type of the depth map
+	*/
+	void getDepth(FrameBuffers const & frame, cv::Mat & depth, DepthFormat format = DEPTH_32F) const;
+
+	/* @brief Convert the disparity map computed in setFrame to depth into a caller buffer, see getDepth(frame, depth, format)
+	@param depth output depth map, 0 where unreliable
+	@param format type of the depth map
+	*/
+	inline void getDepth(cv::Mat & depth, DepthFormat format = DEPTH_32F) const;
+
+	/* @brief Get the depth of each value of the sparse disparity maps, as looked up by getDepth
+	@param format type of the depths
+	@return table of 256 depths in mm, 0 for the unreliable value 0 (1x256 CV_32FC1 or CV_16UC1)
+	*/
+	inline cv::Mat const & getDepthTable(DepthFormat format = DEPTH_32F) const;
+
+	/* @brief Build a sparse output of the valid pixels of the disparity map, in the pass that finalises it: 
+	the rows are collected by the CPU filter while they are in cache, after the other filters in a pass over the map. 
+	Its size and the bytes written scale with the number of valid pixels instead of the image size. 
+	With a subpixel fit, the depth is the fitted one
+	@param format contents of the points, POINTS_NONE by default
+	@param intrinsics intrinsics of the input image for POINTS_XYZ
+	*/
+	void setPointFormat(PointFormat format, Intrinsics const & intrinsics = Intrinsics());
+
+	/* @brief Get the contents of the sparse output
+	@return point format
+	*/
+	inline PointFormat getPointFormat() const;
+
+	/* @brief Get the sparse output of the last setFrame, without copy. 
+	The points of a frame processed with runStage are in FrameBuffers::points
+	@return valid pixels in row order, empty with POINTS_NONE
+	*/
+	inline std::vector<SparsePoint> const & getSparsePoints() const;
+
+	/* @brief Convert the fractional disparity map computed in setFrame to depth, with a subpixel fit. 
+	The image is kept by the estimator and overwritten by the next call
+	@return depth map in mm, 0 where unreliable (CV_32FC1)
+	*/
+	inline const cv::UMat getSubpixelDepth();
+
+	/* @brief Convert the fractional disparity map of a frame processed with runStage to depth.
+	The valid pixels are those of getDepth, their disparity is the fitted one instead of the filtered one, 
+	converted with the mapping of getDepth
+	@param frame images of the frame, processed with a subpixel fit
+	@return depth map in mm, 0 where unreliable (CV_32FC1), a new image owned by the caller
+	*/
+	const cv::UMat getSubpixelDepth(FrameBuffers const & frame) const;
+
+	/* @brief Get the coloured disparity map after being computed in setFrame. 
+	The image is kept by the estimator and overwritten by the next call
 	@return coloured disparity map with cv::COLORMAP_MAGMA (CV_8UC3)
 	*/
 	inline const cv::UMat getDisparityMap();
 
+	/* @brief Colour the disparity map of a frame into a caller buffer, as getDisparityMap. 
+	The dilation and a table of the shifted colour map of the 256 disparities run in a single pass on the host, 
+	without allocation once colour has the size and type of the output
+	@param frame images of the frame
+	@param colour coloured disparity map with cv::COLORMAP_MAGMA (CV_8UC3)
+	*/
+	void getDisparityMap(FrameBuffers const & frame, cv::Mat & colour) const;
+
+	/* @brief Colour the disparity map of a frame into a caller buffer, see the cv::Mat version
+	@param frame images of the frame
+	@param colour coloured disparity map with cv::COLORMAP_MAGMA (CV_8UC3)
+	*/
+	void getDisparityMap(FrameBuffers const & frame, cv::UMat & colour) const;
+
 	/* @brief Get the restored image after being computed in setFrame
 	@return restored image (CV_8UC3)
 	*/
 	inline const cv::UMat getReconsImg();
 
+	/* @brief Select the implementation of the candidate sweep. 
+	Defaults to SWEEP_OPENCV with a GPU and SWEEP_CPU_FUSED otherwise. 
+	SWEEP_OPENCL needs the compiled sweep of the calibration, on any OpenCL device, and COST_RGB: 
+	it always restores the colour once with the winners, and ignores the searches of SWEEP_CPU_FUSED
+	@param engine sweep implementation
+	*/
+	inline void setSweepEngine(SweepEngine engine);
+
+	/* @brief Get the implementation of the candidate sweep
+	@return sweep implementation
+	*/
+	inline SweepEngine getSweepEngine() const;
+
+	/* @brief Select the planes of the candidate costs. The luma cost restores and matches a single plane, 
+	about a third of the work of the colour cost, and approximates it: 
+	compare the disparity maps of both on the scene before choosing it (see the benchmark --mode luma)
+	@param mode cost planes, COST_RGB by default
+	*/
+	inline void setCostMode(CostMode mode);
+
+	/* @brief Get the planes of the candidate costs
+	@return cost planes
+	*/
+	inline CostMode getCostMode() const;
+
+	/* @brief Restore the colour once after the sweep from the winning disparities, 
+	instead of merging the restored image of every candidate with a masked copy (see CostSweep::restoreLabels). 
+	The restored image is the same; with COST_LUMA, the sweep then never restores the colour. 
+	The restoration runs on the CPU, after the SWEEP_OPENCV chain it maps the images to the host
+	@param deferred true to restore after the sweep
+	*/
+	inline void setDeferredColour(bool deferred);
+
+	/* @brief Get whether the colour is restored after the sweep
+	@return true if deferred
+	*/
+	inline bool getDeferredColour() const;
+
+	/* @brief Fit a curve through the cost of the winner and of its neighbouring candidates, 
+	for a fractional disparity map and getSubpixelDepth(), see CostSweep::setSubpixelFit
+	@param fit fitted curve, CostSweep::SUBPIXEL_NONE by default
+	*/
+	inline void setSubpixelFit(CostSweep::SubpixelFit fit);
+
+	/* @brief Get the curve fitted for the fractional disparity map
+	@return fitted curve
+	*/
+	inline CostSweep::SubpixelFit getSubpixelFit() const;
+
+	/* @brief Use a coarse-to-fine candidate search in the SWEEP_CPU_FUSED sweep, see CostSweep::setHierarchicalSearch
+	@param stride one candidate every stride in the coarse pass, 1 for the exhaustive sweep
+	@param tileSize side in pixels of the tiles selecting their fine candidates
+	@param minTileShare minimum share of a tile won by a coarse candidate to refine around it
+	*/
+	inline void setHierarchicalSearch(int stride, int tileSize = 256, float minTileShare = 0.02f);
+
+	/* @brief Reuse the previous frame in the SWEEP_CPU_FUSED sweep of video streams, see CostSweep::setTemporalSearch.
+	Tiles without change only evaluate the candidates around their previous labels having a clear winner.
+	Frames must come in order, as with setFrame and DepthPipeline
+	@param window candidates evaluated on each side of a previous label, 0 to disable
+	@param tileSize side in pixels of the tiles
+	@param changeThresh mean absolute intensity difference above which a tile is swept with all candidates
+	@param refreshPeriod number of frames between full sweeps, 0 for never
+	*/
+	inline void setTemporalSearch(int window, int tileSize = 64, float changeThresh = 4.f, int refreshPeriod = 30);
+
+	/* @brief Skip the candidate sweep of the SWEEP_CPU_FUSED engine far from textured areas, see CostSweep::setTextureGate.
+	The gradient threshold bounds the gradient the restored image can reach at the mask resolution, 
+	rounding of the intermediate images included, and the dilation covers the pixels read by the mask and filter stages: 
+	the depth of the pixels that can end up valid is unchanged
+	@param enable true to gate the sweep
+	*/
+	void setTextureGate(bool enable);
+
+	/* @brief Get the fused CPU sweep, e.g. for the tile candidates of the last frame
+	@return fused sweep of the estimator
+	*/
+	inline CostSweep const & getCostSweep() const;
+
+	/* @brief Select the implementation of the disparity map filtering. 
+	Defaults to FILTER_OPENCL with a GPU and FILTER_CPU otherwise
+	@param engine filter implementation, FILTER_OPENCL requires the compiled filter of the calibration, on any OpenCL device
+	*/
+	inline void setFilterEngine(FilterEngine engine);
+
+	/* @brief Get the implementation of the disparity map filtering
+	@return filter implementation
+	*/
+	inline FilterEngine getFilterEngine() const;
+
+	/* @brief Get the time spent filtering the disparity map of the last frame
+	@return time in ms
+	*/
+	inline double getFilterTime() const;
+
+	/* @brief Get the filtering throughput for the last frame
+	@return disparity map pixels per second, in millions
+	*/
+	inline double getFilterThroughput() const;
+
+	/* @brief Enable the instrumentation of the stages. When enabled, the profiler receives
+	for every stage its wall time (series and trace event named after the stage) and the bytes 
+	of the images it reads and writes ("<stage>_bytes"), the time of each candidate ("candidate_<index>")
+	and the number of valid pixels of the sparse disparity map ("valid_pixels").
+	Each stage then waits for the OpenCL queue so that GPU work is attributed to it.
+	When disabled, the stages only test this flag
+	@param profiling true to enable
+	*/
+	inline void setProfiling(bool profiling);
+
+	/* @brief Get whether the stages are instrumented
+	@return true if enabled
+	*/
+	inline bool getProfiling() const;
+
+	/* @brief Get the measures of the instrumentation, with rolling statistics and trace dump
+	@return profiler of the estimator
+	*/
+	inline StageProfiler & getProfiler();
+
+	/* @brief Get the bytes held by the estimator. The temporary images of the stages are planned 
+	for the current settings; the other buffers are counted once allocated, call it after a frame
+	@return bytes of each kind of buffer, with the steady and peak totals
+	*/
+	MemoryFootprint getMemoryFootprint() const;
+
+	/* @brief Release the temporary images of the stages, e.g. when idle between bursts of frames. 
+	The next frame allocates them again: the estimator then holds the steady bytes of getMemoryFootprint.
+	Not thread-safe with the stages
+	*/
+	void releaseScratch();
+
 private:
-	/* Compile "bilateral_filter.cl" code for disparity map filtering */
-	void readAndCompileFilter(cv::ocl::Context &context);
+	/* Rectify the input image */
+	void rectify(FrameBuffers & frame);
+
+	/* Geometry of the area processed in a frame */
+	inline Geometry const & getGeometry(FrameBuffers const & frame) const;
+
+	/* Tables of a region of interest of the input image */
+	void setRoiGeometry(cv::Rect const & roi, Geometry & geometry) const;
+
+	/* Record the measures of a stage which started at the tick count start */
+	void profileStage(Stage stage, FrameBuffers const & frame, int64 start);
+
+	/* Bytes of the images read and written by a stage */
+	double stageBytes(Stage stage, FrameBuffers const & frame) const;
 
 	/* RestoreImage for all depth candidate, 
 	compute cost and select the best depth and colour */
-	void reconstructDepthAndColour();
+	void reconstructDepthAndColour(FrameBuffers & frame);
 
 	/* Reverse rectification and tweak the colour image 
 	fix intensity and boundaries
 	*/
-	void unwarpAndFixColour();
+	void unwarpAndFixColour(FrameBuffers & frame);
 
 	/* Compute confidence and mask out unreliable areas in the disparity map */
-	void maskDisparityMap();
+	void maskDisparityMap(FrameBuffers & frame);
 
 	/* Filter the sparse disparity map using a bilateral filter */
-	void filterDisparity();
+	void filterDisparity(FrameBuffers & frame);
+
+	/* Candidate sweep of SWEEP_OPENCL, in tiles sized for the local memory of the device */
+	void runSweepKernel(FrameBuffers & frame);
+
+	/* Fractional labels of a frame from the neighbour costs kept by the SWEEP_OPENCV and SWEEP_OPENCL sweeps */
+	void fitSubpixelLabels(FrameBuffers & frame);
+
+	/* Translations and tau scalings of the current candidates for the kernel of SWEEP_OPENCL */
+	void updateSweepTables();
+
+	/* Depth and colour of each value of the sparse disparity map, for the current candidates */
+	void updateOutputTables();
+
+	/* Append the valid pixels of the row y of the sparse disparity map to points. 
+	subDisparityMap holds the fractional labels with a subpixel fit, origin is the position of the maps in getDepth() */
+	void collectPoints(cv::Mat const & sparseDisparityMap, cv::Mat const & reconsImgConf, cv::Mat const & subDisparityMap, 
+		cv::Point origin, int y, std::vector<SparsePoint> & points) const;
+
+	/* Collect the points of the final sparse disparity map of a frame into frame.points, 
+	in bands of rows running in parallel. rowReady, if set, is called on each row before, e.g. to filter it */
+	void collectBands(FrameBuffers & frame, cv::Mat const & sparseDisparityMap, cv::Mat const & reconsImgConf, 
+		cv::Mat const & subDisparityMap, std::function<void(int)> const & rowReady);
+
+	/* Dilate and colour a sparse disparity map with the colour table */
+	void colourDisparity(cv::Mat const & sparseDisparityMap, cv::Mat & colour) const;
+
+	/* Convert the fractional disparity map of a frame to depth, 
+	without allocation when depth and mask have the size of the map */
+	void computeSubpixelDepth(FrameBuffers const & frame, cv::UMat & depth, cv::UMat & mask) const;
+
+	/* Temporary images of the stages running on one thread, views on the memory of an arena */
+	struct Scratch
+	{
+		ScratchArena arena;
+		std::vector<std::pair<int, cv::UMat DepthEstimator::*> > views; // Buffer of each image in the arena
+	};
+
+	/* Declare the temporary images of the stages for the current settings */
+	void planScratch();
+
+	/* Declare a temporary image of scratch, live from the step first to the step last */
+	static void addScratch(Scratch & scratch, cv::UMat DepthEstimator::* image, int type, cv::Size size, int first, int last);
+
+	/* Allocate the memory of scratch if needed and bind its images at a size */
+	void bindScratch(Scratch & scratch, cv::Size size);
 
 	/// Parameters
 	// Horizontal f*baseline: disparity = m_disparityCoef / depth
@@ -123,35 +609,53 @@ private:
 	std::vector<float> m_disparities; // disparity candidates
 	unsigned char m_threshGrad; // Threshold for vertical edges in mask computation
 	unsigned char m_threshCost; // Threshold for clear winner in mask computation
+	SweepEngine m_sweepEngine; // Implementation of the candidate sweep
+	CostMode m_costMode = COST_RGB; // Planes of the candidate costs
+	bool m_deferredColour = false; // Restore the colour after the sweep
+	CostSweep::SubpixelFit m_subpixelFit = CostSweep::SUBPIXEL_NONE; // Curve fitted for fractional labels
 	
-	// Rectification tables
+	// Rectification tables, views on the tables of m_calibration
+	std::shared_ptr<const DepthCalibration> m_calibration;
 	cv::UMat m_tformInd1, m_tformInd2, 
 		m_invInd1, m_invInd2, m_invIndMask1, m_invIndMask2;
+	Geometry m_fullGeometry; // Tables of the full frame
+	int m_minShift = 0, m_maxShift = 0; // Extreme column offsets read by the restoration
+
+	/// Regions of interest
+	std::vector<Geometry> m_roiGeometries;
+	std::vector<FrameBuffers> m_roiFrames;
+	std::vector<RoiOutput> m_roiOutputs;
 
 	/// Image and colour restoration
-	cv::UMat m_img;
-	cv::UMat m_imgRectified; // Rectified input image
-	cv::UMat m_reconsImg; // Restored image
-	cv::UMat m_reconsImgRectified; // Rectified restored image
+	FrameBuffers m_frame; // Images of the frame processed by setFrame
 	cv::UMat m_translatedImg; // Translated image handler for image reconstruction
 	cv::UMat m_reconsImgCandidate; // Restored image for a given candidate
+	// Luma of the rectified image, its translation and restoration for a given candidate with COST_LUMA
+	cv::UMat m_imgLuma, m_translatedLuma, m_reconsLumaCandidate;
 	
 	/// Cost computation
 	// Cost and handles for a given candidate
 	cv::UMat m_cost, m_costHandle, m_costrgb1, m_costrgb2;
-	// Best and worse cost for candidate selection and mask computation
-	cv::UMat m_minCost, m_maxCost;
 	cv::UMat m_maskBest; // Mask of where the current candidate is the best
+	// Costs of the candidates next to the winner, of the current and previous candidates (CV_16SC1),
+	// and mask of the pixels won by the previous candidate, for the subpixel fit
+	cv::UMat m_lowerCost, m_upperCost, m_cost16, m_previousCost16, m_maskNeighbour;
 	// filters for gradient computation
 	cv::Mat m_kernelGrad1, m_kernelGrad2;
+	CostSweep m_costSweep; // Fused CPU sweep
+	cv::ocl::Kernel m_kernelSweep; // ocl kernel of SWEEP_OPENCL, from the program of m_calibration
+	// Tables of the CostSweep for the kernel: candidate translations (CV_32SC2) and tau scalings (CV_8UC1)
+	cv::UMat m_sweepTranslations, m_sweepTauScales;
+	float m_sweepInvWinSize = 1.f; // Reciprocal giving the rounded window mean by truncation
+	// Images of the cv:: sweep, the only one of the stage. 
+	// The sweep and the next stages of other frames run concurrently in DepthPipeline: they do not share memory
+	Scratch m_sweepScratch;
 
 	/// Disparity maps
-	// Disparity map after winner-takes all on all pixels
-	cv::UMat m_fullDisparityMap; 
-	// Disparity map with unreliable areas filtered out
-	cv::UMat m_sparseDisparityMap;
 	// Resized disparity map for confidence estimation
 	cv::UMat m_fullDisparityMapConf;
+	// Resized fractional disparity map and its handle
+	cv::UMat m_subDisparityMapConf, m_subHandle;
 
 	/// Mask computation
 	cv::UMat m_confidence; // Confidence map for reliable areas
@@ -161,61 +665,204 @@ private:
 	cv::UMat m_edges1Conf, m_edges2Conf, m_edgesGreyConf; 
 	// Handle for some conputations on the confidence
 	cv::UMat m_handle, m_maskConfidence;
+	cv::Mat m_kernelErode; // Erosion of the confidence map
+	Scratch m_tailScratch; // Images of the unwarp, mask and filter stages, which run one after the other
 
 	/// Disparity map filtering 
-	static const int m_filterSize = 21, m_filterRadius = m_filterSize / 2;
-	bool m_disparityFiltering = true;
-	cv::ocl::Kernel m_kernelBilateral; // ocl kernel for disparity filtering
-	// weights and indices for disparity map filtering
-	cv::UMat m_spaceWeight, m_filterIndCn1, m_filterIndCn3;
+	static const int m_outlierThresh = 8; // Largest change of a filtered disparity
+	FilterEngine m_filterEngine; // Implementation of the filtering
+	SparseBilateralFilter m_bilateralFilter; // Filter weights and CPU implementation
+	cv::ocl::Kernel m_kernelBilateral; // ocl kernel for disparity filtering, from the program of m_calibration
+	cv::UMat m_spaceWeight; // weights for disparity map filtering
+	double m_filterTime = 0.; // Filtering time of the last frame in ms
+
+	/// Sparse output
+	PointFormat m_pointFormat = POINTS_NONE;
+	Intrinsics m_intrinsics; // Intrinsics of the input image for POINTS_XYZ
+	std::vector<std::vector<SparsePoint> > m_pointBands; // Points of each band of rows, concatenated into the frame
+
+	/// Outputs, kept from one call to the next
+	cv::UMat m_depth, m_subpixelDepth, m_outputMask; // Depth maps and mask of the unreliable fractional disparities
+	cv::UMat m_disparityMap; // Coloured disparity map
+	// Depth of each value of the sparse disparity map in each DepthFormat, 0 for 0 (1x256), and their device copies
+	cv::Mat m_depthTables[2];
+	cv::UMat m_depthTablesDevice[2];
+	float m_inverseDepthScale, m_inverseDepthOffset; // Inverse depth of a fractional label: label * scale + offset, as the tables
+	cv::Mat m_disparityColours; // Shifted colour map of each value of the sparse disparity map (1x256, CV_8UC3)
+	std::vector<cv::UMat> m_roiDepths; // Depth of the regions of interest, with the halo of the filter
+
+	/// Instrumentation
+	bool m_profiling = false;
+	StageProfiler m_profiler;
 };
 
 
 inline void DepthEstimator::setFrame(const cv::UMat & img)
 {
-	m_img = img;
-	cv::remap(m_img, m_imgRectified, m_tformInd1, m_tformInd2, cv::INTER_LINEAR);
-	reconstructDepthAndColour();
-	unwarpAndFixColour();
-	maskDisparityMap();
-	filterDisparity();
+	m_frame.img = img;
+	m_frame.raw = RawRectifier::Frame();
+	for (int stage(0); stage < STAGE_COUNT; stage++)
+	{
+		runStage(Stage(stage), m_frame);
+	}
 }
 
 inline const cv::UMat DepthEstimator::getDepth()
 {
-	cv::UMat depth;
-	
-	// Map disparity to the [0, 1] range
-	m_sparseDisparityMap.convertTo(depth, CV_32F, 
-		1. / (255.), -1. / m_zCount);
-	// Map to the [1. / maxDepth, 1. / minDepth] range
-	double minDepth(1. / (m_disparities[m_zCount - 1] / m_disparityCoef)), maxDepth(1. / (m_disparities[0] / m_disparityCoef));
-	cv::multiply(depth, (1. / minDepth - 1. / maxDepth), depth);
-	cv::add(depth, 1. / maxDepth, depth);
-	// Convert to depth
-	cv::divide(1., depth, depth);
-	// Mask out unreliable areas
-	cv::compare(m_sparseDisparityMap, 0, m_maskConfidence, cv::CMP_EQ);
-	depth.setTo(0., m_maskConfidence);
-
-	return depth;
+	getDepth(m_frame, m_depth);
+	return m_depth;
 }
 
-inline const cv::UMat DepthEstimator::getDisparityMap()
+inline void DepthEstimator::getDepth(cv::Mat & depth, DepthFormat format) const
 {
-	cv::UMat disparityMap;
+	getDepth(m_frame, depth, format);
+}
 
-	// Shift the disparity map to get a better sparse visualisation
-	cv::multiply(m_sparseDisparityMap, 0.8, disparityMap);
-	cv::add(disparityMap, 0.25 * 255., disparityMap, disparityMap);
-	cv::dilate(disparityMap, disparityMap, cv::UMat::ones(3, 3, CV_8UC1));
-	cv::applyColorMap(disparityMap, disparityMap, cv::COLORMAP_MAGMA);
+inline const cv::UMat DepthEstimator::getSubpixelDepth()
+{
+	computeSubpixelDepth(m_frame, m_subpixelDepth, m_outputMask);
+	return m_subpixelDepth;
+}
 
-	return disparityMap;
+inline const cv::UMat DepthEstimator::getDisparityMap()
+{
+	getDisparityMap(m_frame, m_disparityMap);
+	return m_disparityMap;
 }
 
 inline const cv::UMat DepthEstimator::getReconsImg()
 {
-	return m_reconsImg;
+	return m_frame.reconsImg;
+}
+
+inline cv::Mat const & DepthEstimator::getDepthTable(DepthFormat format) const
+{
+	return m_depthTables[format];
+}
+
+inline DepthEstimator::PointFormat DepthEstimator::getPointFormat() const
+{
+	return m_pointFormat;
+}
+
+inline std::vector<DepthEstimator::SparsePoint> const & DepthEstimator::getSparsePoints() const
+{
+	return m_frame.points;
+}
+
+inline std::shared_ptr<const DepthCalibration> const & DepthEstimator::getCalibration() const
+{
+	return m_calibration;
+}
+
+inline std::vector<DepthEstimator::RoiOutput> const & DepthEstimator::getRoiOutputs() const
+{
+	return m_roiOutputs;
+}
+
+inline DepthEstimator::Geometry const & DepthEstimator::getGeometry(FrameBuffers const & frame) const
+{
+	return frame.geometry ? *frame.geometry : m_fullGeometry;
+}
+
+inline void DepthEstimator::setSweepEngine(SweepEngine engine)
+{
+	CV_Assert(engine != SWEEP_OPENCL || (!m_kernelSweep.empty() && m_costMode == COST_RGB));
+	m_sweepEngine = engine;
+	planScratch();
+}
+
+inline DepthEstimator::SweepEngine DepthEstimator::getSweepEngine() const
+{
+	return m_sweepEngine;
+}
+
+inline void DepthEstimator::setCostMode(CostMode mode)
+{
+	CV_Assert(mode == COST_RGB || m_sweepEngine != SWEEP_OPENCL);
+	m_costMode = mode;
+	m_costSweep.setLumaCost(mode == COST_LUMA);
+	planScratch();
+}
+
+inline DepthEstimator::CostMode DepthEstimator::getCostMode() const
+{
+	return m_costMode;
+}
+
+inline void DepthEstimator::setDeferredColour(bool deferred)
+{
+	m_deferredColour = deferred;
+	m_costSweep.setDeferredColour(deferred);
+	planScratch();
+}
+
+inline bool DepthEstimator::getDeferredColour() const
+{
+	return m_deferredColour;
+}
+
+inline void DepthEstimator::setSubpixelFit(CostSweep::SubpixelFit fit)
+{
+	m_subpixelFit = fit;
+	m_costSweep.setSubpixelFit(fit);
+	planScratch();
+}
+
+inline CostSweep::SubpixelFit DepthEstimator::getSubpixelFit() const
+{
+	return m_subpixelFit;
+}
+
+inline void DepthEstimator::setHierarchicalSearch(int stride, int tileSize, float minTileShare)
+{
+	m_costSweep.setHierarchicalSearch(stride, tileSize, minTileShare);
+}
+
+inline void DepthEstimator::setTemporalSearch(int window, int tileSize, float changeThresh, int refreshPeriod)
+{
+	m_costSweep.setTemporalSearch(window, tileSize, changeThresh, m_threshCost, refreshPeriod);
+}
+
+inline CostSweep const & DepthEstimator::getCostSweep() const
+{
+	return m_costSweep;
+}
+
+inline void DepthEstimator::setFilterEngine(FilterEngine engine)
+{
+	CV_Assert(engine != FILTER_OPENCL || !m_kernelBilateral.empty());
+	m_filterEngine = engine;
+}
+
+inline DepthEstimator::FilterEngine DepthEstimator::getFilterEngine() const
+{
+	return m_filterEngine;
+}
+
+inline double DepthEstimator::getFilterTime() const
+{
+	return m_filterTime;
+}
+
+inline double DepthEstimator::getFilterThroughput() const
+{
+	return m_filterTime > 0. ? double(m_frame.sparseDisparityMap.total()) / (1000. * m_filterTime) : 0.;
+}
+
+inline void DepthEstimator::setProfiling(bool profiling)
+{
+	m_profiling = profiling;
+	m_costSweep.setProfiling(profiling);
+}
+
+inline bool DepthEstimator::getProfiling() const
+{
+	return m_profiling;
+}
+
+inline StageProfiler & DepthEstimator::getProfiler()
+{
+	return m_profiler;
 }
 #endif // DEPTHESTIMATOR_H
\ No newline at end of file
@@ -0,0 +1,253 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include "depth_pipeline.h"
+
+#include <iostream>
+
+DepthPipeline::DepthPipeline(DepthEstimator & depthEstimator, int maxInFlight) :
+	m_depthEstimator(depthEstimator),
+	m_maxInFlight(std::max(1, maxInFlight))
+{
+	m_frames.resize(m_maxInFlight);
+	for (int i(0); i < m_maxInFlight; i++)
+	{
+		m_depthEstimator.initFrame(m_frames[i]);
+		m_freeSlots.push_back(m_maxInFlight - 1 - i);
+	}
+
+	for (int stage(0); stage < STAGE_COUNT; stage++)
+	{
+		m_threads.push_back(std::thread(&DepthPipeline::stageLoop, this, stage));
+	}
+}
+
+DepthPipeline::~DepthPipeline()
+{
+	flush();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	for (int stage(0); stage < STAGE_COUNT; stage++)
+	{
+		m_queueReady[stage].notify_all();
+	}
+	for (size_t i(0); i < m_threads.size(); i++)
+	{
+		m_threads[i].join();
+	}
+}
+
+std::future<DepthPipeline::Result> DepthPipeline::submit(cv::UMat const & img)
+{
+	std::shared_ptr<Job> job(std::make_shared<Job>());
+	std::future<Result> result(job->promise.get_future());
+	enqueue(img, job, true);
+	return result;
+}
+
+int64 DepthPipeline::submit(cv::UMat const & img, Callback callback)
+{
+	std::shared_ptr<Job> job(std::make_shared<Job>());
+	job->callback = callback;
+	return enqueue(img, job, true);
+}
+
+int64 DepthPipeline::trySubmit(cv::UMat const & img, Callback callback)
+{
+	std::shared_ptr<Job> job(std::make_shared<Job>());
+	job->callback = callback;
+	return enqueue(img, job, false);
+}
+
+void DepthPipeline::flush()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_slotReleased.wait(lock, [this] { return int(m_freeSlots.size()) == m_maxInFlight; });
+}
+
+int DepthPipeline::getInFlightCount() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_maxInFlight - int(m_freeSlots.size());
+}
+
+int64 DepthPipeline::enqueue(cv::UMat const & img, std::shared_ptr<Job> const & job, bool wait)
+{
+	CV_Assert(img.type() == CV_8UC3);
+	{
+		// Backpressure: wait for the oldest frame to be delivered
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (wait)
+			m_slotReleased.wait(lock, [this] { return !m_freeSlots.empty(); });
+		else if (m_freeSlots.empty())
+			return -1;
+		job->slot = m_freeSlots.back();
+		m_freeSlots.pop_back();
+		job->frameId = m_nextFrameId++;
+		job->result.frameId = job->frameId;
+		// Queued with its id, so that concurrent producers keep the submission order
+		m_queues[STAGE_RECTIFY].push_back(job);
+	}
+
+	// The caller may reuse its image: the copy is the only work done on its thread. 
+	// A failed copy is delivered as the error of the frame
+	int64 frameId(job->frameId);
+	try
+	{
+		img.copyTo(m_frames[job->slot].img);
+	}
+	catch (...)
+	{
+		job->error = std::current_exception();
+	}
+	// Each thread has its own OpenCL queue: the copy is done before the rectification thread reads it
+	cv::ocl::finish();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		job->copied = true;
+	}
+	m_queueReady[STAGE_RECTIFY].notify_one();
+	return frameId;
+}
+
+void DepthPipeline::stageLoop(int stage)
+{
+	while (true)
+	{
+		std::shared_ptr<Job> job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			// The rectification waits for the input of the oldest frame to be copied
+			m_queueReady[stage].wait(lock, [this, stage] 
+			{
+				return m_stop || (!m_queues[stage].empty() && (stage != STAGE_RECTIFY || m_queues[stage].front()->copied));
+			});
+			if (m_queues[stage].empty())
+				return;
+			job = m_queues[stage].front();
+			m_queues[stage].pop_front();
+		}
+
+		// Skip the remaining stages of a failed frame
+		if (!job->error)
+		{
+			try
+			{
+				runStage(stage, *job);
+			}
+			catch (...)
+			{
+				job->error = std::current_exception();
+			}
+		}
+		// The kernels of the stage ran on the queue of this thread: wait for them before the next stage, 
+		// on another thread and queue, maps or reuses the frame buffers, also after a failure
+		cv::ocl::finish();
+
+		if (stage + 1 < STAGE_COUNT)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_queues[stage + 1].push_back(job);
+			}
+			m_queueReady[stage + 1].notify_one();
+		}
+		else
+		{
+			complete(*job);
+		}
+	}
+}
+
+void DepthPipeline::runStage(int stage, Job & job)
+{
+	DepthEstimator::FrameBuffers & frame(m_frames[job.slot]);
+	switch (stage)
+	{
+	case STAGE_RECTIFY:
+		m_depthEstimator.runStage(DepthEstimator::STAGE_RECTIFY, frame);
+		break;
+	case STAGE_SWEEP:
+		m_depthEstimator.runStage(DepthEstimator::STAGE_SWEEP, frame);
+		break;
+	case STAGE_FINISH:
+		m_depthEstimator.runStage(DepthEstimator::STAGE_UNWARP, frame);
+		m_depthEstimator.runStage(DepthEstimator::STAGE_MASK, frame);
+		m_depthEstimator.runStage(DepthEstimator::STAGE_FILTER, frame);
+		// The frame buffers are reused by later frames
+		job.result.depth = m_depthEstimator.getDepth(frame);
+		frame.reconsImg.copyTo(job.result.reconsImg);
+		frame.sparseDisparityMap.copyTo(job.result.sparseDisparityMap);
+		job.result.points = frame.points;
+		break;
+	}
+}
+
+void DepthPipeline::complete(Job & job)
+{
+	if (job.callback)
+	{
+		// Errors cannot be handed to the caller: report them
+		try
+		{
+			if (job.error)
+				std::rethrow_exception(job.error);
+			job.callback(job.result);
+		}
+		catch (std::exception const & e)
+		{
+			std::cout << "Frame " << job.frameId << " failed: " << e.what() << std::endl;
+		}
+		catch (...)
+		{
+			std::cout << "Frame " << job.frameId << " failed" << std::endl;
+		}
+	}
+	else if (job.error)
+	{
+		job.promise.set_exception(job.error);
+	}
+	else
+	{
+		job.promise.set_value(std::move(job.result));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_freeSlots.push_back(job.slot);
+	}
+	m_slotReleased.notify_all();
+}
@@ -0,0 +1,168 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#ifndef DEPTHPIPELINE_H
+#define DEPTHPIPELINE_H
+
+#include <opencv2/core/core.hpp>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "depth_estimator.h"
+
+/* @class DepthPipeline
+@brief Streaming interface to DepthEstimator. Frames are submitted and their results 
+are delivered through a future or a callback, in submission order.
+Each stage runs on its own thread: the rectification, the candidate sweep 
+and the tail (unwarp, mask and filter) of consecutive frames overlap.
+At most maxInFlight frames are processed at the same time; submitting more blocks the caller 
+until the oldest frame has been delivered, so a slow consumer slows down the producer.
+*/
+class DepthPipeline
+{
+public:
+	/* Outputs of a frame */
+	struct Result
+	{
+		int64 frameId = -1; // Index of the frame in submission order
+		cv::UMat depth; // Depth map in mm, 0 for unreliable areas (CV_32FC1)
+		cv::UMat reconsImg; // Restored image (CV_8UC3)
+		cv::UMat sparseDisparityMap; // Disparity map the depth is converted from, 0 for unreliable areas (CV_8UC1)
+		std::vector<DepthEstimator::SparsePoint> points; // Valid pixels, with a point format (see DepthEstimator::setPointFormat)
+	};
+
+	/* Called on the pipeline thread when a frame is done. It must not submit frames */
+	typedef std::function<void(Result &)> Callback;
+
+	/* @brief Start the stage threads
+	@param depthEstimator estimator providing the parameters and stages. 
+	It must outlive the pipeline and not be used directly in the meantime
+	@param maxInFlight largest number of frames in the pipeline, at least 1
+	*/
+	DepthPipeline(DepthEstimator & depthEstimator, int maxInFlight = 3);
+
+	/* @brief Deliver the frames in flight and stop the threads */
+	~DepthPipeline();
+
+	/* @brief Submit a frame, blocking while maxInFlight frames are in flight
+	@param img uneven birefractive image (CV_8UC3), copied
+	@return result of the frame
+	*/
+	std::future<Result> submit(cv::UMat const & img);
+
+	/* @brief Submit a frame, blocking while maxInFlight frames are in flight
+	@param img uneven birefractive image (CV_8UC3), copied
+	@param callback called with the result of the frame. 
+	A slow callback holds the frame in flight and applies backpressure
+	@return id of the frame
+	*/
+	int64 submit(cv::UMat const & img, Callback callback);
+
+	/* @brief Submit a frame if fewer than maxInFlight frames are in flight
+	@param img uneven birefractive image (CV_8UC3), copied
+	@param callback called with the result of the frame
+	@return id of the frame, -1 if the frame was dropped
+	*/
+	int64 trySubmit(cv::UMat const & img, Callback callback);
+
+	/* @brief Wait until all submitted frames are delivered */
+	void flush();
+
+	/* @brief Get the number of frames submitted and not delivered yet */
+	int getInFlightCount() const;
+
+	/* @brief Get the largest number of frames in flight */
+	inline int getMaxInFlight() const;
+
+private:
+	/* Processing stages, each on its own thread */
+	enum Stage
+	{
+		STAGE_RECTIFY, // Input remapping
+		STAGE_SWEEP, // Candidate sweep
+		STAGE_FINISH, // Unwarp, mask, filter and outputs
+		STAGE_COUNT
+	};
+
+	/* A frame going through the stages */
+	struct Job
+	{
+		int64 frameId;
+		int slot; // Index of the frame buffers
+		Result result;
+		Callback callback; // Empty when the result goes to the promise
+		std::promise<Result> promise;
+		std::exception_ptr error; // First error of the stages
+		bool copied = false; // The input is in the frame buffers: the rectification can start
+	};
+
+	/* Take free frame buffers and queue the job in submission order, then copy the input. 
+	-1 if none is free and wait is false */
+	int64 enqueue(cv::UMat const & img, std::shared_ptr<Job> const & job, bool wait);
+
+	/* Run the jobs of a stage until stopped */
+	void stageLoop(int stage);
+
+	/* Process a job for one stage */
+	void runStage(int stage, Job & job);
+
+	/* Deliver the result and release the frame buffers */
+	void complete(Job & job);
+
+	DepthEstimator & m_depthEstimator;
+	int m_maxInFlight;
+	std::vector<DepthEstimator::FrameBuffers> m_frames; // Buffers of the frames in flight
+	std::vector<int> m_freeSlots; // Frame buffers available
+	int64 m_nextFrameId = 0;
+	bool m_stop = false;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_slotReleased; // A frame has been delivered
+	std::deque<std::shared_ptr<Job>> m_queues[STAGE_COUNT]; // Jobs waiting for each stage
+	std::condition_variable m_queueReady[STAGE_COUNT]; // A job has been queued for a stage
+	std::vector<std::thread> m_threads;
+};
+
+
+inline int DepthPipeline::getMaxInFlight() const
+{
+	return m_maxInFlight;
+}
+#endif // DEPTHPIPELINE_H
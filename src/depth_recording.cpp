@@ -0,0 +1,390 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include "depth_recording.h"
+
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+	const char RECORDING_MAGIC[8] = { 'U', 'R', 'G', 'B', 'D', 'R', 'E', 'C' };
+	const uint32_t RECORDING_VERSION(1);
+	const uint32_t FRAME_MAGIC(0x454d5246); // "FRME"
+	const uint64_t RECORDING_ALIGNMENT(64);
+
+	/* Beginning of the file, rewritten with the index by DepthRecorder::close */
+	struct FileHeader
+	{
+		MappedFile::Signature signature;
+		uint32_t codec;
+		uint32_t frameCount;
+		uint64_t indexOffset; // 0 if the recording was not closed
+		float depthTable[256];
+	};
+
+	/* Beginning of a frame, followed by the encoded disparity map, then by the colour at the next alignment */
+	struct FrameHeader
+	{
+		uint32_t magic;
+		int32_t rows, cols; // Disparity map
+		int32_t originX, originY;
+		int32_t colourRows, colourCols;
+		int32_t padding;
+		int64_t frameId;
+		uint64_t disparityBytes, colourBytes;
+	};
+
+	uint64_t alignOffset(uint64_t offset)
+	{
+		return MappedFile::alignOffset(offset, RECORDING_ALIGNMENT);
+	}
+
+	// Offset of the colour of a frame and of the next frame
+	uint64_t colourOffset(uint64_t offset, FrameHeader const & header)
+	{
+		return alignOffset(offset + sizeof(FrameHeader) + header.disparityBytes);
+	}
+
+	uint64_t nextOffset(uint64_t offset, FrameHeader const & header)
+	{
+		return alignOffset(colourOffset(offset, header) + header.colourBytes);
+	}
+
+	// Unsigned LEB128
+	uchar * putVarint(uchar * out, uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			*out++ = uchar(value | 0x80);
+			value >>= 7;
+		}
+		*out++ = uchar(value);
+		return out;
+	}
+
+	bool getVarint(const uchar * & in, const uchar * end, uint64_t & value)
+	{
+		value = 0;
+		for (int shift(0); in < end && shift < 64; shift += 7)
+		{
+			uchar byte(*in++);
+			value |= uint64_t(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	/* Runs of the map in row-major order: (length of the run of 0, length of the following valid run, its values), 
+	with the valid runs cut at the end of the rows. The 0 after the last valid run are implicit */
+	size_t encodeDisparity(cv::Mat const & map, std::vector<uchar> & buffer)
+	{
+		// Worst case: runs are cut at the row ends, so a single column of valid pixels takes 3 bytes per pixel. 
+		// A longer varint needs a run of more than 127 pixels
+		buffer.resize(3 * map.total() + 16);
+		uchar * out(buffer.data());
+		uint64_t zeros(0);
+		for (int y(0); y < map.rows; y++)
+		{
+			const uchar * row(map.ptr<uchar>(y));
+			int x(0);
+			while (x < map.cols)
+			{
+				int start(x);
+#if CV_SIMD128
+				while (x + 16 <= map.cols && !cv::v_check_any(cv::v_load(row + x) != cv::v_setall_u8(0)))
+				{
+					x += 16;
+				}
+#endif
+				while (x < map.cols && !row[x])
+				{
+					x++;
+				}
+				zeros += uint64_t(x - start);
+				if (x == map.cols)
+					break;
+
+				start = x;
+				while (x < map.cols && row[x])
+				{
+					x++;
+				}
+				out = putVarint(out, zeros);
+				out = putVarint(out, uint64_t(x - start));
+				std::memcpy(out, row + start, size_t(x - start));
+				out += x - start;
+				zeros = 0;
+			}
+		}
+		return size_t(out - buffer.data());
+	}
+
+	bool decodeDisparity(const uchar * in, size_t bytes, cv::Mat & map)
+	{
+		uchar * out(map.data), * outEnd(map.data + map.total());
+		const uchar * inEnd(in + bytes);
+		while (in < inEnd)
+		{
+			uint64_t zeros, count;
+			if (!getVarint(in, inEnd, zeros) || !getVarint(in, inEnd, count) || 
+				zeros > uint64_t(outEnd - out) || count > uint64_t(outEnd - out) - zeros || count > uint64_t(inEnd - in))
+			{
+				return false;
+			}
+			std::memset(out, 0, size_t(zeros));
+			out += zeros;
+			std::memcpy(out, in, size_t(count));
+			out += count;
+			in += count;
+		}
+		std::memset(out, 0, size_t(outEnd - out));
+		return true;
+	}
+}
+
+DepthRecorder::~DepthRecorder()
+{
+	close();
+}
+
+bool DepthRecorder::open(std::string const & path, cv::Mat const & depthTable, ColourCodec codec, int quality)
+{
+	CV_Assert(depthTable.type() == CV_32FC1 && depthTable.total() == 256 && depthTable.isContinuous());
+	close();
+	m_codec = codec;
+	m_jpegParams = { cv::IMWRITE_JPEG_QUALITY, quality };
+	m_offsets.clear();
+
+	// Header without index: readable as is if the recording is not closed
+	FileHeader header;
+	std::memset(&header, 0, sizeof(FileHeader));
+	MappedFile::sign(header.signature, RECORDING_MAGIC, RECORDING_VERSION);
+	header.codec = uint32_t(codec);
+	std::memcpy(header.depthTable, depthTable.ptr<float>(), sizeof(header.depthTable));
+
+	m_file.open(path, std::ios::binary | std::ios::trunc);
+	if (!m_file)
+	{
+		m_file.close();
+		return false;
+	}
+	const char padding[RECORDING_ALIGNMENT] = {};
+	m_file.write(reinterpret_cast<const char *>(&header), sizeof(FileHeader));
+	m_bytes = alignOffset(sizeof(FileHeader));
+	m_file.write(padding, std::streamsize(m_bytes - sizeof(FileHeader)));
+	return bool(m_file);
+}
+
+bool DepthRecorder::write(int64 frameId, cv::Mat const & sparseDisparityMap, cv::Mat const & colour, cv::Point origin)
+{
+	CV_Assert(sparseDisparityMap.type() == CV_8UC1 && (m_codec == COLOUR_NONE || colour.type() == CV_8UC3));
+	if (!m_file.is_open())
+		return false;
+
+	FrameHeader header;
+	std::memset(&header, 0, sizeof(FrameHeader));
+	header.magic = FRAME_MAGIC;
+	header.rows = sparseDisparityMap.rows;
+	header.cols = sparseDisparityMap.cols;
+	header.originX = origin.x;
+	header.originY = origin.y;
+	header.frameId = frameId;
+	header.disparityBytes = encodeDisparity(sparseDisparityMap, m_disparityBuffer);
+	if (m_codec != COLOUR_NONE)
+	{
+		header.colourRows = colour.rows;
+		header.colourCols = colour.cols;
+	}
+	if (m_codec == COLOUR_RAW)
+		header.colourBytes = uint64_t(colour.total() * colour.elemSize());
+	else if (m_codec == COLOUR_JPEG)
+	{
+		if (!cv::imencode(".jpg", colour, m_colourBuffer, m_jpegParams))
+			return false;
+		header.colourBytes = m_colourBuffer.size();
+	}
+
+	const char padding[RECORDING_ALIGNMENT] = {};
+	uint64_t offset(m_bytes), colourStart(colourOffset(offset, header)), next(nextOffset(offset, header));
+	m_file.write(reinterpret_cast<const char *>(&header), sizeof(FrameHeader));
+	m_file.write(reinterpret_cast<const char *>(m_disparityBuffer.data()), std::streamsize(header.disparityBytes));
+	m_file.write(padding, std::streamsize(colourStart - (offset + sizeof(FrameHeader) + header.disparityBytes)));
+	if (m_codec == COLOUR_RAW)
+	{
+		for (int y(0); y < colour.rows; y++)
+		{
+			m_file.write(colour.ptr<char>(y), std::streamsize(colour.cols * colour.elemSize()));
+		}
+	}
+	else if (m_codec == COLOUR_JPEG)
+	{
+		m_file.write(reinterpret_cast<const char *>(m_colourBuffer.data()), std::streamsize(header.colourBytes));
+	}
+	m_file.write(padding, std::streamsize(next - (colourStart + header.colourBytes)));
+	if (!m_file)
+		return false;
+
+	m_offsets.push_back(offset);
+	m_bytes = next;
+	return true;
+}
+
+bool DepthRecorder::close()
+{
+	if (!m_file.is_open())
+		return false;
+
+	// Index after the last frame, then the frame count and index offset in the header
+	uint32_t frameCount(uint32_t(m_offsets.size()));
+	uint64_t indexOffset(m_bytes);
+	m_file.write(reinterpret_cast<const char *>(m_offsets.data()), std::streamsize(m_offsets.size() * sizeof(uint64)));
+	m_bytes += m_offsets.size() * sizeof(uint64);
+	m_file.seekp(std::streamoff(offsetof(FileHeader, frameCount)));
+	m_file.write(reinterpret_cast<const char *>(&frameCount), sizeof(frameCount));
+	m_file.write(reinterpret_cast<const char *>(&indexOffset), sizeof(indexOffset));
+	bool success(m_file.flush());
+	m_file.close();
+	return success;
+}
+
+DepthRecording::~DepthRecording()
+{
+	release();
+}
+
+bool DepthRecording::open(std::string const & path)
+{
+	release();
+	if (!m_file.open(path, sizeof(FileHeader)))
+	{
+		return false;
+	}
+
+	FileHeader header;
+	std::memcpy(&header, m_file.data(), sizeof(FileHeader));
+	if (!MappedFile::check(header.signature, RECORDING_MAGIC, RECORDING_VERSION) || 
+		header.codec > uint32_t(DepthRecorder::COLOUR_JPEG))
+	{
+		release();
+		return false;
+	}
+	m_codec = DepthRecorder::ColourCodec(header.codec);
+	// The mapping is read-only
+	unsigned char * data(const_cast<unsigned char *>(m_file.data()));
+	m_depthTable = cv::Mat(1, 256, CV_32FC1, data + offsetof(FileHeader, depthTable));
+
+	if (header.indexOffset != 0 && header.indexOffset <= m_file.size() && 
+		uint64_t(header.frameCount) * sizeof(uint64) <= m_file.size() - header.indexOffset)
+	{
+		m_offsets.resize(header.frameCount);
+		std::memcpy(m_offsets.data(), data + header.indexOffset, m_offsets.size() * sizeof(uint64));
+	}
+	else
+	{
+		// Not closed: walk the frames up to the first incomplete one
+		uint64_t offset(alignOffset(sizeof(FileHeader)));
+		while (offset + sizeof(FrameHeader) <= m_file.size())
+		{
+			FrameHeader frame;
+			std::memcpy(&frame, data + offset, sizeof(FrameHeader));
+			if (frame.magic != FRAME_MAGIC || frame.disparityBytes > m_file.size() || frame.colourBytes > m_file.size() || 
+				nextOffset(offset, frame) > alignOffset(m_file.size()))
+			{
+				break;
+			}
+			m_offsets.push_back(offset);
+			offset = nextOffset(offset, frame);
+		}
+	}
+	return true;
+}
+
+bool DepthRecording::read(int index, Frame & frame) const
+{
+	CV_Assert(index >= 0 && index < getFrameCount());
+	const unsigned char * data(m_file.data());
+	const size_t mappingSize(m_file.size());
+	uint64_t offset(m_offsets[index]);
+	FrameHeader header;
+	if (offset > mappingSize || mappingSize - offset < sizeof(FrameHeader))
+		return false;
+	std::memcpy(&header, data + offset, sizeof(FrameHeader));
+	uint64_t colourStart(colourOffset(offset, header));
+	if (header.magic != FRAME_MAGIC || header.rows < 0 || header.cols < 0 || header.colourRows < 0 || header.colourCols < 0 || 
+		header.disparityBytes > mappingSize || header.colourBytes > mappingSize || 
+		colourStart + header.colourBytes > mappingSize)
+	{
+		return false;
+	}
+
+	frame.frameId = header.frameId;
+	frame.origin = cv::Point(header.originX, header.originY);
+	if (!frame.sparseDisparityMap.isContinuous())
+		frame.sparseDisparityMap.release();
+	frame.sparseDisparityMap.create(header.rows, header.cols, CV_8UC1);
+	if (!decodeDisparity(data + offset + sizeof(FrameHeader), size_t(header.disparityBytes), frame.sparseDisparityMap))
+		return false;
+
+	if (m_codec == DepthRecorder::COLOUR_RAW)
+	{
+		if (header.colourBytes != uint64_t(header.colourRows) * header.colourCols * 3)
+			return false;
+		// The mapping is read-only
+		frame.colour = cv::Mat(header.colourRows, header.colourCols, CV_8UC3, const_cast<unsigned char *>(data + colourStart));
+	}
+	else if (m_codec == DepthRecorder::COLOUR_JPEG)
+	{
+		// Decoded into the existing buffer, unless it is a view on a mapping
+		cv::Mat encoded(1, int(header.colourBytes), CV_8UC1, const_cast<unsigned char *>(data + colourStart));
+		if (frame.colour.u == nullptr)
+			frame.colour.release();
+		cv::imdecode(encoded, cv::IMREAD_COLOR, &frame.colour);
+		if (frame.colour.size() != cv::Size(header.colourCols, header.colourRows))
+			return false;
+	}
+	else
+		frame.colour.release();
+	return true;
+}
+
+void DepthRecording::release()
+{
+	m_offsets.clear();
+	m_depthTable.release();
+	m_file.release();
+}
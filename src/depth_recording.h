@@ -0,0 +1,193 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#ifndef DEPTHRECORDING_H
+#define DEPTHRECORDING_H
+
+#include <opencv2/core/core.hpp>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+/* @class DepthRecorder
+@brief Streaming recording of the output of DepthEstimator: the sparse disparity maps with the restored colour images. 
+The disparity map is run-length encoded: runs of unreliable pixels (0) are stored as their length 
+and runs of valid pixels as their values, so that its size follows the number of valid pixels. 
+The depth table of the estimator is stored once in the header, a reader gets the depth of each value from it. 
+The colour is stored raw, or JPEG encoded. Frames are appended one by one, each aligned to 64 bytes 
+with a header giving its sizes, and an index of the frames is written by close() for random access. 
+The file is written in the native byte order, see DepthRecording to read it.
+*/
+class DepthRecorder
+{
+public:
+	/* Storage of the colour images */
+	enum ColourCodec
+	{
+		COLOUR_NONE, // No colour
+		COLOUR_RAW, // Raw CV_8UC3 rows, replayed without copy
+		COLOUR_JPEG // cv::imencode JPEG
+	};
+
+	DepthRecorder() {}
+
+	~DepthRecorder();
+
+	// Not copyable, owns the file
+	DepthRecorder(DepthRecorder const &) = delete;
+	DepthRecorder & operator=(DepthRecorder const &) = delete;
+
+	/* @brief Create a recording
+	@param path recording file, overwritten
+	@param depthTable depth in mm of each value of the sparse disparity map (1x256 CV_32FC1, see DepthEstimator::getDepthTable)
+	@param codec storage of the colour images
+	@param quality JPEG quality with COLOUR_JPEG
+	@return true on success
+	*/
+	bool open(std::string const & path, cv::Mat const & depthTable, ColourCodec codec = COLOUR_JPEG, int quality = 95);
+
+	/* @brief Append a frame. No allocation once the buffers fit the frames
+	@param frameId identifier of the frame, e.g. DepthPipeline::Result::frameId
+	@param sparseDisparityMap sparse disparity map of the frame (CV_8UC1)
+	@param colour restored image (CV_8UC3), ignored with COLOUR_NONE
+	@param origin position of the disparity map in the full map, for a region of interest
+	@return true on success
+	*/
+	bool write(int64 frameId, cv::Mat const & sparseDisparityMap, cv::Mat const & colour, cv::Point origin = cv::Point());
+
+	/* @brief Write the frame index and close the file. A recording that was not closed is still readable, 
+	without its last incomplete frame
+	@return true on success
+	*/
+	bool close();
+
+	inline bool isOpen() const;
+	inline int getFrameCount() const;
+	inline uint64 getBytes() const;
+
+private:
+	std::ofstream m_file;
+	ColourCodec m_codec = COLOUR_NONE;
+	std::vector<int> m_jpegParams;
+	std::vector<uint64> m_offsets; // Offset of each frame in the file
+	std::vector<int64> m_frameIds;
+	uint64 m_bytes = 0; // Written so far
+	std::vector<uchar> m_disparityBuffer, m_colourBuffer; // Encoded frame, reused from one frame to the next
+};
+
+/* @class DepthRecording
+@brief Memory-mapped recording written by DepthRecorder, for replay. 
+Frames are decoded from the mapping in any order: the raw colour images are views on the mapping, without copy. 
+Reading frames is const, several threads can replay the same recording into their own Frames
+*/
+class DepthRecording
+{
+public:
+	/* Decoded frame */
+	struct Frame
+	{
+		int64 frameId = -1;
+		cv::Point origin; // Position of the disparity map in the full map
+		cv::Mat sparseDisparityMap; // CV_8UC1, decoded into the existing buffer when it fits
+		cv::Mat colour; // CV_8UC3, read-only view on the mapping with COLOUR_RAW, empty with COLOUR_NONE
+	};
+
+	DepthRecording() {}
+
+	~DepthRecording();
+
+	// Not copyable, owns the mapping
+	DepthRecording(DepthRecording const &) = delete;
+	DepthRecording & operator=(DepthRecording const &) = delete;
+
+	/* @brief Memory-map a recording. Without index (recording not closed), the frames are found by walking their headers
+	@param path recording file
+	@return true if the file is a recording of this version
+	*/
+	bool open(std::string const & path);
+
+	/* @brief Unmap the recording */
+	void release();
+
+	/* @brief Decode a frame
+	@param index frame index in recording order, in [0, getFrameCount())
+	@param frame decoded frame
+	@return false if the frame is corrupted
+	*/
+	bool read(int index, Frame & frame) const;
+
+	inline int getFrameCount() const;
+	inline DepthRecorder::ColourCodec getColourCodec() const;
+	/* Depth in mm of each value of the sparse disparity maps (1x256 CV_32FC1), for cv::LUT */
+	inline cv::Mat const & getDepthTable() const;
+
+private:
+	std::vector<uint64> m_offsets; // Offset of each frame in the mapping
+	DepthRecorder::ColourCodec m_codec = DepthRecorder::COLOUR_NONE;
+	cv::Mat m_depthTable;
+
+	MappedFile m_file;
+};
+
+inline bool DepthRecorder::isOpen() const
+{
+	return m_file.is_open();
+}
+
+inline int DepthRecorder::getFrameCount() const
+{
+	return int(m_offsets.size());
+}
+
+inline uint64 DepthRecorder::getBytes() const
+{
+	return m_bytes;
+}
+
+inline int DepthRecording::getFrameCount() const
+{
+	return int(m_offsets.size());
+}
+
+inline DepthRecorder::ColourCodec DepthRecording::getColourCodec() const
+{
+	return m_codec;
+}
+
+inline cv::Mat const & DepthRecording::getDepthTable() const
+{
+	return m_depthTable;
+}
+#endif // DEPTHRECORDING_H
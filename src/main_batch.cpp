@@ -0,0 +1,358 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include "depth_estimator.h"
+#include "depth_pipeline.h"
+#include "depth_recording.h"
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core/utils/filesystem.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+/* Frames read one by one from an image directory, a video file or a raw BGR stream */
+class FrameSource
+{
+public:
+	/* @brief Open the input
+	@param input image directory, video file, or raw stream file ("-" for the standard input)
+	@param rawSize frame size of a raw stream, empty for images and videos
+	*/
+	FrameSource(std::string const & input, cv::Size rawSize) :
+		m_rawSize(rawSize)
+	{
+		if (!rawSize.empty())
+		{
+			if (input != "-")
+			{
+				m_rawFile.open(input, std::ios::binary);
+				CV_Assert(m_rawFile.is_open());
+			}
+			m_raw = input == "-" ? &std::cin : &m_rawFile;
+		}
+		else
+		{
+			// A directory is read as a sorted list of images, anything else as a video
+			cv::glob(input + "/*", m_files, false);
+			m_files.erase(std::remove_if(m_files.begin(), m_files.end(), [](cv::String const & file) 
+				{ return !cv::haveImageReader(file); }), m_files.end());
+			if (m_files.empty())
+			{
+				m_video.open(input);
+				CV_Assert(m_video.isOpened());
+			}
+		}
+	}
+
+	/* @brief Read the next frame
+	@param frame next frame (CV_8UC3)
+	@param name name of the frame for the output files
+	@return false at the end of the input
+	*/
+	bool read(cv::Mat & frame, std::string & name)
+	{
+		char index[16];
+		std::snprintf(index, sizeof(index), "%06d", m_index);
+		name = index;
+
+		if (m_raw)
+		{
+			frame.create(m_rawSize, CV_8UC3);
+			m_raw->read(reinterpret_cast<char *>(frame.data), frame.total() * frame.elemSize());
+			if (m_raw->gcount() != std::streamsize(frame.total() * frame.elemSize()))
+				return false;
+		}
+		else if (!m_files.empty())
+		{
+			if (m_index >= int(m_files.size()))
+				return false;
+			frame = cv::imread(m_files[m_index], cv::IMREAD_COLOR);
+			std::string file(m_files[m_index]);
+			size_t begin(file.find_last_of("/\\") + 1), end(file.find_last_of('.'));
+			name = file.substr(begin, end == std::string::npos || end < begin ? std::string::npos : end - begin);
+		}
+		else if (!m_video.read(frame))
+		{
+			return false;
+		}
+		m_index++;
+		return !frame.empty();
+	}
+
+private:
+	cv::Size m_rawSize;
+	std::ifstream m_rawFile;
+	std::istream * m_raw = nullptr;
+	std::vector<cv::String> m_files;
+	cv::VideoCapture m_video;
+	int m_index = 0;
+};
+
+/* Read a two-channel rectification table from its two exr files */
+cv::UMat readTable(std::string const & file1, std::string const & file2)
+{
+	std::vector<cv::UMat> handle(2);
+	cv::UMat table;
+	handle[0] = cv::imread(file1, cv::IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
+	handle[1] = cv::imread(file2, cv::IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
+	CV_Assert(!handle[0].empty() && !handle[1].empty());
+	cv::merge(handle, table);
+	return table;
+}
+
+/* Memory-map the binary rectification tables of precompute_rectification,
+or convert the exr tables if there is no cache for these parameters */
+std::shared_ptr<RectificationCache> loadTables(std::string const & directory, float upsampling, double scaleMask)
+{
+	std::shared_ptr<RectificationCache> tables(std::make_shared<RectificationCache>());
+	if (!tables->open(RectificationCache::fileName(directory + "/rectification", upsampling, scaleMask), 
+		upsampling, scaleMask))
+	{
+		std::cerr << "No binary rectification tables for these parameters, converting the exr tables" << std::endl;
+		tables->build(readTable(directory + "/tform_ind1.exr", directory + "/tform_ind2.exr"),
+			readTable(directory + "/inv_ind1.exr", directory + "/inv_ind2.exr"), upsampling, scaleMask);
+	}
+	return tables;
+}
+
+/* Value of a sorted list at a percentile */
+double percentile(std::vector<double> const & sorted, double p)
+{
+	return sorted[std::min(sorted.size() - 1, size_t(p / 100. * double(sorted.size())))];
+}
+
+void printUsage()
+{
+	std::cout << "uneven_rgbd_batch --input <directory|video|raw stream> [options]\n"
+		<< "  --raw <width>x<height>  input is a raw BGR stream, \"-\" for the standard input\n"
+		<< "  --output <directory>    output directory (default: output)\n"
+		<< "  --depth-format png|exr  16-bit depth in mm or float depth (default: png)\n"
+		<< "  --record <file>         write a recording of the sparse disparity and colour instead of images\n"
+		<< "  --record-colour raw|jpeg|none  colour of the recording (default: jpeg)\n"
+		<< "  --no-output             only measure throughput\n"
+		<< "  --tables <directory>    directory of the rectification tables (default: resources)\n"
+		<< "  --min-depth <mm>        lowest depth candidate (default: 450)\n"
+		<< "  --max-depth <mm>        largest depth candidate (default: 800)\n"
+		<< "  --baseline <px.mm>      f * baseline (default: -8013)\n"
+		<< "  --tau <tau>             intensity proportion between e-ray and o-ray (default: 0.286)\n"
+		<< "  --upsampling <factor>   upsampling (default: 1)\n"
+		<< "  --in-flight <frames>    frames processed concurrently (default: 3)\n"
+		<< "  --temporal <window>     CPU sweep reusing the previous frame, <window> candidates around its labels\n"
+		<< "  --trace <file>          instrument the stages, print their statistics and write a Chrome trace" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	std::string input, output("output"), tables("resources"), depthFormat("png"), trace, record, recordColour("jpeg");
+	cv::Size rawSize;
+	float minDepth(450.f), maxDepth(800.f), baseline(-8013.f), tau(0.286f), upsampling(1.f);
+	int maxInFlight(3), temporalWindow(0);
+	bool writeOutput(true);
+
+	for (int i(1); i < argc; i++)
+	{
+		std::string arg(argv[i]);
+		if (arg == "--no-output")
+		{
+			writeOutput = false;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			printUsage();
+			return 1;
+		}
+		std::string value(argv[++i]);
+		if (arg == "--input")
+			input = value;
+		else if (arg == "--raw")
+			CV_Assert(std::sscanf(value.c_str(), "%dx%d", &rawSize.width, &rawSize.height) == 2);
+		else if (arg == "--output")
+			output = value;
+		else if (arg == "--depth-format")
+			depthFormat = value;
+		else if (arg == "--tables")
+			tables = value;
+		else if (arg == "--min-depth")
+			minDepth = std::stof(value);
+		else if (arg == "--max-depth")
+			maxDepth = std::stof(value);
+		else if (arg == "--baseline")
+			baseline = std::stof(value);
+		else if (arg == "--tau")
+			tau = std::stof(value);
+		else if (arg == "--upsampling")
+			upsampling = std::stof(value);
+		else if (arg == "--in-flight")
+			maxInFlight = std::stoi(value);
+		else if (arg == "--temporal")
+			temporalWindow = std::stoi(value);
+		else if (arg == "--trace")
+			trace = value;
+		else if (arg == "--record")
+			record = value;
+		else if (arg == "--record-colour")
+			recordColour = value;
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+	if (input.empty() || (depthFormat != "png" && depthFormat != "exr") || 
+		(recordColour != "raw" && recordColour != "jpeg" && recordColour != "none"))
+	{
+		printUsage();
+		return 1;
+	}
+
+	// Initialise and set parameters
+	DepthEstimator depthEstimator(loadTables(tables, upsampling, 0.3), minDepth, maxDepth, baseline, tau);
+	depthEstimator.setProfiling(!trace.empty());
+	if (temporalWindow > 0)
+	{
+		depthEstimator.setSweepEngine(DepthEstimator::SWEEP_CPU_FUSED);
+		depthEstimator.setTemporalSearch(temporalWindow);
+	}
+	FrameSource source(input, rawSize);
+	DepthRecorder recorder;
+	if (writeOutput && !record.empty())
+	{
+		DepthRecorder::ColourCodec codec(recordColour == "raw" ? DepthRecorder::COLOUR_RAW 
+			: recordColour == "none" ? DepthRecorder::COLOUR_NONE : DepthRecorder::COLOUR_JPEG);
+		if (!recorder.open(record, depthEstimator.getDepthTable(), codec))
+		{
+			std::cout << "Failed creating " << record << std::endl;
+			return 1;
+		}
+	}
+	else if (writeOutput)
+		cv::utils::fs::createDirectories(output);
+
+	// Written by the callbacks on the pipeline thread
+	std::mutex mutex;
+	std::vector<int64> submitTicks;
+	std::vector<std::string> names;
+	std::vector<double> latencies;
+	double recordMs(0.);
+
+	int64 start(cv::getTickCount());
+	{
+		DepthPipeline pipeline(depthEstimator, maxInFlight);
+		cv::Mat frame;
+		std::string name;
+		while (source.read(frame, name))
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				submitTicks.push_back(cv::getTickCount());
+				names.push_back(name);
+			}
+			pipeline.submit(frame.getUMat(cv::ACCESS_READ), [&](DepthPipeline::Result & result)
+			{
+				std::string frameName;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					frameName = names[size_t(result.frameId)];
+				}
+				if (recorder.isOpen())
+				{
+					// Encoded on the pipeline thread
+					int64 recordStart(cv::getTickCount());
+					if (!recorder.write(result.frameId, result.sparseDisparityMap.getMat(cv::ACCESS_READ), 
+						result.reconsImg.getMat(cv::ACCESS_READ)))
+						std::cout << "Failed recording frame " << frameName << std::endl;
+					recordMs += 1000. * double(cv::getTickCount() - recordStart) / cv::getTickFrequency();
+				}
+				else if (writeOutput)
+				{
+					cv::Mat depth;
+					if (depthFormat == "png")
+						result.depth.convertTo(depth, CV_16U);
+					else
+						depth = result.depth.getMat(cv::ACCESS_READ).clone();
+					cv::imwrite(output + "/" + frameName + "_depth." + depthFormat, depth);
+					cv::imwrite(output + "/" + frameName + "_colour.png", result.reconsImg);
+				}
+
+				std::lock_guard<std::mutex> lock(mutex);
+				latencies.push_back(1000. * double(cv::getTickCount() - submitTicks[size_t(result.frameId)]) 
+					/ cv::getTickFrequency());
+			});
+		}
+	}
+	double totalMs(1000. * double(cv::getTickCount() - start) / cv::getTickFrequency());
+	if (recorder.isOpen())
+	{
+		int frameCount(recorder.getFrameCount());
+		if (!recorder.close())
+			std::cout << "Failed writing the index of " << record << std::endl;
+		std::cout << std::fixed << std::setprecision(2) << "Recording: " << recorder.getBytes() / 1e6 << " MB, " 
+			<< recordMs / std::max(1, frameCount) << " ms per frame" << std::endl;
+	}
+
+	if (latencies.empty())
+	{
+		std::cout << "No frame processed" << std::endl;
+		return 1;
+	}
+	std::sort(latencies.begin(), latencies.end());
+	std::cout << std::fixed << std::setprecision(2) 
+		<< latencies.size() << " frames in " << totalMs / 1000. << " s: " 
+		<< 1000. * double(latencies.size()) / totalMs << " fps" << std::endl
+		<< "Latency (ms): p50 " << percentile(latencies, 50.) << ", p90 " << percentile(latencies, 90.) 
+		<< ", p99 " << percentile(latencies, 99.) << ", max " << latencies.back() << std::endl;
+
+	if (!trace.empty())
+	{
+		StageProfiler & profiler(depthEstimator.getProfiler());
+		for (int stage(0); stage < DepthEstimator::STAGE_COUNT; stage++)
+		{
+			std::string name(DepthEstimator::getStageName(DepthEstimator::Stage(stage)));
+			StageProfiler::Stats stats(profiler.getStats(name));
+			std::cout << std::setw(8) << name << " (ms): p50 " << stats.p50 << ", p90 " << stats.p90 
+				<< ", p99 " << stats.p99 << ", max " << stats.max 
+				<< ", " << profiler.getStats(name + "_bytes").mean / 1e6 << " MB" << std::endl;
+		}
+		std::cout << "Valid pixels: " << profiler.getStats("valid_pixels").mean << " on average" << std::endl;
+		if (!profiler.writeTrace(trace))
+			std::cout << "Failed writing " << trace << std::endl;
+	}
+
+	return 0;
+}
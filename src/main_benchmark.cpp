@@ -0,0 +1,1272 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include "cost_sweep.h"
+#include "depth_estimator.h"
+#include "depth_pipeline.h"
+#include "depth_recording.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#define MIN_DEPTH 450.f
+#define MAX_DEPTH 800.f
+#define BASELINE -8013.f
+#define TAU 0.286f
+
+/* Median time in ms of the fused candidate sweep over repeat runs */
+double timeSweep(CostSweep & sweep, cv::Mat const & imgRectified, int repeat)
+{
+	cv::Mat fullDisparityMap, minCost, maxCost, reconsImgRectified;
+	std::vector<double> times(repeat);
+
+	// Warm up: buffer allocation and thread pool creation
+	sweep.run(imgRectified, fullDisparityMap, minCost, maxCost, reconsImgRectified);
+	for (int i(0); i < repeat; i++)
+	{
+		int64 start(cv::getTickCount());
+		sweep.run(imgRectified, fullDisparityMap, minCost, maxCost, reconsImgRectified);
+		times[i] = 1000. * double(cv::getTickCount() - start) / cv::getTickFrequency();
+	}
+	std::sort(times.begin(), times.end());
+	return times[repeat / 2];
+}
+
+/* Thread scaling of the row-band candidate sweep on a synthetic image */
+int runScaling(cv::Size size, float upsampling, int winSize, int maxThreads, int repeat)
+{
+	cv::Mat imgRectified(cv::Size(int(size.width * upsampling), int(size.height * upsampling)), CV_8UC3);
+	cv::randu(imgRectified, cv::Scalar::all(0), cv::Scalar::all(256));
+
+	int win(int(upsampling * winSize) + 1 - (int(upsampling * winSize) % 2));
+	std::vector<float> disparities(DepthEstimator::depthCandidates(MIN_DEPTH, MAX_DEPTH, upsampling * BASELINE));
+	CostSweep sweep(disparities, TAU, win);
+
+	std::cout << "Sweep of " << disparities.size() << " candidates on " << imgRectified.cols << "x" << imgRectified.rows
+		<< ", window " << win << ", " << cv::getNumberOfCPUs() << " CPUs" << std::endl;
+	std::cout << std::setw(8) << "threads" << std::setw(12) << "ms" 
+		<< std::setw(10) << "speedup" << std::setw(12) << "efficiency" << std::endl;
+
+	double reference(0.);
+	for (int threads(1); threads <= maxThreads; threads *= 2)
+	{
+		cv::setNumThreads(threads);
+		sweep.setBandCount(threads);
+		double ms(timeSweep(sweep, imgRectified, repeat));
+		if (threads == 1)
+			reference = ms;
+		std::cout << std::setw(8) << threads << std::setw(12) << std::fixed << std::setprecision(2) << ms
+			<< std::setw(10) << reference / ms << std::setw(12) << reference / (ms * threads) << std::endl;
+	}
+	return 0;
+}
+
+/* Synthetic rectified capture: smooth texture plus its tau-weighted copy, 
+translated by a disparity that changes every few columns and rows. 
+trueLabels receives the candidate index + 1 of each pixel, as the disparity maps (CV_8UC1) */
+cv::Mat syntheticCapture(cv::Size size, std::vector<float> const & disparities, float tau, cv::Mat * trueLabels = nullptr)
+{
+	cv::Mat texture(size, CV_8UC3), captured(size, CV_8UC3);
+	cv::randu(texture, cv::Scalar::all(0), cv::Scalar::all(256));
+	cv::GaussianBlur(texture, texture, cv::Size(5, 5), 1.);
+
+	// Candidate index of each patch
+	const int patch(std::max(32, size.width / 8));
+	cv::Mat patchLabels((size.height + patch - 1) / patch, (size.width + patch - 1) / patch, CV_32SC1);
+	cv::randu(patchLabels, cv::Scalar::all(0), cv::Scalar::all(double(disparities.size())));
+	if (trueLabels)
+		trueLabels->create(size, CV_8UC1);
+	for (int y(0); y < size.height; y++)
+	{
+		const cv::Vec3b * src(texture.ptr<cv::Vec3b>(y));
+		cv::Vec3b * dst(captured.ptr<cv::Vec3b>(y));
+		for (int x(0); x < size.width; x++)
+		{
+			int label(patchLabels.at<int>(y / patch, x / patch));
+			if (trueLabels)
+				trueLabels->at<uchar>(y, x) = uchar(label + 1);
+			int d(CostSweep::translation(disparities[label]));
+			int xShifted(std::min(size.width - 1, std::max(0, x - d)));
+			for (int c(0); c < 3; c++)
+			{
+				dst[x][c] = cv::saturate_cast<uchar>(src[x][c] + tau * src[xShifted][c]);
+			}
+		}
+	}
+	return captured;
+}
+
+/* Exhaustive sweep against the coarse-to-fine search on a synthetic capture */
+int runHierarchical(cv::Size size, float upsampling, int winSize, std::vector<std::string> const & strides, 
+	int tileSize, int repeat)
+{
+	int win(int(upsampling * winSize) + 1 - (int(upsampling * winSize) % 2));
+	std::vector<float> disparities(DepthEstimator::depthCandidates(MIN_DEPTH, MAX_DEPTH, upsampling * BASELINE));
+	cv::Mat imgRectified(syntheticCapture(cv::Size(int(size.width * upsampling), int(size.height * upsampling)), 
+		disparities, TAU));
+
+	CostSweep sweep(disparities, TAU, win);
+	cv::Mat reference, minCost, maxCost, reconsImgRectified;
+	sweep.run(imgRectified, reference, minCost, maxCost, reconsImgRectified);
+	double exhaustiveMs(timeSweep(sweep, imgRectified, repeat));
+
+	std::cout << "Search over " << disparities.size() << " candidates on " << imgRectified.cols << "x" 
+		<< imgRectified.rows << ", window " << win << ", tiles " << tileSize << std::endl;
+	std::cout << std::setw(8) << "stride" << std::setw(12) << "ms" << std::setw(10) << "speedup" 
+		<< std::setw(12) << "evaluated" << std::setw(10) << "exact" << std::setw(10) << "near" 
+		<< std::setw(12) << "mean error" << std::endl;
+	std::cout << std::setw(8) << 1 << std::setw(12) << std::fixed << std::setprecision(2) << exhaustiveMs
+		<< std::setw(10) << 1. << std::setw(12) << 1. << std::setw(10) << 1. << std::setw(10) << 1. 
+		<< std::setw(12) << 0. << std::endl;
+
+	for (size_t i(0); i < strides.size(); i++)
+	{
+		int stride(std::max(1, std::stoi(strides[i])));
+		sweep.setHierarchicalSearch(stride, tileSize);
+		double ms(timeSweep(sweep, imgRectified, repeat));
+		cv::Mat labels;
+		sweep.run(imgRectified, labels, minCost, maxCost, reconsImgRectified);
+		CostSweep::SearchReport report(CostSweep::compareLabels(reference, labels));
+		std::cout << std::setw(8) << stride << std::setw(12) << ms << std::setw(10) << exhaustiveMs / ms 
+			<< std::setw(12) << sweep.getEvaluatedShare() << std::setw(10) << report.exactShare 
+			<< std::setw(10) << report.nearShare << std::setw(12) << report.meanError << std::endl;
+	}
+	return 0;
+}
+
+/* Exhaustive sweep against the temporal search on a static synthetic capture with a moving square */
+int runTemporal(cv::Size size, float upsampling, int winSize, int window, int tileSize, int frameCount)
+{
+	int win(int(upsampling * winSize) + 1 - (int(upsampling * winSize) % 2));
+	std::vector<float> disparities(DepthEstimator::depthCandidates(MIN_DEPTH, MAX_DEPTH, upsampling * BASELINE));
+	cv::Mat background(syntheticCapture(cv::Size(int(size.width * upsampling), int(size.height * upsampling)), 
+		disparities, TAU));
+	cv::Mat object(syntheticCapture(cv::Size(background.rows / 4, background.rows / 4), disparities, TAU));
+
+	CostSweep exhaustive(disparities, TAU, win), temporal(disparities, TAU, win);
+	temporal.setTemporalSearch(window, tileSize);
+	cv::Mat imgRectified, reference, labels, minCost, maxCost, reconsImgRectified;
+	double exhaustiveMs(0.), temporalMs(0.), evaluated(0.), exact(0.), near(0.);
+
+	for (int i(0); i < frameCount; i++)
+	{
+		background.copyTo(imgRectified);
+		object.copyTo(imgRectified(cv::Rect((i * 8) % (background.cols - object.cols), background.rows / 2, 
+			object.cols, object.rows)));
+
+		int64 start(cv::getTickCount());
+		exhaustive.run(imgRectified, reference, minCost, maxCost, reconsImgRectified);
+		exhaustiveMs += 1000. * double(cv::getTickCount() - start) / cv::getTickFrequency();
+		start = cv::getTickCount();
+		temporal.run(imgRectified, labels, minCost, maxCost, reconsImgRectified);
+		temporalMs += 1000. * double(cv::getTickCount() - start) / cv::getTickFrequency();
+
+		CostSweep::SearchReport report(CostSweep::compareLabels(reference, labels));
+		evaluated += temporal.getEvaluatedShare();
+		exact += report.exactShare;
+		near += report.nearShare;
+	}
+
+	std::cout << frameCount << " frames of " << background.cols << "x" << background.rows << ", " 
+		<< disparities.size() << " candidates, window " << window << ", tiles " << tileSize << std::endl;
+	std::cout << std::fixed << std::setprecision(2) << "exhaustive " << 1000. * frameCount / exhaustiveMs << " fps, temporal " 
+		<< 1000. * frameCount / temporalMs << " fps, evaluated " << evaluated / frameCount 
+		<< ", exact " << exact / frameCount << ", near " << near / frameCount << std::endl;
+	return 0;
+}
+
+/* Rectification table mapping every pixel to itself */
+cv::UMat identityTable(cv::Size size)
+{
+	cv::Mat table(size, CV_32FC2);
+	for (int y(0); y < size.height; y++)
+	{
+		for (int x(0); x < size.width; x++)
+		{
+			table.at<cv::Vec2f>(y, x) = cv::Vec2f(float(x), float(y));
+		}
+	}
+	return table.getUMat(cv::ACCESS_READ).clone();
+}
+
+/* Frame rate of DepthEstimator::setFrame against DepthPipeline on synthetic frames */
+int runPipeline(cv::Size size, float upsampling, int winSize, int frameCount, int maxInFlight)
+{
+	cv::UMat table(identityTable(size));
+	DepthEstimator depthEstimator(table, table, MIN_DEPTH, MAX_DEPTH, BASELINE, TAU, upsampling, 0.3, winSize);
+
+	std::vector<cv::UMat> frames(4);
+	for (size_t i(0); i < frames.size(); i++)
+	{
+		frames[i].create(size, CV_8UC3);
+		cv::randu(frames[i], cv::Scalar::all(0), cv::Scalar::all(256));
+	}
+
+	std::cout << frameCount << " frames of " << size.width << "x" << size.height 
+		<< ", upsampling " << upsampling << std::endl;
+
+	// Warm up: buffer allocation, kernel compilation and thread pool creation
+	depthEstimator.setFrame(frames[0]);
+	int64 start(cv::getTickCount());
+	for (int i(0); i < frameCount; i++)
+	{
+		depthEstimator.setFrame(frames[i % frames.size()]);
+		depthEstimator.getDepth();
+	}
+	double syncMs(1000. * double(cv::getTickCount() - start) / cv::getTickFrequency());
+	std::cout << std::setw(12) << "setFrame" << std::setw(10) << std::fixed << std::setprecision(2)
+		<< 1000. * frameCount / syncMs << " fps" << std::endl;
+
+	DepthPipeline pipeline(depthEstimator, maxInFlight);
+	pipeline.submit(frames[0]).get();
+	start = cv::getTickCount();
+	for (int i(0); i < frameCount; i++)
+	{
+		pipeline.submit(frames[i % frames.size()], [](DepthPipeline::Result &) {});
+	}
+	pipeline.flush();
+	double pipelineMs(1000. * double(cv::getTickCount() - start) / cv::getTickFrequency());
+	std::cout << std::setw(12) << "pipeline" << std::setw(10) << 1000. * frameCount / pipelineMs << " fps, " 
+		<< maxInFlight << " frames in flight" << std::endl;
+	return 0;
+}
+
+/* Parameters of a stage benchmark */
+struct StageConfig
+{
+	cv::Size size;
+	float upsampling;
+	int winSize;
+	double scaleMask;
+	float minDepth, maxDepth;
+	DepthEstimator::SweepEngine sweepEngine;
+	DepthEstimator::FilterEngine filterEngine;
+};
+
+/* Split a comma-separated list */
+std::vector<std::string> splitList(std::string const & list)
+{
+	std::vector<std::string> items;
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ','))
+	{
+		if (!item.empty())
+			items.push_back(item);
+	}
+	return items;
+}
+
+/* Median of a list of times */
+double median(std::vector<double> times)
+{
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+/* Time in ms since start, after the OpenCL queue is done */
+double elapsedMs(int64 start)
+{
+	cv::ocl::finish();
+	return 1000. * double(cv::getTickCount() - start) / cv::getTickFrequency();
+}
+
+/* Median time of each stage on random frames, written as a JSON object. 
+Returns false if the configuration cannot run */
+bool timeStages(StageConfig const & config, int repeat, std::ostream & json)
+{
+	cv::UMat table(identityTable(config.size));
+	DepthEstimator depthEstimator(table, table, config.minDepth, config.maxDepth, BASELINE, TAU, 
+		config.upsampling, config.scaleMask, config.winSize);
+	// The OpenCL programs may be compiled for a CPU device, where the CPU engines are the defaults
+	std::shared_ptr<const DepthCalibration> const & calibration(depthEstimator.getCalibration());
+	if ((config.filterEngine == DepthEstimator::FILTER_OPENCL && !calibration->hasOpenCLFilter()) 
+		|| (config.sweepEngine == DepthEstimator::SWEEP_OPENCL && !calibration->hasOpenCLSweep()))
+		return false;
+	depthEstimator.setSweepEngine(config.sweepEngine);
+	depthEstimator.setFilterEngine(config.filterEngine);
+
+	std::vector<float> disparities(DepthEstimator::depthCandidates(config.minDepth, config.maxDepth, 
+		config.upsampling * BASELINE));
+	DepthEstimator::FrameBuffers frame;
+	depthEstimator.initFrame(frame);
+	cv::UMat translatedImg, reconsImgCandidate;
+
+	// One more run to warm up
+	std::vector<std::vector<double> > times(DepthEstimator::STAGE_COUNT + 2, std::vector<double>(repeat));
+	for (int r(-1); r < repeat; r++)
+	{
+		cv::randu(frame.img, cv::Scalar::all(0), cv::Scalar::all(256));
+		int64 frameStart(cv::getTickCount());
+		for (int stage(0); stage < DepthEstimator::STAGE_COUNT; stage++)
+		{
+			int64 start(cv::getTickCount());
+			depthEstimator.runStage(DepthEstimator::Stage(stage), frame);
+			double ms(elapsedMs(start));
+			if (r >= 0)
+				times[stage][r] = ms;
+		}
+		double frameMs(elapsedMs(frameStart));
+
+		// restoreImage alone, for all candidates
+		int64 start(cv::getTickCount());
+		translatedImg.create(frame.imgRectified.size(), CV_8UC3);
+		for (size_t zInd(0); zInd < disparities.size(); zInd++)
+		{
+			DepthEstimator::restoreImage(disparities[zInd], TAU, frame.imgRectified, translatedImg, reconsImgCandidate);
+		}
+		double restoreMs(elapsedMs(start));
+		if (r >= 0)
+		{
+			times[DepthEstimator::STAGE_COUNT][r] = restoreMs;
+			times[DepthEstimator::STAGE_COUNT + 1][r] = frameMs;
+		}
+	}
+
+	const char * sweepNames[] = { "opencv", "cpu_fused", "opencl" }, * filterNames[] = { "none", "opencl", "cpu" };
+	json << "{\"width\": " << config.size.width << ", \"height\": " << config.size.height
+		<< ", \"upsampling\": " << config.upsampling << ", \"win_size\": " << config.winSize
+		<< ", \"scale_mask\": " << config.scaleMask << ", \"min_depth\": " << config.minDepth 
+		<< ", \"max_depth\": " << config.maxDepth << ", \"candidates\": " << disparities.size()
+		<< ", \"sweep_engine\": \"" << sweepNames[config.sweepEngine] 
+		<< "\", \"filter_engine\": \"" << filterNames[config.filterEngine] << "\", \"ms\": {";
+	for (int stage(0); stage < DepthEstimator::STAGE_COUNT; stage++)
+	{
+		json << "\"" << DepthEstimator::getStageName(DepthEstimator::Stage(stage)) << "\": " << median(times[stage]) << ", ";
+	}
+	json << "\"restore_image\": " << median(times[DepthEstimator::STAGE_COUNT])
+		<< ", \"frame\": " << median(times[DepthEstimator::STAGE_COUNT + 1]) << "}}";
+	return true;
+}
+
+/* Per-stage times over the cartesian product of the parameter lists, as JSON */
+int runStages(std::map<std::string, std::string> const & lists, int repeat, std::string const & jsonFile)
+{
+	// Cartesian product of the lists, the last one varying fastest
+	const char * keys[] = { "sizes", "upsamplings", "win-sizes", "scale-masks", 
+		"depth-ranges", "sweep-engines", "filter-engines" };
+	std::vector<std::vector<std::string> > values;
+	size_t configCount(1);
+	for (const char * key : keys)
+	{
+		values.push_back(splitList(lists.at(key)));
+		configCount *= values.back().size();
+	}
+
+	std::vector<StageConfig> configs(configCount);
+	for (size_t c(0); c < configCount; c++)
+	{
+		std::vector<std::string> value(values.size());
+		size_t rest(c);
+		for (size_t k(values.size()); k-- > 0;)
+		{
+			value[k] = values[k][rest % values[k].size()];
+			rest /= values[k].size();
+		}
+
+		StageConfig & config(configs[c]);
+		CV_Assert(std::sscanf(value[0].c_str(), "%dx%d", &config.size.width, &config.size.height) == 2);
+		config.upsampling = std::stof(value[1]);
+		config.winSize = std::stoi(value[2]);
+		config.scaleMask = std::stod(value[3]);
+		CV_Assert(std::sscanf(value[4].c_str(), "%f:%f", &config.minDepth, &config.maxDepth) == 2);
+		config.sweepEngine = value[5] == "opencv" ? DepthEstimator::SWEEP_OPENCV 
+			: value[5] == "opencl" ? DepthEstimator::SWEEP_OPENCL : DepthEstimator::SWEEP_CPU_FUSED;
+		config.filterEngine = value[6] == "opencl" ? DepthEstimator::FILTER_OPENCL 
+			: value[6] == "cpu" ? DepthEstimator::FILTER_CPU : DepthEstimator::FILTER_NONE;
+	}
+
+	// Not on the standard output, used by DepthEstimator messages
+	std::ofstream json(jsonFile);
+	CV_Assert(json.is_open());
+	json << "{\"opencl\": " << (cv::ocl::useOpenCL() ? "true" : "false") 
+		<< ", \"threads\": " << cv::getNumThreads() << ", \"repeat\": " << repeat << ", \"results\": [";
+	bool first(true);
+	for (size_t i(0); i < configs.size(); i++)
+	{
+		std::stringstream result;
+		if (!timeStages(configs[i], repeat, result))
+		{
+			std::cout << "Configuration " << i + 1 << "/" << configs.size() << " skipped: no OpenCL program" << std::endl;
+			continue;
+		}
+		json << (first ? "\n  " : ",\n  ") << result.str();
+		first = false;
+		std::cout << "Configuration " << i + 1 << "/" << configs.size() << " done" << std::endl;
+	}
+	json << "\n]}" << std::endl;
+	std::cout << "Results written to " << jsonFile << std::endl;
+	return 0;
+}
+
+/* Sweep time and sparse disparity map with and without texture gate, the texture covering a centred area */
+int runTexture(cv::Size size, float upsampling, int winSize, std::vector<std::string> const & textureShares, int repeat)
+{
+	cv::UMat table(identityTable(size));
+	DepthEstimator depthEstimator(table, table, MIN_DEPTH, MAX_DEPTH, BASELINE, TAU, upsampling, 0.3, winSize);
+	depthEstimator.setSweepEngine(DepthEstimator::SWEEP_CPU_FUSED);
+	std::vector<float> disparities(DepthEstimator::depthCandidates(MIN_DEPTH, MAX_DEPTH, BASELINE));
+	cv::Mat capture(syntheticCapture(size, disparities, TAU));
+
+	std::cout << size.width << "x" << size.height << ", upsampling " << upsampling << std::endl;
+	std::cout << std::setw(10) << "texture" << std::setw(12) << "full ms" << std::setw(12) << "gated ms" 
+		<< std::setw(10) << "swept" << std::setw(10) << "valid" << std::setw(10) << "changed" << std::endl;
+	for (size_t t(0); t < textureShares.size(); t++)
+	{
+		// Flat image with a textured centre
+		double share(std::sqrt(std::stod(textureShares[t])));
+		cv::Size textureSize(std::max(1, int(size.width * share)), std::max(1, int(size.height * share)));
+		cv::Rect textured(cv::Point((size.width - textureSize.width) / 2, (size.height - textureSize.height) / 2), textureSize);
+		cv::Mat img(size, CV_8UC3, cv::Scalar(90, 110, 130));
+		capture(textured).copyTo(img(textured));
+
+		DepthEstimator::FrameBuffers frames[2];
+		double times[2];
+		for (int gated(0); gated < 2; gated++)
+		{
+			depthEstimator.setTextureGate(gated == 1);
+			depthEstimator.initFrame(frames[gated]);
+			img.copyTo(frames[gated].img);
+			std::vector<double> sweepTimes(repeat);
+			for (int i(0); i < repeat; i++)
+			{
+				depthEstimator.runStage(DepthEstimator::STAGE_RECTIFY, frames[gated]);
+				int64 start(cv::getTickCount());
+				depthEstimator.runStage(DepthEstimator::STAGE_SWEEP, frames[gated]);
+				sweepTimes[i] = elapsedMs(start);
+			}
+			times[gated] = median(sweepTimes);
+			for (int stage(DepthEstimator::STAGE_UNWARP); stage < DepthEstimator::STAGE_COUNT; stage++)
+			{
+				depthEstimator.runStage(DepthEstimator::Stage(stage), frames[gated]);
+			}
+		}
+
+		// Valid pixels of either map whose disparity differs
+		cv::UMat valid, changed;
+		cv::bitwise_or(frames[0].sparseDisparityMap, frames[1].sparseDisparityMap, valid);
+		cv::compare(frames[0].sparseDisparityMap, frames[1].sparseDisparityMap, changed, cv::CMP_NE);
+		std::cout << std::setw(10) << std::fixed << std::setprecision(3) << share * share 
+			<< std::setw(12) << std::setprecision(2) << times[0] << std::setw(12) << times[1] 
+			<< std::setw(10) << std::setprecision(3) << depthEstimator.getCostSweep().getTexturedShare() 
+			<< std::setw(10) << cv::countNonZero(valid) << std::setw(10) << cv::countNonZero(changed) << std::endl;
+	}
+	depthEstimator.setTextureGate(false);
+	return 0;
+}
+
+/* Time of DepthEstimator::setFrame on centred regions of interest against the full frame */
+int runRoi(cv::Size size, float upsampling, int winSize, std::vector<std::string> const & roiShares, int repeat)
+{
+	cv::UMat table(identityTable(size));
+	DepthEstimator depthEstimator(table, table, MIN_DEPTH, MAX_DEPTH, BASELINE, TAU, upsampling, 0.3, winSize);
+	cv::UMat img(size, CV_8UC3);
+	cv::randu(img, cv::Scalar::all(0), cv::Scalar::all(256));
+
+	std::vector<double> times(repeat);
+	depthEstimator.setFrame(img);
+	for (int i(0); i < repeat; i++)
+	{
+		int64 start(cv::getTickCount());
+		depthEstimator.setFrame(img);
+		depthEstimator.getDepth();
+		times[i] = elapsedMs(start);
+	}
+	double fullMs(median(times));
+	std::cout << size.width << "x" << size.height << ", upsampling " << upsampling << std::endl;
+	std::cout << std::setw(12) << "roi" << std::setw(12) << "area" << std::setw(12) << "ms" 
+		<< std::setw(12) << "time share" << std::endl;
+	std::cout << std::setw(12) << "full" << std::setw(12) << std::fixed << std::setprecision(3) << 1. 
+		<< std::setw(12) << std::setprecision(2) << fullMs << std::setw(12) << 1. << std::endl;
+
+	for (size_t r(0); r < roiShares.size(); r++)
+	{
+		// Side share of the region
+		double share(std::stod(roiShares[r]));
+		cv::Size roiSize(std::max(1, int(size.width * share)), std::max(1, int(size.height * share)));
+		std::vector<cv::Rect> rois(1, cv::Rect(cv::Point((size.width - roiSize.width) / 2, 
+			(size.height - roiSize.height) / 2), roiSize));
+
+		depthEstimator.setFrame(img, rois);
+		for (int i(0); i < repeat; i++)
+		{
+			int64 start(cv::getTickCount());
+			depthEstimator.setFrame(img, rois);
+			times[i] = elapsedMs(start);
+		}
+		double ms(median(times));
+		std::cout << std::setw(12) << (std::to_string(roiSize.width) + "x" + std::to_string(roiSize.height))
+			<< std::setw(12) << std::setprecision(3) << share * share << std::setw(12) << std::setprecision(2) << ms 
+			<< std::setw(12) << ms / fullMs << std::endl;
+	}
+	return 0;
+}
+
+/* Colour against luma cost: sweep time and labels on a synthetic capture with known labels, 
+or on an image used as rectified input, and sparse disparity maps of DepthEstimator */
+int runLuma(cv::Size size, float upsampling, int winSize, std::string const & imageFile, int repeat)
+{
+	int win(int(upsampling * winSize) + 1 - (int(upsampling * winSize) % 2));
+	std::vector<float> disparities(DepthEstimator::depthCandidates(MIN_DEPTH, MAX_DEPTH, upsampling * BASELINE));
+	cv::Mat imgRectified, trueLabels;
+	if (imageFile.empty())
+	{
+		imgRectified = syntheticCapture(cv::Size(int(size.width * upsampling), int(size.height * upsampling)), 
+			disparities, TAU, &trueLabels);
+	}
+	else
+	{
+		cv::Mat img(cv::imread(imageFile));
+		if (img.empty())
+		{
+			std::cout << "Failed reading " << imageFile << std::endl;
+			return 1;
+		}
+		cv::resize(img, imgRectified, cv::Size(), upsampling, upsampling);
+	}
+
+	CostSweep sweeps[2] = { CostSweep(disparities, TAU, win), CostSweep(disparities, TAU, win) };
+	sweeps[1].setLumaCost(true);
+	cv::Mat labels[2], minCost, maxCost, reconsImgRectified;
+	double times[2];
+	for (int luma(0); luma < 2; luma++)
+	{
+		sweeps[luma].run(imgRectified, labels[luma], minCost, maxCost, reconsImgRectified);
+		times[luma] = timeSweep(sweeps[luma], imgRectified, repeat);
+	}
+
+	std::cout << (imageFile.empty() ? "Synthetic capture " : imageFile + " ") << imgRectified.cols << "x" 
+		<< imgRectified.rows << ", " << disparities.size() << " candidates, window " << win << std::endl;
+	std::cout << std::setw(8) << "cost" << std::setw(12) << "sweep ms" << std::setw(10) << "speedup" 
+		<< std::setw(12) << "true exact" << std::setw(12) << "true near" << std::setw(12) << "rgb exact" 
+		<< std::setw(12) << "rgb near" << std::endl;
+	for (int luma(0); luma < 2; luma++)
+	{
+		CostSweep::SearchReport reference(CostSweep::compareLabels(labels[0], labels[luma]));
+		std::cout << std::setw(8) << (luma ? "luma" : "rgb") << std::setw(12) << std::fixed << std::setprecision(2) 
+			<< times[luma] << std::setw(10) << times[0] / times[luma] << std::setprecision(3);
+		if (trueLabels.empty())
+		{
+			std::cout << std::setw(12) << "-" << std::setw(12) << "-";
+		}
+		else
+		{
+			CostSweep::SearchReport truth(CostSweep::compareLabels(trueLabels, labels[luma]));
+			std::cout << std::setw(12) << truth.exactShare << std::setw(12) << truth.nearShare;
+		}
+		std::cout << std::setw(12) << reference.exactShare << std::setw(12) << reference.nearShare << std::endl;
+	}
+
+	// Masked and filtered output: pixels kept by each cost and their agreement
+	cv::UMat table(identityTable(cv::Size(int(imgRectified.cols / upsampling), int(imgRectified.rows / upsampling))));
+	DepthEstimator depthEstimator(table, table, MIN_DEPTH, MAX_DEPTH, BASELINE, TAU, upsampling, 0.3, winSize);
+	DepthEstimator::FrameBuffers frames[2];
+	cv::UMat sparse[2];
+	for (int luma(0); luma < 2; luma++)
+	{
+		depthEstimator.setCostMode(luma ? DepthEstimator::COST_LUMA : DepthEstimator::COST_RGB);
+		depthEstimator.initFrame(frames[luma]);
+		cv::resize(imgRectified, frames[luma].img, table.size());
+		for (int stage(0); stage < DepthEstimator::STAGE_COUNT; stage++)
+		{
+			depthEstimator.runStage(DepthEstimator::Stage(stage), frames[luma]);
+		}
+		sparse[luma] = frames[luma].sparseDisparityMap;
+	}
+	cv::UMat validBoth, same;
+	cv::bitwise_and(sparse[0], sparse[1], validBoth);
+	cv::compare(sparse[0], sparse[1], same, cv::CMP_EQ);
+	cv::bitwise_and(same, validBoth, same);
+	int valid[2] = { cv::countNonZero(sparse[0]), cv::countNonZero(sparse[1]) }, both(cv::countNonZero(validBoth));
+	std::cout << "Sparse disparity: " << valid[0] << " valid pixels with rgb, " << valid[1] << " with luma, " 
+		<< both << " with both, " << std::setprecision(3) << (both > 0 ? double(cv::countNonZero(same)) / both : 0.) 
+		<< " of them equal" << std::endl;
+	depthEstimator.setCostMode(DepthEstimator::COST_RGB);
+	return 0;
+}
+
+/* Number of values differing between two images of the same type */
+int differingValues(cv::UMat const & a, cv::UMat const & b)
+{
+	cv::UMat different;
+	cv::compare(a.reshape(1), b.reshape(1), different, cv::CMP_NE);
+	return cv::countNonZero(different);
+}
+
+/* Candidate sweep of the OpenCL kernel against the cv:: chain and the fused CPU sweep on a synthetic capture, 
+with and without subpixel fit: sweep time, and labels and other outputs against the fused sweep. 
+Runs on the default OpenCL device, which can be a CPU runtime (OPENCV_OPENCL_DEVICE=:CPU:) */
+int runOpenCL(cv::Size size, float upsampling, int winSize, int repeat)
+{
+	cv::UMat table(identityTable(size));
+	DepthEstimator depthEstimator(table, table, MIN_DEPTH, MAX_DEPTH, BASELINE, TAU, upsampling, 0.3, winSize);
+	if (!depthEstimator.getCalibration()->hasOpenCLSweep())
+	{
+		std::cout << "No OpenCL device, or the sweep failed compiling" << std::endl;
+		return 1;
+	}
+	DepthEstimator::FrameBuffers frame;
+	depthEstimator.initFrame(frame);
+	std::vector<float> disparities(DepthEstimator::depthCandidates(MIN_DEPTH, MAX_DEPTH, upsampling * BASELINE));
+	syntheticCapture(frame.imgRectified.size(), disparities, TAU).copyTo(frame.imgRectified);
+	cv::ocl::Device const & device(cv::ocl::Device::getDefault());
+	std::cout << device.name() << " (" << device.vendorName() << "), " << frame.imgRectified.cols << "x" 
+		<< frame.imgRectified.rows << ", " << disparities.size() << " candidates" << std::endl;
+	std::cout << std::setw(10) << "sweep" << std::setw(10) << "fit" << std::setw(12) << "sweep ms" 
+		<< std::setw(10) << "speedup" << std::setw(14) << "labels exact" << std::setw(16) << "other changed" << std::endl;
+
+	const DepthEstimator::SweepEngine engines[3] = { DepthEstimator::SWEEP_CPU_FUSED, DepthEstimator::SWEEP_OPENCV, 
+		DepthEstimator::SWEEP_OPENCL };
+	const char * names[3] = { "cpu_fused", "opencv", "opencl" };
+	for (int fit(0); fit < 2; fit++)
+	{
+		depthEstimator.setSubpixelFit(fit ? CostSweep::SUBPIXEL_PARABOLA : CostSweep::SUBPIXEL_NONE);
+		// Outputs of the fused sweep, the reference
+		cv::UMat labels, minCost, maxCost, reconsImgRectified, subDisparityMap;
+		double fusedMs(0.);
+		for (int e(0); e < 3; e++)
+		{
+			depthEstimator.setSweepEngine(engines[e]);
+			std::vector<double> times(repeat);
+			for (int r(-1); r < repeat; r++)
+			{
+				int64 start(cv::getTickCount());
+				depthEstimator.runStage(DepthEstimator::STAGE_SWEEP, frame);
+				double ms(elapsedMs(start));
+				if (r >= 0)
+					times[r] = ms;
+			}
+			double ms(median(times));
+			if (e == 0)
+			{
+				fusedMs = ms;
+				frame.fullDisparityMap.copyTo(labels);
+				frame.minCost.copyTo(minCost);
+				frame.maxCost.copyTo(maxCost);
+				frame.reconsImgRectified.copyTo(reconsImgRectified);
+				if (fit)
+					frame.subDisparityMap.copyTo(subDisparityMap);
+			}
+
+			CostSweep::SearchReport report(CostSweep::compareLabels(labels.getMat(cv::ACCESS_READ), 
+				frame.fullDisparityMap.getMat(cv::ACCESS_READ)));
+			int changed(differingValues(minCost, frame.minCost) + differingValues(maxCost, frame.maxCost) 
+				+ differingValues(reconsImgRectified, frame.reconsImgRectified) 
+				+ (fit ? differingValues(subDisparityMap, frame.subDisparityMap) : 0));
+			std::cout << std::setw(10) << names[e] << std::setw(10) << (fit ? "parabola" : "none") 
+				<< std::setw(12) << std::fixed << std::setprecision(2) << ms << std::setw(10) << fusedMs / ms 
+				<< std::setw(14) << std::setprecision(4) << report.exactShare << std::setw(16) << changed << std::endl;
+		}
+	}
+	depthEstimator.setSweepEngine(DepthEstimator::SWEEP_CPU_FUSED);
+	return 0;
+}
+
+/* Synthetic rectified capture with fractional disparities, constant on patches within [minDisparity, maxDisparity]. 
+The copy is translated with linear interpolation. trueDisparity receives the disparity of each pixel (CV_32FC1) */
+cv::Mat fractionalCapture(cv::Size size, float minDisparity, float maxDisparity, float tau, cv::Mat & trueDisparity)
+{
+	cv::Mat texture(size, CV_8UC3), translated, captured;
+	cv::randu(texture, cv::Scalar::all(0), cv::Scalar::all(256));
+	cv::GaussianBlur(texture, texture, cv::Size(5, 5), 1.);
+
+	// Patches wider than the window, so that most pixels measure the precision rather than the boundaries
+	const int patch(std::max(32, size.width / 4));
+	cv::Mat patchDisparities((size.height + patch - 1) / patch, (size.width + patch - 1) / patch, CV_32FC1), 
+		mapX(size, CV_32FC1), mapY(size, CV_32FC1);
+	cv::randu(patchDisparities, cv::Scalar::all(std::min(minDisparity, maxDisparity)), 
+		cv::Scalar::all(std::max(minDisparity, maxDisparity)));
+	trueDisparity.create(size, CV_32FC1);
+	for (int y(0); y < size.height; y++)
+	{
+		for (int x(0); x < size.width; x++)
+		{
+			float d(patchDisparities.at<float>(y / patch, x / patch));
+			trueDisparity.at<float>(y, x) = d;
+			mapX.at<float>(y, x) = float(x) - d;
+			mapY.at<float>(y, x) = float(y);
+		}
+	}
+	cv::remap(texture, translated, mapX, mapY, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+	cv::addWeighted(texture, 1., translated, tau, 0., captured);
+	return captured;
+}
+
+/* Precision of the disparity against candidate spacing, subpixel fit and upsampling on a capture with 
+fractional disparities: candidates one pixel apart, spacing pixels apart, and one pixel apart at twice the resolution */
+int runSubpixel(cv::Size size, int winSize, float spacing, int repeat)
+{
+	std::vector<float> disparities(DepthEstimator::depthCandidates(MIN_DEPTH, MAX_DEPTH, BASELINE));
+	cv::Mat trueDisparity, imgUpsampled;
+	cv::Mat imgRectified(fractionalCapture(size, disparities.front(), disparities.back(), TAU, trueDisparity));
+	cv::resize(imgRectified, imgUpsampled, cv::Size(), 2., 2., cv::INTER_LINEAR);
+
+	struct Config
+	{
+		std::string name;
+		float upsampling, spacing;
+		CostSweep::SubpixelFit fit;
+	};
+	std::ostringstream stream;
+	stream << "spacing " << spacing;
+	std::string spacingName(stream.str());
+	std::vector<Config> configs = { 
+		{ "spacing 1", 1.f, 1.f, CostSweep::SUBPIXEL_NONE }, 
+		{ "spacing 1 parabola", 1.f, 1.f, CostSweep::SUBPIXEL_PARABOLA }, 
+		{ "spacing 1 equiangular", 1.f, 1.f, CostSweep::SUBPIXEL_EQUIANGULAR }, 
+		{ spacingName, 1.f, spacing, CostSweep::SUBPIXEL_NONE }, 
+		{ spacingName + " parabola", 1.f, spacing, CostSweep::SUBPIXEL_PARABOLA }, 
+		{ spacingName + " equiangular", 1.f, spacing, CostSweep::SUBPIXEL_EQUIANGULAR }, 
+		{ "upsampling 2", 2.f, 1.f, CostSweep::SUBPIXEL_NONE } };
+
+	std::cout << "Fractional disparities on " << size.width << "x" << size.height << ", window " << winSize 
+		<< ", errors in pixels at the input resolution" << std::endl;
+	std::cout << std::setw(30) << "candidates" << std::setw(8) << "count" << std::setw(12) << "sweep ms" 
+		<< std::setw(10) << "speedup" << std::setw(12) << "mean error" << std::setw(10) << "< 0.25" 
+		<< std::setw(10) << "< 0.5" << std::endl;
+	double reference(0.);
+	for (size_t i(0); i < configs.size(); i++)
+	{
+		Config const & config(configs[i]);
+		int win(int(config.upsampling * winSize) + 1 - (int(config.upsampling * winSize) % 2));
+		std::vector<float> candidates(DepthEstimator::depthCandidates(MIN_DEPTH, MAX_DEPTH, 
+			config.upsampling * BASELINE, config.spacing));
+		cv::Mat const & img(config.upsampling > 1.f ? imgUpsampled : imgRectified);
+		CostSweep sweep(candidates, TAU, win);
+		sweep.setSubpixelFit(config.fit);
+		double ms(timeSweep(sweep, img, repeat));
+
+		// Fractional labels, or the integer ones, to disparities at the input resolution
+		cv::Mat labels, minCost, maxCost, reconsImgRectified, subLabels, disparity;
+		sweep.run(img, labels, minCost, maxCost, reconsImgRectified);
+		if (config.fit == CostSweep::SUBPIXEL_NONE)
+			labels.convertTo(subLabels, CV_32F);
+		else
+			subLabels = sweep.getSubpixelLabels();
+		if (config.upsampling > 1.f)
+			cv::resize(subLabels, subLabels, size, 0., 0., cv::INTER_NEAREST);
+		float step(candidates.size() > 1 ? candidates[1] - candidates[0] : 0.f);
+		subLabels.convertTo(disparity, CV_32F, step / config.upsampling, (candidates[0] - step) / config.upsampling);
+
+		cv::Mat error;
+		cv::absdiff(disparity, trueDisparity, error);
+		double total(double(error.total()));
+		cv::Mat within;
+		cv::compare(error, 0.25, within, cv::CMP_LT);
+		double quarter(cv::countNonZero(within) / total);
+		cv::compare(error, 0.5, within, cv::CMP_LT);
+		double half(cv::countNonZero(within) / total);
+		if (i == 0)
+			reference = ms;
+		std::cout << std::setw(30) << config.name << std::setw(8) << candidates.size() << std::setw(12) 
+			<< std::fixed << std::setprecision(2) << ms << std::setw(10) << reference / ms << std::setprecision(3) 
+			<< std::setw(12) << cv::mean(error)[0] << std::setw(10) << quarter << std::setw(10) << half << std::endl;
+	}
+	return 0;
+}
+
+/* Creation time and table memory of count estimators, each building its own tables or all sharing one calibration */
+int runInstances(cv::Size size, float upsampling, int winSize, int count)
+{
+	cv::UMat table(identityTable(size));
+	std::vector<std::unique_ptr<DepthEstimator> > estimators;
+
+	int64 start(cv::getTickCount());
+	for (int i(0); i < count; i++)
+	{
+		estimators.emplace_back(new DepthEstimator(table, table, MIN_DEPTH, MAX_DEPTH, BASELINE, TAU, upsampling, 0.3, winSize));
+	}
+	double separateMs(elapsedMs(start));
+	double bytes(double(estimators[0]->getCalibration()->getBytes()));
+	estimators.clear();
+
+	start = cv::getTickCount();
+	std::shared_ptr<RectificationCache> tables(std::make_shared<RectificationCache>());
+	tables->build(table, table, upsampling, 0.3);
+	std::shared_ptr<const DepthCalibration> calibration(std::make_shared<DepthCalibration>(tables, 
+		MIN_DEPTH, MAX_DEPTH, BASELINE, TAU, winSize));
+	double calibrationMs(elapsedMs(start));
+	start = cv::getTickCount();
+	for (int i(0); i < count; i++)
+	{
+		estimators.emplace_back(new DepthEstimator(calibration));
+	}
+	double sharedMs(elapsedMs(start));
+
+	std::cout << count << " estimators for " << size.width << "x" << size.height << ", upsampling " << upsampling << std::endl;
+	std::cout << std::setw(10) << "tables" << std::setw(16) << "calibration ms" << std::setw(16) << "estimators ms" 
+		<< std::setw(16) << "per estimator" << std::setw(12) << "tables MB" << std::endl;
+	std::cout << std::setw(10) << "separate" << std::setw(16) << "-" << std::setw(16) << std::fixed << std::setprecision(2) 
+		<< separateMs << std::setw(16) << separateMs / count << std::setw(12) << count * bytes / (1024. * 1024.) << std::endl;
+	std::cout << std::setw(10) << "shared" << std::setw(16) << calibrationMs << std::setw(16) << sharedMs 
+		<< std::setw(16) << sharedMs / count << std::setw(12) << bytes / (1024. * 1024.) << std::endl;
+	return 0;
+}
+
+/* Memory held by an estimator after a frame, for sweep configurations of the cv:: chain and the fused sweep */
+int runMemory(cv::Size size, float upsampling, int winSize)
+{
+	struct Config
+	{
+		const char * name;
+		DepthEstimator::SweepEngine engine;
+		DepthEstimator::CostMode cost;
+		bool deferred;
+		CostSweep::SubpixelFit fit;
+	};
+	Config configs[] = {
+		{ "opencv rgb", DepthEstimator::SWEEP_OPENCV, DepthEstimator::COST_RGB, false, CostSweep::SUBPIXEL_NONE },
+		{ "opencv luma", DepthEstimator::SWEEP_OPENCV, DepthEstimator::COST_LUMA, true, CostSweep::SUBPIXEL_NONE },
+		{ "opencv fit", DepthEstimator::SWEEP_OPENCV, DepthEstimator::COST_RGB, false, CostSweep::SUBPIXEL_PARABOLA },
+		{ "cpu_fused", DepthEstimator::SWEEP_CPU_FUSED, DepthEstimator::COST_RGB, false, CostSweep::SUBPIXEL_NONE },
+		{ "cpu_fused fit", DepthEstimator::SWEEP_CPU_FUSED, DepthEstimator::COST_RGB, false, CostSweep::SUBPIXEL_PARABOLA } };
+
+	cv::UMat table(identityTable(size)), img(size, CV_8UC3);
+	cv::randu(img, cv::Scalar::all(0), cv::Scalar::all(256));
+	double mb(1. / (1024. * 1024.));
+	std::cout << "Estimator memory in MB for " << size.width << "x" << size.height << ", upsampling " << upsampling << std::endl;
+	std::cout << std::setw(14) << "sweep" << std::setw(9) << "frames" << std::setw(9) << "scratch" << std::setw(11) << "unaliased" 
+		<< std::setw(9) << "outputs" << std::setw(9) << "cpu" << std::setw(9) << "steady" << std::setw(9) << "peak" 
+		<< std::setw(9) << "shared" << std::endl;
+	for (size_t c(0); c < sizeof(configs) / sizeof(configs[0]); c++)
+	{
+		// New estimator: the buffers of the previous configurations are not counted
+		DepthEstimator depthEstimator(table, table, MIN_DEPTH, MAX_DEPTH, BASELINE, TAU, upsampling, 0.3, winSize);
+		depthEstimator.setSweepEngine(configs[c].engine);
+		depthEstimator.setCostMode(configs[c].cost);
+		depthEstimator.setDeferredColour(configs[c].deferred);
+		depthEstimator.setSubpixelFit(configs[c].fit);
+		depthEstimator.setFrame(img);
+		depthEstimator.getDepth();
+		depthEstimator.getDisparityMap();
+		if (configs[c].fit != CostSweep::SUBPIXEL_NONE)
+			depthEstimator.getSubpixelDepth();
+
+		DepthEstimator::MemoryFootprint footprint(depthEstimator.getMemoryFootprint());
+		std::cout << std::setw(14) << configs[c].name << std::fixed << std::setprecision(1) 
+			<< std::setw(9) << footprint.frames * mb << std::setw(9) << footprint.scratch * mb 
+			<< std::setw(11) << footprint.scratchUnaliased * mb << std::setw(9) << footprint.outputs * mb 
+			<< std::setw(9) << footprint.cpu * mb << std::setw(9) << footprint.steady * mb 
+			<< std::setw(9) << footprint.peak * mb << std::setw(9) << footprint.shared * mb << std::endl;
+	}
+	return 0;
+}
+
+/* Handing the valid pixels of a frame to a consumer: the dense depth map, scanned by the consumer for its valid pixels, 
+against the sparse points built while filtering */
+int runPoints(cv::Size size, float upsampling, int winSize, int repeat)
+{
+	cv::UMat table(identityTable(size));
+	DepthEstimator depthEstimator(table, table, MIN_DEPTH, MAX_DEPTH, BASELINE, TAU, upsampling, 0.3, winSize);
+	depthEstimator.setSweepEngine(DepthEstimator::SWEEP_CPU_FUSED);
+	depthEstimator.setFilterEngine(DepthEstimator::FILTER_CPU);
+	std::vector<float> disparities(DepthEstimator::depthCandidates(MIN_DEPTH, MAX_DEPTH, BASELINE));
+	DepthEstimator::FrameBuffers frame;
+	depthEstimator.initFrame(frame);
+	syntheticCapture(size, disparities, TAU).copyTo(frame.img);
+	for (int stage(DepthEstimator::STAGE_RECTIFY); stage < DepthEstimator::STAGE_FILTER; stage++)
+	{
+		depthEstimator.runStage(DepthEstimator::Stage(stage), frame);
+	}
+
+	// Dense: filter, depth map, then the scan of the consumer for its points
+	cv::Mat depth;
+	std::vector<cv::Point3f> densePoints;
+	std::vector<double> denseTimes(repeat), sparseTimes(repeat);
+	depthEstimator.setPointFormat(DepthEstimator::POINTS_NONE);
+	for (int r(0); r < repeat; r++)
+	{
+		int64 start(cv::getTickCount());
+		depthEstimator.runStage(DepthEstimator::STAGE_FILTER, frame);
+		depthEstimator.getDepth(frame, depth);
+		densePoints.clear();
+		for (int y(0); y < depth.rows; y++)
+		{
+			const float * row(depth.ptr<float>(y));
+			for (int x(0); x < depth.cols; x++)
+			{
+				if (row[x] > 0.f)
+					densePoints.push_back(cv::Point3f(float(x), float(y), row[x]));
+			}
+		}
+		denseTimes[r] = elapsedMs(start);
+	}
+
+	// Sparse: the points are collected by the filter
+	depthEstimator.setPointFormat(DepthEstimator::POINTS_PIXEL);
+	for (int r(0); r < repeat; r++)
+	{
+		int64 start(cv::getTickCount());
+		depthEstimator.runStage(DepthEstimator::STAGE_FILTER, frame);
+		sparseTimes[r] = elapsedMs(start);
+	}
+
+	double mb(1. / (1024. * 1024.)), share(double(frame.points.size()) / (depth.rows * depth.cols));
+	std::cout << "Valid pixels of a " << depth.cols << "x" << depth.rows << " map, " 
+		<< std::fixed << std::setprecision(3) << share << " valid" << std::endl;
+	std::cout << std::setw(10) << "dense" << std::setw(10) << median(denseTimes) << " ms" << std::setw(10) 
+		<< depth.total() * depth.elemSize() * mb << " MB, " << densePoints.size() << " points" << std::endl;
+	std::cout << std::setw(10) << "sparse" << std::setw(10) << median(sparseTimes) << " ms" << std::setw(10) 
+		<< frame.points.size() * sizeof(DepthEstimator::SparsePoint) * mb << " MB, " << frame.points.size() << " points" << std::endl;
+	return 0;
+}
+
+/* Writing the outputs of frameCount frames: the 16-bit depth and colour PNGs of the batch tool, encoded in memory, 
+against recordings with each colour codec, then their memory-mapped replay into depth maps */
+int runRecording(cv::Size size, float upsampling, int winSize, int frameCount, std::string const & file)
+{
+	cv::UMat table(identityTable(size));
+	DepthEstimator depthEstimator(table, table, MIN_DEPTH, MAX_DEPTH, BASELINE, TAU, upsampling, 0.3, winSize);
+	depthEstimator.setSweepEngine(DepthEstimator::SWEEP_CPU_FUSED);
+	std::vector<float> disparities(DepthEstimator::depthCandidates(MIN_DEPTH, MAX_DEPTH, BASELINE));
+	DepthEstimator::FrameBuffers frame;
+	depthEstimator.initFrame(frame);
+	syntheticCapture(size, disparities, TAU).copyTo(frame.img);
+	for (int stage(0); stage < DepthEstimator::STAGE_COUNT; stage++)
+	{
+		depthEstimator.runStage(DepthEstimator::Stage(stage), frame);
+	}
+	cv::Mat sparse(frame.sparseDisparityMap.getMat(cv::ACCESS_READ)), colour(frame.reconsImg.getMat(cv::ACCESS_READ)), depth;
+	std::cout << frameCount << " frames of " << colour.cols << "x" << colour.rows << ", " 
+		<< double(cv::countNonZero(sparse)) / sparse.total() << " valid" << std::endl;
+	std::cout << std::setw(14) << "output" << std::setw(12) << "write ms" << std::setw(12) << "MB/frame" 
+		<< std::setw(12) << "replay ms" << std::endl;
+
+	// Batch tool outputs
+	std::vector<uchar> depthPng, colourPng;
+	std::vector<double> times(frameCount);
+	for (int f(0); f < frameCount; f++)
+	{
+		int64 start(cv::getTickCount());
+		depthEstimator.getDepth(frame, depth, DepthEstimator::DEPTH_16U);
+		cv::imencode(".png", depth, depthPng);
+		cv::imencode(".png", colour, colourPng);
+		times[f] = elapsedMs(start);
+	}
+	std::cout << std::setw(14) << "png" << std::fixed << std::setprecision(3) << std::setw(12) << median(times) 
+		<< std::setw(12) << double(depthPng.size() + colourPng.size()) / 1e6 << std::endl;
+
+	const char * names[3] = { "record none", "record raw", "record jpeg" };
+	for (int codec(DepthRecorder::COLOUR_NONE); codec <= DepthRecorder::COLOUR_JPEG; codec++)
+	{
+		DepthRecorder recorder;
+		if (!recorder.open(file, depthEstimator.getDepthTable(), DepthRecorder::ColourCodec(codec)))
+		{
+			std::cout << "Failed creating " << file << std::endl;
+			return 1;
+		}
+		for (int f(0); f < frameCount; f++)
+		{
+			int64 start(cv::getTickCount());
+			recorder.write(f, sparse, colour);
+			times[f] = elapsedMs(start);
+		}
+		recorder.close();
+		double writeMs(median(times));
+
+		// Replay: decode and convert to depth
+		DepthRecording recording;
+		if (!recording.open(file))
+		{
+			std::cout << "Failed opening " << file << std::endl;
+			return 1;
+		}
+		DepthRecording::Frame replayed;
+		std::vector<double> replayTimes(recording.getFrameCount());
+		for (int f(0); f < recording.getFrameCount(); f++)
+		{
+			int64 start(cv::getTickCount());
+			recording.read(f, replayed);
+			cv::LUT(replayed.sparseDisparityMap, recording.getDepthTable(), depth);
+			replayTimes[f] = elapsedMs(start);
+		}
+		std::cout << std::setw(14) << names[codec] << std::setw(12) << writeMs 
+			<< std::setw(12) << double(recorder.getBytes()) / frameCount / 1e6 << std::setw(12) << median(replayTimes) << std::endl;
+	}
+	std::remove(file.c_str());
+	return 0;
+}
+
+/* Time of the depth and visualisation outputs: chains of cv:: calls allocating their images, 
+as before the output tables, and lookups into caller buffers, on a sparse disparity map with validShare valid pixels */
+int runOutputs(cv::Size size, float upsampling, int winSize, double validShare, int repeat)
+{
+	cv::UMat table(identityTable(size));
+	DepthEstimator depthEstimator(table, table, MIN_DEPTH, MAX_DEPTH, BASELINE, TAU, upsampling, 0.3, winSize);
+	DepthEstimator::FrameBuffers frame;
+	depthEstimator.initFrame(frame);
+	cv::Mat sparse(frame.sparseDisparityMap.size(), CV_8UC1), valid(sparse.size(), CV_32FC1);
+	cv::randu(sparse, cv::Scalar(1), cv::Scalar(256));
+	cv::randu(valid, cv::Scalar(0.), cv::Scalar(1.));
+	sparse.setTo(0, valid > validShare);
+	sparse.copyTo(frame.sparseDisparityMap);
+
+	std::vector<float> disparities(DepthEstimator::depthCandidates(MIN_DEPTH, MAX_DEPTH, upsampling * BASELINE));
+	double minDepth(upsampling * BASELINE / disparities.back()), maxDepth(upsampling * BASELINE / disparities.front());
+	int zCount(int(disparities.size()));
+	cv::UMat chainDepth, chainColour;
+	auto chainOutputs = [&]()
+	{
+		cv::UMat depth, mask, disparityMap;
+		frame.sparseDisparityMap.convertTo(depth, CV_32F, 1. / 255., -1. / zCount);
+		cv::multiply(depth, (1. / minDepth - 1. / maxDepth), depth);
+		cv::add(depth, 1. / maxDepth, depth);
+		cv::divide(1., depth, depth);
+		cv::compare(frame.sparseDisparityMap, 0, mask, cv::CMP_EQ);
+		depth.setTo(0., mask);
+		cv::multiply(frame.sparseDisparityMap, 0.8, disparityMap);
+		cv::add(disparityMap, 0.25 * 255., disparityMap, disparityMap);
+		cv::dilate(disparityMap, disparityMap, cv::UMat::ones(3, 3, CV_8UC1));
+		cv::applyColorMap(disparityMap, disparityMap, cv::COLORMAP_MAGMA);
+		chainDepth = depth;
+		chainColour = disparityMap;
+	};
+	cv::Mat depth32, depth16, colour;
+	cv::UMat depthDevice;
+
+	// Median of repeat runs of each output, after a first run allocating the buffers
+	std::vector<double> times[5];
+	for (int r(0); r <= repeat; r++)
+	{
+		int64 start(cv::getTickCount());
+		chainOutputs();
+		double chainMs(elapsedMs(start));
+		start = cv::getTickCount();
+		depthEstimator.getDepth(frame, depth32);
+		double depth32Ms(elapsedMs(start));
+		start = cv::getTickCount();
+		depthEstimator.getDepth(frame, depth16, DepthEstimator::DEPTH_16U);
+		double depth16Ms(elapsedMs(start));
+		start = cv::getTickCount();
+		depthEstimator.getDepth(frame, depthDevice);
+		double deviceMs(elapsedMs(start));
+		start = cv::getTickCount();
+		depthEstimator.getDisparityMap(frame, colour);
+		double colourMs(elapsedMs(start));
+		if (r == 0)
+			continue;
+		times[0].push_back(chainMs);
+		times[1].push_back(depth32Ms);
+		times[2].push_back(depth16Ms);
+		times[3].push_back(deviceMs);
+		times[4].push_back(colourMs);
+	}
+
+	// Differences with the chains
+	cv::Mat depthDiff, colourDiff;
+	cv::absdiff(depth32, chainDepth.getMat(cv::ACCESS_READ), depthDiff);
+	cv::absdiff(colour, chainColour.getMat(cv::ACCESS_READ), colourDiff);
+	double maxDepthDiff, maxColourDiff;
+	cv::minMaxLoc(depthDiff, nullptr, &maxDepthDiff);
+	cv::minMaxLoc(colourDiff.reshape(1), nullptr, &maxColourDiff);
+
+	std::cout << "Outputs of a " << sparse.cols << "x" << sparse.rows << " sparse disparity map, " 
+		<< validShare << " valid" << std::endl;
+	const char * names[5] = { "cv:: chains", "depth 32F", "depth 16U", "depth device", "colour" };
+	for (int i(0); i < 5; i++)
+	{
+		std::cout << std::setw(14) << names[i] << std::setw(10) << std::fixed << std::setprecision(3) 
+			<< median(times[i]) << " ms" << std::endl;
+	}
+	std::cout << "Largest difference with the chains: depth " << maxDepthDiff << " mm, colour " << maxColourDiff << std::endl;
+	return 0;
+}
+
+/* Conversion and rectification of raw camera buffers: cv::cvtColor then cv::remap against the fused RawRectifier */
+int runRaw(cv::Size size, std::vector<std::string> const & formats, int repeat)
+{
+	// Slightly rotated table, so that the remapping interpolates
+	cv::Mat table(size, CV_32FC2), tformInd1, tformInd2;
+	cv::Point2f centre(0.5f * size.width, 0.5f * size.height);
+	for (int y(0); y < size.height; y++)
+	{
+		for (int x(0); x < size.width; x++)
+		{
+			cv::Point2f d(float(x) - centre.x, float(y) - centre.y);
+			table.at<cv::Vec2f>(y, x) = cv::Vec2f(centre.x + 0.999f * d.x - 0.02f * d.y, centre.y + 0.02f * d.x + 0.999f * d.y);
+		}
+	}
+	cv::convertMaps(table, cv::noArray(), tformInd1, tformInd2, CV_16SC2);
+
+	std::map<std::string, RawRectifier::Format> names = { { "bgr", RawRectifier::FORMAT_BGR }, 
+		{ "bayer_rggb", RawRectifier::FORMAT_BAYER_RGGB }, { "bayer_bggr", RawRectifier::FORMAT_BAYER_BGGR }, 
+		{ "bayer_grbg", RawRectifier::FORMAT_BAYER_GRBG }, { "bayer_gbrg", RawRectifier::FORMAT_BAYER_GBRG }, 
+		{ "yuyv", RawRectifier::FORMAT_YUYV }, { "uyvy", RawRectifier::FORMAT_UYVY }, { "nv12", RawRectifier::FORMAT_NV12 } };
+
+	std::cout << size.width << "x" << size.height << std::endl;
+	std::cout << std::setw(12) << "format" << std::setw(14) << "cvtColor ms" << std::setw(12) << "fused ms" 
+		<< std::setw(10) << "max diff" << std::endl;
+	for (size_t f(0); f < formats.size(); f++)
+	{
+		if (!names.count(formats[f]))
+		{
+			std::cout << "Unknown raw format " << formats[f] << std::endl;
+			return 1;
+		}
+		RawRectifier::Format format(names[formats[f]]);
+		cv::Mat raw;
+		if (format == RawRectifier::FORMAT_NV12)
+			raw.create(size.height * 3 / 2, size.width, CV_8UC1);
+		else
+			raw.create(size, CV_8UC(int(RawRectifier::getBytesPerPixel(format))));
+		cv::randu(raw, cv::Scalar::all(0), cv::Scalar::all(256));
+		RawRectifier::Frame frame;
+		frame.data = raw.data;
+		frame.step = raw.step;
+		frame.size = size;
+		frame.format = format;
+
+		cv::Mat converted, reference, fused;
+		std::vector<double> times(repeat), fusedTimes(repeat);
+		for (int i(0); i < repeat; i++)
+		{
+			int64 start(cv::getTickCount());
+			if (format == RawRectifier::FORMAT_BGR)
+				converted = raw;
+			else
+				cv::cvtColor(raw, converted, RawRectifier::getConversionCode(format));
+			cv::remap(converted, reference, tformInd1, tformInd2, cv::INTER_LINEAR);
+			times[i] = elapsedMs(start);
+
+			start = cv::getTickCount();
+			RawRectifier::rectify(frame, tformInd1, tformInd2, fused);
+			fusedTimes[i] = elapsedMs(start);
+		}
+		std::cout << std::setw(12) << formats[f] << std::setw(14) << std::fixed << std::setprecision(2) << median(times) 
+			<< std::setw(12) << median(fusedTimes) << std::setw(10) << std::setprecision(0) 
+			<< cv::norm(reference, fused, cv::NORM_INF) << std::endl;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	cv::Size size(1920, 1080);
+	float upsampling(1.f), spacing(2.f);
+	double validShare(0.1);
+	int winSize(61), maxThreads(32), repeat(5), frameCount(50), maxInFlight(3), tileSize(256), 
+		temporalWindow(2), instanceCount(16);
+	std::string mode("scaling"), jsonFile("stages.json"), imageFile, recordFile("recording.rec");
+	// Parameter lists of the stage benchmark
+	std::map<std::string, std::string> lists = { 
+		{ "sizes", "640x360,1280x720,1920x1080" }, { "upsamplings", "1" }, { "win-sizes", "61" }, 
+		{ "scale-masks", "0.3" }, { "depth-ranges", "450:800" }, { "sweep-engines", "opencv,cpu_fused" }, 
+		{ "filter-engines", "none,cpu,opencl" }, { "strides", "2,4,8" }, 
+		{ "roi-shares", "0.125,0.25,0.5" }, { "texture-shares", "0.05,0.2,0.5,1" }, 
+		{ "raw-formats", "bgr,bayer_rggb,yuyv,nv12" } };
+
+	for (int i(1); i + 1 < argc; i += 2)
+	{
+		std::string arg(argv[i]);
+		if (arg == "--width")
+			size.width = std::stoi(argv[i + 1]);
+		else if (arg == "--height")
+			size.height = std::stoi(argv[i + 1]);
+		else if (arg == "--upsampling")
+			upsampling = std::stof(argv[i + 1]);
+		else if (arg == "--spacing")
+			spacing = std::max(1.f, std::stof(argv[i + 1]));
+		else if (arg == "--win-size")
+			winSize = std::stoi(argv[i + 1]);
+		else if (arg == "--max-threads")
+			maxThreads = std::stoi(argv[i + 1]);
+		else if (arg == "--repeat")
+			repeat = std::max(1, std::stoi(argv[i + 1]));
+		else if (arg == "--mode")
+			mode = argv[i + 1];
+		else if (arg == "--frames")
+			frameCount = std::max(1, std::stoi(argv[i + 1]));
+		else if (arg == "--in-flight")
+			maxInFlight = std::max(1, std::stoi(argv[i + 1]));
+		else if (arg == "--window")
+			temporalWindow = std::max(1, std::stoi(argv[i + 1]));
+		else if (arg == "--valid-share")
+			validShare = std::stod(argv[i + 1]);
+		else if (arg == "--instances")
+			instanceCount = std::max(1, std::stoi(argv[i + 1]));
+		else if (arg == "--tile-size")
+			tileSize = std::max(1, std::stoi(argv[i + 1]));
+		else if (arg == "--json")
+			jsonFile = argv[i + 1];
+		else if (arg == "--image")
+			imageFile = argv[i + 1];
+		else if (arg == "--record")
+			recordFile = argv[i + 1];
+		else if (arg.size() > 2 && lists.count(arg.substr(2)))
+			lists[arg.substr(2)] = argv[i + 1];
+		else
+		{
+			std::cout << "Unknown option " << arg << std::endl;
+			return 1;
+		}
+	}
+
+	if (mode == "pipeline")
+		return runPipeline(size, upsampling, winSize, frameCount, maxInFlight);
+	if (mode == "stages")
+		return runStages(lists, repeat, jsonFile);
+	if (mode == "texture")
+		return runTexture(size, upsampling, winSize, splitList(lists["texture-shares"]), repeat);
+	if (mode == "roi")
+		return runRoi(size, upsampling, winSize, splitList(lists["roi-shares"]), repeat);
+	if (mode == "luma")
+		return runLuma(size, upsampling, winSize, imageFile, repeat);
+	if (mode == "opencl")
+		return runOpenCL(size, upsampling, winSize, repeat);
+	if (mode == "outputs")
+		return runOutputs(size, upsampling, winSize, validShare, repeat);
+	if (mode == "points")
+		return runPoints(size, upsampling, winSize, repeat);
+	if (mode == "recording")
+		return runRecording(size, upsampling, winSize, frameCount, recordFile);
+	if (mode == "memory")
+		return runMemory(size, upsampling, winSize);
+	if (mode == "instances")
+		return runInstances(size, upsampling, winSize, instanceCount);
+	if (mode == "subpixel")
+		return runSubpixel(size, winSize, spacing, repeat);
+	if (mode == "raw")
+		return runRaw(size, splitList(lists["raw-formats"]), repeat);
+	if (mode == "temporal")
+		return runTemporal(size, upsampling, winSize, temporalWindow, tileSize, frameCount);
+	if (mode == "hierarchical")
+		return runHierarchical(size, upsampling, winSize, splitList(lists["strides"]), tileSize, repeat);
+	return runScaling(size, upsampling, winSize, maxThreads, repeat);
+}
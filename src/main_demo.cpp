@@ -42,26 +42,33 @@ SOFTWARE.
 
 int main(int argc, char **argv)
 {
-	// Read the rectification tables
-	cv::UMat tformInd, invInd;
-	std::vector<cv::UMat> handle(2);
+	// Memory-map the binary rectification tables written by precompute_rectification, 
+	// or read and convert the exr tables if they are not available
+	std::shared_ptr<RectificationCache> tables(std::make_shared<RectificationCache>());
+	if (!tables->open(RectificationCache::fileName("resources/rectification", 1.f, 0.3), 1.f, 0.3))
+	{
+		cv::UMat tformInd, invInd;
+		std::vector<cv::UMat> handle(2);
 
-	handle[0] = cv::imread("resources/tform_ind1.exr", cv::IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
-	handle[1] = cv::imread("resources/tform_ind2.exr", cv::IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
-	cv::merge(handle, tformInd);
-	
-	handle[0] = cv::imread("resources/inv_ind1.exr", cv::IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
-	handle[1] = cv::imread("resources/inv_ind2.exr", cv::IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
-	cv::merge(handle, invInd);
+		handle[0] = cv::imread("resources/tform_ind1.exr", cv::IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
+		handle[1] = cv::imread("resources/tform_ind2.exr", cv::IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
+		cv::merge(handle, tformInd);
+		
+		handle[0] = cv::imread("resources/inv_ind1.exr", cv::IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
+		handle[1] = cv::imread("resources/inv_ind2.exr", cv::IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
+		cv::merge(handle, invInd);
+
+		tables->build(tformInd, invInd, 1.f, 0.3);
+	}
 
 	// Initialise and set parameters
-	DepthEstimator depthEstimator(tformInd, invInd, MIN_DEPTH, MAX_DEPTH, BASELINE, TAU);
-	tformInd.release();
-	invInd.release();
+	DepthEstimator depthEstimator(tables, MIN_DEPTH, MAX_DEPTH, BASELINE, TAU);
 
 	// Read the input image and run the algorithm
 	cv::UMat in(cv::imread("resources/demo.png").getUMat(cv::ACCESS_READ));
 	depthEstimator.setFrame(in.clone());
+	std::cout << "Disparity filtering: " << depthEstimator.getFilterTime() << " ms, " 
+		<< depthEstimator.getFilterThroughput() << " Mpx/s" << std::endl;
 
 	cv::imshow("Restored", depthEstimator.getReconsImg());
 	cv::imshow("Input", in);
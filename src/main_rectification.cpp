@@ -32,37 +32,99 @@ SOFTWARE.
 *****************************************************************************/
 
 #include "rectifier.h"
+#include "rectification_cache.h"
 
 #include <opencv2/opencv.hpp>
+#include <string>
 
-int main(int argc, char **argv)
+/* Read a two-channel table from its two exr files */
+cv::UMat readTable(std::string const & file1, std::string const & file2)
 {
-	cv::UMat bO2D, bE2D, tformInd, invInd;
 	std::vector<cv::UMat> handle(2);
+	cv::UMat table;
+	handle[0] = cv::imread(file1, cv::IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
+	handle[1] = cv::imread(file2, cv::IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
+	CV_Assert(!handle[0].empty() && !handle[1].empty());
+	cv::merge(handle, table);
+	return table;
+}
+
+int main(int argc, char **argv)
+{
+	// --from-tables only converts the current tables to the binary format
+	bool fromTables(false);
+	Rectifier::Engine engine(Rectifier::ENGINE_CPU);
+	float upsampling(1.f);
+	double scaleMask(0.3), inverseScale(6.);
+	for (int i(1); i < argc; i++)
+	{
+		std::string arg(argv[i]);
+		if (arg == "--from-tables")
+			fromTables = true;
+		else if (arg == "--upsampling" && i + 1 < argc)
+			upsampling = std::stof(argv[++i]);
+		else if (arg == "--scale-mask" && i + 1 < argc)
+			scaleMask = std::stod(argv[++i]);
+		else if (arg == "--inverse-scale" && i + 1 < argc)
+			inverseScale = std::stod(argv[++i]);
+		else if (arg == "--engine" && i + 1 < argc)
+			engine = std::string(argv[++i]) == "opencv" ? Rectifier::ENGINE_OPENCV : Rectifier::ENGINE_CPU;
+		else
+		{
+			std::cout << "precompute_rectification [--from-tables] [--upsampling <factor>] [--scale-mask <scale>] [--engine cpu|opencv] [--inverse-scale <scale>]" << std::endl;
+			return 1;
+		}
+	}
+
+	cv::UMat tformInd, invInd;
+	std::string cachePrefix("resources/rectification");
+	if (fromTables)
+	{
+		tformInd = readTable("resources/tform_ind1.exr", "resources/tform_ind2.exr");
+		invInd = readTable("resources/inv_ind1.exr", "resources/inv_ind2.exr");
+	}
+	else
+	{
+		cv::UMat bO2D, bE2D;
 
-	// Read LuT given by Birefractive stereo's model (http://vclab.kaist.ac.kr/siggraphasia2016p1/)
-	handle[0] = cv::imread("resources/b_o2d_1.exr", cv::IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
-	handle[1] = cv::imread("resources/b_o2d_2.exr", cv::IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
-	cv::merge(handle, bO2D);
+		// Read LuT given by Birefractive stereo's model (http://vclab.kaist.ac.kr/siggraphasia2016p1/)
+		bO2D = readTable("resources/b_o2d_1.exr", "resources/b_o2d_2.exr");
+		bE2D = readTable("resources/b_e2d_1.exr", "resources/b_e2d_2.exr");
 
-	handle[0] = cv::imread("resources/b_e2d_1.exr", cv::IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
-	handle[1] = cv::imread("resources/b_e2d_2.exr", cv::IMREAD_UNCHANGED).getUMat(cv::ACCESS_READ);
-	cv::merge(handle, bE2D);
+		// Rectification mapping via dynamic programming
+		int64 start(cv::getTickCount());
+		std::cout << "Disparity coeficient: f * baseline = " <<
+			Rectifier::buildRectification(bO2D, bE2D, tformInd, invInd, engine) << std::endl;
+		std::cout << "Dynamic programming: " << 
+			1000. * double(cv::getTickCount() - start) / cv::getTickFrequency() << " ms" << std::endl;
+		std::cout << "Reverse rectification..." << std::endl;
+		start = cv::getTickCount();
+		invInd = cv::UMat::zeros(bO2D.size(), CV_32FC2);
+		Rectifier::reverseRectification(tformInd, invInd, inverseScale, engine);
+		std::cout << "Reverse rectification: " << 
+			1000. * double(cv::getTickCount() - start) / cv::getTickFrequency() << " ms" << std::endl;
 
-	// Rectification mapping via dynamic programming
-	std::cout << "Disparity coeficient: f * baseline = " <<
-		Rectifier::buildRectification(bO2D, bE2D, tformInd, invInd) << std::endl;
-	std::cout << "Reverse rectification..." << std::endl;
-	invInd = cv::UMat::zeros(bO2D.size(), CV_32FC2);
-	Rectifier::reverseRectification(tformInd, invInd);
+		// Write the rectification tables
+		std::vector<cv::UMat> handle(2);
+		cv::split(tformInd, handle);
+		cv::imwrite("resources/tform_ind_new1.exr", handle[0]);
+		cv::imwrite("resources/tform_ind_new2.exr", handle[1]);
+		cv::split(invInd, handle);
+		cv::imwrite("resources/inv_ind_new1.exr", handle[0]);
+		cv::imwrite("resources/inv_ind_new2.exr", handle[1]);
+		cachePrefix = "resources/rectification_new";
+	}
 
-	// Write the rectification tables
-	cv::split(tformInd, handle);
-	cv::imwrite("resources/tform_ind_new1.exr", handle[0]);
-	cv::imwrite("resources/tform_ind_new2.exr", handle[1]);
-	cv::split(invInd, handle);
-	cv::imwrite("resources/inv_ind_new1.exr", handle[0]);
-	cv::imwrite("resources/inv_ind_new2.exr", handle[1]);
+	// Fixed-point tables for DepthEstimator, memory-mapped at startup
+	RectificationCache cache;
+	cache.build(tformInd, invInd, upsampling, scaleMask);
+	std::string cacheFile(RectificationCache::fileName(cachePrefix, upsampling, scaleMask));
+	if (!cache.write(cacheFile))
+	{
+		std::cout << "Failed writing " << cacheFile << std::endl;
+		return 1;
+	}
+	std::cout << "Binary tables: " << cacheFile << std::endl;
 
 	return 0;
 }
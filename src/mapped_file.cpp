@@ -0,0 +1,151 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include "mapped_file.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	const uint32_t NATIVE_BYTE_ORDER(0x01020304);
+}
+
+MappedFile::~MappedFile()
+{
+	release();
+}
+
+bool MappedFile::open(std::string const & path, size_t minSize)
+{
+	release();
+
+#ifdef _WIN32
+	HANDLE file(CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, 
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	HANDLE mapping(NULL);
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart >= LONGLONG(minSize) && fileSize.QuadPart > 0)
+	{
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	}
+	if (!mapping)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	m_mapping = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	m_fileHandle = file;
+	m_mappingHandle = mapping;
+	m_size = size_t(fileSize.QuadPart);
+#else
+	int file(::open(path.c_str(), O_RDONLY));
+	if (file < 0)
+	{
+		return false;
+	}
+	struct stat fileStat;
+	if (fstat(file, &fileStat) != 0 || size_t(fileStat.st_size) < minSize || fileStat.st_size == 0)
+	{
+		::close(file);
+		return false;
+	}
+	m_size = size_t(fileStat.st_size);
+	m_mapping = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, file, 0);
+	// The mapping remains valid once the file is closed
+	::close(file);
+	if (m_mapping == MAP_FAILED)
+	{
+		m_mapping = nullptr;
+	}
+#endif
+	if (!m_mapping)
+	{
+		release();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::release()
+{
+#ifdef _WIN32
+	if (m_mapping)
+	{
+		UnmapViewOfFile(m_mapping);
+	}
+	if (m_mappingHandle)
+	{
+		CloseHandle(m_mappingHandle);
+	}
+	if (m_fileHandle)
+	{
+		CloseHandle(m_fileHandle);
+	}
+	m_mappingHandle = nullptr;
+	m_fileHandle = nullptr;
+#else
+	if (m_mapping)
+	{
+		munmap(m_mapping, m_size);
+	}
+#endif
+	m_mapping = nullptr;
+	m_size = 0;
+}
+
+void MappedFile::sign(Signature & signature, const char (& magic)[8], uint32_t version)
+{
+	std::memcpy(signature.magic, magic, sizeof(signature.magic));
+	signature.version = version;
+	signature.byteOrder = NATIVE_BYTE_ORDER;
+}
+
+bool MappedFile::check(Signature const & signature, const char (& magic)[8], uint32_t version)
+{
+	return std::memcmp(signature.magic, magic, sizeof(signature.magic)) == 0 && 
+		signature.version == version && signature.byteOrder == NATIVE_BYTE_ORDER;
+}
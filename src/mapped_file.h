@@ -0,0 +1,122 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/* @class MappedFile
+@brief Read-only memory mapping of a whole file, for the binary files read without copy 
+(RectificationCache, DepthRecording). The mapping is valid until release or destruction.
+The files start with a Signature: a magic identifying the format, its version and a byte order marker, 
+as they are written and read in the native byte order.
+*/
+class MappedFile
+{
+public:
+	/* Beginning of a binary file */
+	struct Signature
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;
+	};
+
+	MappedFile() {}
+
+	~MappedFile();
+
+	// Not copyable, owns the mapping
+	MappedFile(MappedFile const &) = delete;
+	MappedFile & operator=(MappedFile const &) = delete;
+
+	/* @brief Map a file
+	@param path file to map
+	@param minSize smallest size of a valid file, e.g. of its header
+	@return true on success
+	*/
+	bool open(std::string const & path, size_t minSize);
+
+	/* @brief Unmap the file */
+	void release();
+
+	/* @brief Fill the signature of a file written in the native byte order
+	@param signature signature to fill
+	@param magic identifier of the format
+	@param version version of the format
+	*/
+	static void sign(Signature & signature, const char (& magic)[8], uint32_t version);
+
+	/* @brief Check the signature of a file against its format, version and the native byte order */
+	static bool check(Signature const & signature, const char (& magic)[8], uint32_t version);
+
+	/* @brief Round an offset up to a multiple of alignment */
+	static inline uint64_t alignOffset(uint64_t offset, uint64_t alignment);
+
+	inline bool empty() const;
+	inline const unsigned char * data() const;
+	inline size_t size() const;
+
+private:
+	void * m_mapping = nullptr; // Start of the mapped file
+	size_t m_size = 0;
+#ifdef _WIN32
+	void * m_fileHandle = nullptr;
+	void * m_mappingHandle = nullptr;
+#endif
+};
+
+
+inline uint64_t MappedFile::alignOffset(uint64_t offset, uint64_t alignment)
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+inline bool MappedFile::empty() const
+{
+	return m_mapping == nullptr;
+}
+
+inline const unsigned char * MappedFile::data() const
+{
+	return static_cast<const unsigned char *>(m_mapping);
+}
+
+inline size_t MappedFile::size() const
+{
+	return m_size;
+}
+#endif // MAPPEDFILE_H
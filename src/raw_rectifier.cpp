@@ -0,0 +1,287 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include "raw_rectifier.h"
+
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <climits>
+
+namespace
+{
+	// Fixed-point BT.601 coefficients of the OpenCV YUV to BGR conversions
+	const int YUV_CY(1220542), YUV_CUB(2116026), YUV_CUG(-409993), YUV_CVG(-852492), YUV_CVR(1673527), YUV_SHIFT(20);
+
+	// Channel (B: 0, G: 1, R: 2) of the first two rows of each Bayer format, from FORMAT_BAYER_RGGB
+	const int BAYER_SITES[4][4] = { { 2, 1, 1, 0 }, { 0, 1, 1, 2 }, { 1, 2, 0, 1 }, { 1, 0, 2, 1 } };
+
+	inline void yuvToBgr(int y, int u, int v, unsigned char * bgr)
+	{
+		int luma(std::max(0, y - 16) * YUV_CY + (1 << (YUV_SHIFT - 1)));
+		u -= 128;
+		v -= 128;
+		bgr[0] = cv::saturate_cast<unsigned char>((luma + YUV_CUB * u) >> YUV_SHIFT);
+		bgr[1] = cv::saturate_cast<unsigned char>((luma + YUV_CVG * v + YUV_CUG * u) >> YUV_SHIFT);
+		bgr[2] = cv::saturate_cast<unsigned char>((luma + YUV_CVR * v) >> YUV_SHIFT);
+	}
+
+	/* BGR value of the pixel (x, y) of a raw buffer, inside of the buffer */
+	template<int format>
+	inline void decode(RawRectifier::Frame const & raw, int x, int y, unsigned char * bgr)
+	{
+		switch (format)
+		{
+		case RawRectifier::FORMAT_BGR:
+		{
+			const unsigned char * p(raw.data + y * raw.step + 3 * x);
+			bgr[0] = p[0];
+			bgr[1] = p[1];
+			bgr[2] = p[2];
+			break;
+		}
+		case RawRectifier::FORMAT_YUYV:
+		{
+			const unsigned char * p(raw.data + y * raw.step + 2 * (x & ~1));
+			yuvToBgr(p[2 * (x & 1)], p[1], p[3], bgr);
+			break;
+		}
+		case RawRectifier::FORMAT_UYVY:
+		{
+			const unsigned char * p(raw.data + y * raw.step + 2 * (x & ~1));
+			yuvToBgr(p[1 + 2 * (x & 1)], p[0], p[2], bgr);
+			break;
+		}
+		case RawRectifier::FORMAT_NV12:
+		{
+			const unsigned char * uv(raw.chroma ? raw.chroma + (y / 2) * raw.chromaStep :
+				raw.data + (raw.size.height + y / 2) * raw.step);
+			yuvToBgr(raw.data[y * raw.step + x], uv[x & ~1], uv[(x & ~1) + 1], bgr);
+			break;
+		}
+		default:
+		{
+			// Bilinear demosaicing, the border copies its nearest inner pixel
+			x = std::min(std::max(x, 1), raw.size.width - 2);
+			y = std::min(std::max(y, 1), raw.size.height - 2);
+			const int * sites(BAYER_SITES[format - RawRectifier::FORMAT_BAYER_RGGB]);
+			const unsigned char * p(raw.data + y * raw.step + x);
+			const ptrdiff_t step(ptrdiff_t(raw.step));
+			int site(sites[(y & 1) * 2 + (x & 1)]);
+			bgr[site] = p[0];
+			if (site == 1)
+			{
+				bgr[sites[(y & 1) * 2 + ((x + 1) & 1)]] = (unsigned char)((p[-1] + p[1] + 1) >> 1);
+				bgr[sites[((y + 1) & 1) * 2 + (x & 1)]] = (unsigned char)((p[-step] + p[step] + 1) >> 1);
+			}
+			else
+			{
+				bgr[1] = (unsigned char)((p[-1] + p[1] + p[-step] + p[step] + 2) >> 2);
+				bgr[2 - site] = (unsigned char)((p[-step - 1] + p[-step + 1] + p[step - 1] + p[step + 1] + 2) >> 2);
+			}
+			break;
+		}
+		}
+	}
+
+	/* Convert the frame rows from top to bottom (excluded) to BGR, with the context the conversion needs.
+	Return the frame row of the first converted row */
+	int convertRows(RawRectifier::Frame const & raw, int top, int bottom, cv::Mat & converted)
+	{
+		const int width(raw.size.width), height(raw.size.height);
+		unsigned char * data(const_cast<unsigned char *>(raw.data));
+		switch (raw.format)
+		{
+		case RawRectifier::FORMAT_BGR:
+			// Read in place
+			converted = cv::Mat(bottom - top, width, CV_8UC3, data + top * raw.step, raw.step);
+			return top;
+		case RawRectifier::FORMAT_YUYV:
+		case RawRectifier::FORMAT_UYVY:
+			cv::cvtColor(cv::Mat(bottom - top, width, CV_8UC2, data + top * raw.step, raw.step), converted,
+				RawRectifier::getConversionCode(raw.format));
+			return top;
+		case RawRectifier::FORMAT_NV12:
+		{
+			// Pairs of rows share their chroma
+			int first(top & ~1), last(std::min(height, (bottom + 1) & ~1));
+			unsigned char * chroma(raw.chroma ? const_cast<unsigned char *>(raw.chroma) : data + height * raw.step);
+			size_t chromaStep(raw.chroma ? raw.chromaStep : raw.step);
+			cv::cvtColorTwoPlane(cv::Mat(last - first, width, CV_8UC1, data + first * raw.step, raw.step),
+				cv::Mat((last - first) / 2, width / 2, CV_8UC2, chroma + (first / 2) * chromaStep, chromaStep), 
+				converted, RawRectifier::getConversionCode(raw.format));
+			return first;
+		}
+		default:
+		{
+			// The demosaicing treats the first and last converted rows as borders: 
+			// convert one more row on each side inside of the frame, from an even row to keep the pattern
+			int first(std::max(0, top - 2) & ~1), last(std::min(height, std::max(bottom + 1, first + 3)));
+			cv::cvtColor(cv::Mat(last - first, width, CV_8UC1, data + first * raw.step, raw.step), converted,
+				RawRectifier::getConversionCode(raw.format));
+			return first;
+		}
+		}
+	}
+
+	template<int format>
+	void convertArea(RawRectifier::Frame const & raw, cv::Rect const & area, cv::Mat & dst)
+	{
+		for (int y(0); y < area.height; y++)
+		{
+			unsigned char * row(dst.ptr<unsigned char>(y));
+			for (int x(0); x < area.width; x++)
+			{
+				decode<format>(raw, area.x + x, area.y + y, row + 3 * x);
+			}
+		}
+	}
+}
+
+void RawRectifier::rectify(Frame const & raw, cv::Mat const & tformInd1, cv::Mat const & tformInd2, cv::Mat & imgRectified)
+{
+	CV_Assert(raw.data && tformInd1.type() == CV_16SC2 && tformInd2.type() == CV_16UC1 && 
+		tformInd1.size() == tformInd2.size());
+	CV_Assert(raw.format != FORMAT_NV12 || (raw.size.width % 2 == 0 && raw.size.height % 2 == 0));
+	CV_Assert(raw.format < FORMAT_BAYER_RGGB || raw.format > FORMAT_BAYER_GBRG || 
+		(raw.size.width > 2 && raw.size.height > 2));
+	imgRectified.create(tformInd1.size(), CV_8UC3);
+
+	// Bands of rectified rows are converted and remapped while their source rows are in cache
+	const int bandRows(64);
+	cv::parallel_for_(cv::Range(0, (imgRectified.rows + bandRows - 1) / bandRows), [&](cv::Range const & range)
+	{
+		cv::Mat converted, bandInd1;
+		for (int b(range.start); b < range.end; b++)
+		{
+			cv::Range rows(b * bandRows, std::min(imgRectified.rows, (b + 1) * bandRows));
+			cv::Mat bandRectified(imgRectified.rowRange(rows));
+
+			// Source rows of the bilinear taps
+			int top(INT_MAX), bottom(INT_MIN);
+			for (int i(rows.start); i < rows.end; i++)
+			{
+				const short * xy(tformInd1.ptr<short>(i));
+				for (int j(0); j < tformInd1.cols; j++)
+				{
+					top = std::min(top, int(xy[2 * j + 1]));
+					bottom = std::max(bottom, int(xy[2 * j + 1]));
+				}
+			}
+			top = std::max(top, 0);
+			bottom = std::min(bottom + 2, raw.size.height);
+			if (top >= bottom)
+			{
+				bandRectified.setTo(cv::Scalar::all(0));
+				continue;
+			}
+
+			// The converted rows only end where the frame does, so the constant border of the remapping is unchanged
+			int first(convertRows(raw, top, bottom, converted));
+			cv::subtract(tformInd1.rowRange(rows), cv::Scalar(0, first), bandInd1);
+			cv::remap(converted, bandRectified, bandInd1, tformInd2.rowRange(rows), cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+		}
+	});
+}
+
+void RawRectifier::convert(Frame const & raw, cv::Rect const & area, cv::Mat & dst)
+{
+	CV_Assert(raw.data && (area & cv::Rect(cv::Point(), raw.size)) == area);
+	dst.create(area.size(), CV_8UC3);
+	switch (raw.format)
+	{
+	case FORMAT_BGR:
+		convertArea<FORMAT_BGR>(raw, area, dst);
+		break;
+	case FORMAT_BAYER_RGGB:
+		convertArea<FORMAT_BAYER_RGGB>(raw, area, dst);
+		break;
+	case FORMAT_BAYER_BGGR:
+		convertArea<FORMAT_BAYER_BGGR>(raw, area, dst);
+		break;
+	case FORMAT_BAYER_GRBG:
+		convertArea<FORMAT_BAYER_GRBG>(raw, area, dst);
+		break;
+	case FORMAT_BAYER_GBRG:
+		convertArea<FORMAT_BAYER_GBRG>(raw, area, dst);
+		break;
+	case FORMAT_YUYV:
+		convertArea<FORMAT_YUYV>(raw, area, dst);
+		break;
+	case FORMAT_UYVY:
+		convertArea<FORMAT_UYVY>(raw, area, dst);
+		break;
+	case FORMAT_NV12:
+		convertArea<FORMAT_NV12>(raw, area, dst);
+		break;
+	}
+}
+
+int RawRectifier::getConversionCode(Format format)
+{
+	// OpenCV names Bayer patterns after the second and third pixels of the second row
+	switch (format)
+	{
+	case FORMAT_BAYER_RGGB:
+		return cv::COLOR_BayerBG2BGR;
+	case FORMAT_BAYER_BGGR:
+		return cv::COLOR_BayerRG2BGR;
+	case FORMAT_BAYER_GRBG:
+		return cv::COLOR_BayerGB2BGR;
+	case FORMAT_BAYER_GBRG:
+		return cv::COLOR_BayerGR2BGR;
+	case FORMAT_YUYV:
+		return cv::COLOR_YUV2BGR_YUY2;
+	case FORMAT_UYVY:
+		return cv::COLOR_YUV2BGR_UYVY;
+	case FORMAT_NV12:
+		return cv::COLOR_YUV2BGR_NV12;
+	default:
+		return -1;
+	}
+}
+
+double RawRectifier::getBytesPerPixel(Format format)
+{
+	switch (format)
+	{
+	case FORMAT_BGR:
+		return 3.;
+	case FORMAT_YUYV:
+	case FORMAT_UYVY:
+		return 2.;
+	case FORMAT_NV12:
+		return 1.5;
+	default:
+		return 1.;
+	}
+}
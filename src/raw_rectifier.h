@@ -0,0 +1,101 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#ifndef RAWRECTIFIER_H
+#define RAWRECTIFIER_H
+
+#include <opencv2/core/core.hpp>
+
+/* @class RawRectifier
+@brief Rectification of raw sensor buffers, read in place. 
+The rectified image is processed in bands of rows: only the sensor rows read by a band are demosaiced 
+or converted, into a small buffer remapped right away, so that no BGR copy of the frame is written. 
+The output is the one of cv::cvtColor (see getConversionCode) followed by cv::remap with INTER_LINEAR 
+and a constant 0 border, on the CPU.
+*/
+class RawRectifier
+{
+public:
+	/* Pixel formats of the raw buffers. Bayer patterns are named after their first two rows */
+	enum Format
+	{
+		FORMAT_BGR, // Packed 8-bit BGR
+		FORMAT_BAYER_RGGB, // 8-bit Bayer mosaics, bilinear demosaicing
+		FORMAT_BAYER_BGGR,
+		FORMAT_BAYER_GRBG,
+		FORMAT_BAYER_GBRG,
+		FORMAT_YUYV, // 4:2:2 packed Y0 U Y1 V (YUY2)
+		FORMAT_UYVY, // 4:2:2 packed U Y0 V Y1
+		FORMAT_NV12 // 4:2:0 luma plane followed by an interleaved U V plane
+	};
+
+	/* Raw sensor buffer, not owned */
+	struct Frame
+	{
+		const unsigned char * data = nullptr; // First row
+		size_t step = 0; // Bytes per row
+		cv::Size size; // Size in pixels
+		Format format = FORMAT_BGR;
+		// Chroma plane of FORMAT_NV12, right after the luma plane if null
+		const unsigned char * chroma = nullptr;
+		size_t chromaStep = 0;
+	};
+
+	/* @brief Rectify a raw buffer
+	@param raw raw buffer
+	@param tformInd1 integer part of the rectification table (CV_16SC2)
+	@param tformInd2 interpolation part of the rectification table (CV_16UC1)
+	@param imgRectified rectified image, of the size of the tables (CV_8UC3)
+	*/
+	static void rectify(Frame const & raw, cv::Mat const & tformInd1, cv::Mat const & tformInd2, cv::Mat & imgRectified);
+
+	/* @brief Convert an area of a raw buffer to BGR, e.g. to read the input image at the boundary
+	@param raw raw buffer
+	@param area area to convert, inside the buffer
+	@param dst BGR image of the size of the area (CV_8UC3)
+	*/
+	static void convert(Frame const & raw, cv::Rect const & area, cv::Mat & dst);
+
+	/* @brief cv::cvtColor conversion to BGR giving the same output as the decoding of a format
+	@param format raw pixel format
+	@return conversion code, -1 for FORMAT_BGR
+	*/
+	static int getConversionCode(Format format);
+
+	/* @brief Average number of bytes per pixel of a format */
+	static double getBytesPerPixel(Format format);
+
+private:
+	RawRectifier() {}
+};
+#endif // RAWRECTIFIER_H
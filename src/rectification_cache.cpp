@@ -0,0 +1,203 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include "rectification_cache.h"
+
+#include <opencv2/imgproc.hpp>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+	const char CACHE_MAGIC[8] = { 'U', 'R', 'G', 'B', 'D', 'L', 'U', 'T' };
+	const uint32_t CACHE_VERSION(1);
+	const uint64_t CACHE_ALIGNMENT(64);
+
+	/* Layout of one table in the file */
+	struct TableHeader
+	{
+		int32_t rows, cols, type, padding;
+		uint64_t step; // Bytes per row
+		uint64_t offset; // From the beginning of the file
+	};
+
+	/* Beginning of the file */
+	struct FileHeader
+	{
+		MappedFile::Signature signature;
+		uint32_t tableCount;
+		float upsampling;
+		double scaleMask;
+		TableHeader tables[RectificationCache::TABLE_COUNT];
+	};
+
+	// The two tables given by cv::convertMaps for CV_16SC2
+	int expectedType(int table)
+	{
+		return table % 2 == 0 ? CV_16SC2 : CV_16UC1;
+	}
+}
+
+RectificationCache::~RectificationCache()
+{
+	release();
+}
+
+void RectificationCache::build(cv::UMat const & tformInd, cv::UMat const & invInd, 
+	float upsampling, double scaleMask)
+{
+	release();
+	m_upsampling = upsampling;
+	m_scaleMask = scaleMask;
+
+	// Resize and optimise LuTs
+	cv::UMat invIndMask, invIndHandle, tformIndHandle, table1, table2;
+	cv::multiply(invInd, upsampling, invIndHandle);
+	cv::resize(invIndHandle, invIndMask, cv::Size(), scaleMask, scaleMask);
+	cv::resize(tformInd, tformIndHandle, cv::Size(), double(upsampling), double(upsampling));
+
+	cv::convertMaps(tformIndHandle, cv::noArray(), table1, table2, CV_16SC2);
+	table1.copyTo(m_tables[TABLE_TFORM1]);
+	table2.copyTo(m_tables[TABLE_TFORM2]);
+	cv::convertMaps(invIndHandle, cv::noArray(), table1, table2, CV_16SC2);
+	table1.copyTo(m_tables[TABLE_INV1]);
+	table2.copyTo(m_tables[TABLE_INV2]);
+	cv::convertMaps(invIndMask, cv::noArray(), table1, table2, CV_16SC2);
+	table1.copyTo(m_tables[TABLE_INV_MASK1]);
+	table2.copyTo(m_tables[TABLE_INV_MASK2]);
+}
+
+bool RectificationCache::open(std::string const & path, float upsampling, double scaleMask)
+{
+	release();
+	if (!m_file.open(path, sizeof(FileHeader)))
+	{
+		return false;
+	}
+
+	// Check the header against the expected version and parameters
+	FileHeader header;
+	std::memcpy(&header, m_file.data(), sizeof(FileHeader));
+	if (!MappedFile::check(header.signature, CACHE_MAGIC, CACHE_VERSION) || header.tableCount != TABLE_COUNT ||
+		std::abs(header.upsampling - upsampling) > 1e-6f || std::abs(header.scaleMask - scaleMask) > 1e-9)
+	{
+		release();
+		return false;
+	}
+
+	// Wrap the tables without copy. The mapping is read-only
+	unsigned char * data(const_cast<unsigned char *>(m_file.data()));
+	for (int t(0); t < TABLE_COUNT; t++)
+	{
+		TableHeader const & table(header.tables[t]);
+		if (table.type != expectedType(t) || table.rows <= 0 || table.cols <= 0 ||
+			table.step < uint64_t(table.cols) * CV_ELEM_SIZE(table.type) ||
+			table.offset % CACHE_ALIGNMENT != 0 || table.offset > m_file.size() ||
+			uint64_t(table.rows) * table.step > m_file.size() - table.offset)
+		{
+			release();
+			return false;
+		}
+		m_tables[t] = cv::Mat(table.rows, table.cols, table.type, data + table.offset, size_t(table.step));
+	}
+	m_upsampling = upsampling;
+	m_scaleMask = scaleMask;
+
+	return true;
+}
+
+bool RectificationCache::write(std::string const & path) const
+{
+	if (empty())
+	{
+		return false;
+	}
+
+	FileHeader header;
+	std::memset(&header, 0, sizeof(FileHeader));
+	MappedFile::sign(header.signature, CACHE_MAGIC, CACHE_VERSION);
+	header.tableCount = TABLE_COUNT;
+	header.upsampling = m_upsampling;
+	header.scaleMask = m_scaleMask;
+
+	uint64_t offset(MappedFile::alignOffset(sizeof(FileHeader), CACHE_ALIGNMENT));
+	for (int t(0); t < TABLE_COUNT; t++)
+	{
+		TableHeader & table(header.tables[t]);
+		table.rows = m_tables[t].rows;
+		table.cols = m_tables[t].cols;
+		table.type = m_tables[t].type();
+		table.step = uint64_t(m_tables[t].cols) * m_tables[t].elemSize();
+		table.offset = offset;
+		offset = MappedFile::alignOffset(offset + table.step * uint64_t(table.rows), CACHE_ALIGNMENT);
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		return false;
+	}
+	const char padding[CACHE_ALIGNMENT] = {};
+	file.write(reinterpret_cast<const char *>(&header), sizeof(FileHeader));
+	uint64_t written(sizeof(FileHeader));
+	for (int t(0); t < TABLE_COUNT; t++)
+	{
+		file.write(padding, std::streamsize(header.tables[t].offset - written));
+		for (int i(0); i < m_tables[t].rows; i++)
+		{
+			file.write(m_tables[t].ptr<char>(i), std::streamsize(header.tables[t].step));
+		}
+		written = header.tables[t].offset + header.tables[t].step * uint64_t(header.tables[t].rows);
+	}
+
+	return bool(file.flush());
+}
+
+void RectificationCache::release()
+{
+	for (int t(0); t < TABLE_COUNT; t++)
+	{
+		m_tables[t].release();
+	}
+	m_file.release();
+}
+
+std::string RectificationCache::fileName(std::string const & prefix, float upsampling, double scaleMask)
+{
+	char suffix[64];
+	std::snprintf(suffix, sizeof(suffix), "_u%g_m%g.bin", double(upsampling), scaleMask);
+	return prefix + suffix;
+}
@@ -0,0 +1,142 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#ifndef RECTIFICATIONCACHE_H
+#define RECTIFICATIONCACHE_H
+
+#include <opencv2/core/core.hpp>
+#include <string>
+
+#include "mapped_file.h"
+
+/* @class RectificationCache
+@brief Fixed-point rectification tables ready for cv::remap, as used by DepthEstimator.
+The tables are either converted from the floating point tables (CV_32FC2) 
+or memory-mapped from a binary file written by precompute_rectification. 
+In the latter case, the tables are views on the mapping and no copy nor conversion happens at loading.
+The binary file holds a header with a version, the upsampling and mask scale the tables were built for 
+and the layout of the six tables, followed by the raw table data, each aligned to 64 bytes. 
+It is written and read in the native byte order, a marker in the header rejects files from another order.
+*/
+class RectificationCache
+{
+public:
+	/* Tables held by the cache, in the order they are stored */
+	enum Table
+	{
+		TABLE_TFORM1, TABLE_TFORM2, // Rectification (CV_16SC2 and CV_16UC1)
+		TABLE_INV1, TABLE_INV2, // Reverse rectification
+		TABLE_INV_MASK1, TABLE_INV_MASK2, // Reverse rectification at the mask scale
+		TABLE_COUNT
+	};
+
+	RectificationCache() {}
+
+	~RectificationCache();
+
+	// Not copyable, the tables may point to the mapping
+	RectificationCache(RectificationCache const &) = delete;
+	RectificationCache & operator=(RectificationCache const &) = delete;
+
+	/* @brief Convert floating point tables, as done previously in the DepthEstimator constructor
+	@param tformInd rectification remapping table (CV_32FC2)
+	@param invInd table to reverse rectification (CV_32FC2)
+	@param upsampling upsampling of the rectified image
+	@param scaleMask scale of the disparity map before masking
+	*/
+	void build(cv::UMat const & tformInd, cv::UMat const & invInd, float upsampling, double scaleMask);
+
+	/* @brief Memory-map a binary cache. Fails if the file is missing, from another version 
+	or built for other parameters
+	@param path binary cache file
+	@param upsampling expected upsampling
+	@param scaleMask expected scale of the disparity map before masking
+	@return true if the tables are available
+	*/
+	bool open(std::string const & path, float upsampling, double scaleMask);
+
+	/* @brief Write the tables to a binary cache
+	@param path binary cache file
+	@return true on success
+	*/
+	bool write(std::string const & path) const;
+
+	/* @brief Unmap or free the tables */
+	void release();
+
+	/* @brief Name of the cache file for a set of parameters
+	@param prefix path and beginning of the name
+	@param upsampling upsampling of the rectified image
+	@param scaleMask scale of the disparity map before masking
+	*/
+	static std::string fileName(std::string const & prefix, float upsampling, double scaleMask);
+
+	inline bool empty() const;
+	inline bool isMapped() const;
+	inline float getUpsampling() const;
+	inline double getScaleMask() const;
+	inline cv::Mat const & getTable(Table table) const;
+
+private:
+	cv::Mat m_tables[TABLE_COUNT];
+	float m_upsampling = 1.f;
+	double m_scaleMask = 0.3;
+
+	MappedFile m_file; // Empty if the tables are owned
+};
+
+bool RectificationCache::empty() const
+{
+	return m_tables[TABLE_TFORM1].empty();
+}
+
+bool RectificationCache::isMapped() const
+{
+	return !m_file.empty();
+}
+
+float RectificationCache::getUpsampling() const
+{
+	return m_upsampling;
+}
+
+double RectificationCache::getScaleMask() const
+{
+	return m_scaleMask;
+}
+
+cv::Mat const & RectificationCache::getTable(Table table) const
+{
+	return m_tables[table];
+}
+#endif // RECTIFICATIONCACHE_H
@@ -34,12 +34,17 @@ SOFTWARE.
 #include "rectifier.h"
 
 #include <opencv2/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
 
 // squared l2 norm between the cv::Point2f a and [bx, by]
 #define POINTS_DIFF(a,bx,by) ((a.x-bx)*(a.x-bx)+(a.y-by)*(a.y-by))
 
 float Rectifier::buildRectification(cv::UMat const & bO2D, cv::UMat const & bE2D,
-	cv::UMat & tformInd, cv::UMat & invInd)
+	cv::UMat & tformInd, cv::UMat & invInd, Engine engine)
 {
 	// Add thirsty rows to prevent the image from being cropped
 	tformInd = cv::UMat::zeros(cv::Size(bO2D.cols + 30, bO2D.rows), CV_32FC2);
@@ -61,6 +66,13 @@ float Rectifier::buildRectification(cv::UMat const & bO2D, cv::UMat const & bE2D
 	identityGrid.getUMat(cv::ACCESS_READ).copyTo(tformInd.col(0));
 
 	// Dynamic programming rectification
+	if (engine == ENGINE_CPU)
+	{
+		cv::Mat tformIndMat(tformInd.getMat(cv::ACCESS_RW));
+		columnRecurrence(bO2E.getMat(cv::ACCESS_READ), tformIndMat);
+		return baseline;
+	}
+
 	for (int j(1); j < tformInd.cols; j++)
 	{
 		// Get the current column local disparity to be mapped to horizontal
@@ -73,8 +85,134 @@ float Rectifier::buildRectification(cv::UMat const & bO2D, cv::UMat const & bE2D
 	return baseline;
 }
 
-void Rectifier::reverseRectification(cv::UMat const & tformInd, cv::UMat & invInd, double scale)
+namespace
+{
+	/* Bilinear lookup of a CV_32FC2 table at (x, y), as cv::remap with INTER_LINEAR and a constant 0 border */
+	inline cv::Point2f lookup(cv::Mat const & table, float x, float y)
+	{
+		int X(cvRound(x * cv::INTER_TAB_SIZE)), Y(cvRound(y * cv::INTER_TAB_SIZE));
+		int ix(X >> cv::INTER_BITS), iy(Y >> cv::INTER_BITS);
+		float fx(float(X & (cv::INTER_TAB_SIZE - 1)) * (1.f / cv::INTER_TAB_SIZE)),
+			fy(float(Y & (cv::INTER_TAB_SIZE - 1)) * (1.f / cv::INTER_TAB_SIZE));
+		float w[4] = { (1.f - fy) * (1.f - fx), (1.f - fy) * fx, fy * (1.f - fx), fy * fx };
+
+		cv::Point2f v[4];
+		for (int k(0); k < 4; k++)
+		{
+			int nx(ix + k % 2), ny(iy + k / 2);
+			if (nx >= 0 && ny >= 0 && nx < table.cols && ny < table.rows)
+			{
+				v[k] = table.at<cv::Point2f>(ny, nx);
+			}
+		}
+
+		return cv::Point2f(v[0].x * w[0] + v[1].x * w[1] + v[2].x * w[2] + v[3].x * w[3],
+			v[0].y * w[0] + v[1].y * w[1] + v[2].y * w[2] + v[3].y * w[3]);
+	}
+}
+
+void Rectifier::columnRecurrence(cv::Mat const & bO2E, cv::Mat & tformInd)
 {
+	CV_Assert(bO2E.type() == CV_32FC2 && tformInd.type() == CV_32FC2);
+	const int lanes(4);
+
+	cv::parallel_for_(cv::Range(0, (tformInd.rows + lanes - 1) / lanes), [&](cv::Range const & range)
+	{
+		for (int group(range.start); group < range.end; group++)
+		{
+			int i(group * lanes);
+			if (i + lanes > tformInd.rows)
+			{
+				// Remaining rows
+				for (; i < tformInd.rows; i++)
+				{
+					cv::Point2f * row(tformInd.ptr<cv::Point2f>(i));
+					for (int j(1); j < tformInd.cols; j++)
+					{
+						row[j] = row[j - 1] + lookup(bO2E, row[j - 1].x, row[j - 1].y);
+					}
+				}
+				continue;
+			}
+
+			cv::Point2f * rows[lanes];
+			for (int l(0); l < lanes; l++)
+			{
+				rows[l] = tformInd.ptr<cv::Point2f>(i + l);
+			}
+
+#if CV_SIMD128
+			// One row per lane, the table is read with lookups at the fixed-point coordinates
+			const float * table(bO2E.ptr<float>());
+			const cv::v_float32x4 tabScale(cv::v_setall_f32(float(cv::INTER_TAB_SIZE))), 
+				invTabScale(cv::v_setall_f32(1.f / cv::INTER_TAB_SIZE)), one(cv::v_setall_f32(1.f)),
+				zero(cv::v_setall_f32(0.f));
+			const cv::v_int32x4 tabMask(cv::v_setall_s32(cv::INTER_TAB_SIZE - 1)), 
+				zeroInt(cv::v_setall_s32(0)), lastX(cv::v_setall_s32(bO2E.cols - 1)), 
+				lastY(cv::v_setall_s32(bO2E.rows - 1)), oneInt(cv::v_setall_s32(1)), 
+				step(cv::v_setall_s32(int(bO2E.step1())));
+			float x[lanes], y[lanes];
+			for (int l(0); l < lanes; l++)
+			{
+				x[l] = rows[l][0].x;
+				y[l] = rows[l][0].y;
+			}
+			cv::v_float32x4 posX(cv::v_load(x)), posY(cv::v_load(y));
+
+			for (int j(1); j < tformInd.cols; j++)
+			{
+				cv::v_int32x4 X(cv::v_round(posX * tabScale)), Y(cv::v_round(posY * tabScale));
+				cv::v_int32x4 ix(X >> cv::INTER_BITS), iy(Y >> cv::INTER_BITS);
+				cv::v_float32x4 fx(cv::v_cvt_f32(X & tabMask) * invTabScale), 
+					fy(cv::v_cvt_f32(Y & tabMask) * invTabScale);
+				cv::v_float32x4 w[4] = { (one - fy) * (one - fx), (one - fy) * fx, fy * (one - fx), fy * fx };
+
+				cv::v_float32x4 sumX, sumY;
+				for (int k(0); k < 4; k++)
+				{
+					cv::v_int32x4 nx(k % 2 ? ix + oneInt : ix), ny(k / 2 ? iy + oneInt : iy);
+					cv::v_float32x4 inside(cv::v_reinterpret_as_f32((nx >= zeroInt) & (nx <= lastX) &
+						(ny >= zeroInt) & (ny <= lastY)));
+					cv::v_int32x4 index(cv::v_min(cv::v_max(ny, zeroInt), lastY) * step +
+						(cv::v_min(cv::v_max(nx, zeroInt), lastX) << 1));
+					cv::v_float32x4 valueX(cv::v_select(inside, cv::v_lut(table, index), zero)),
+						valueY(cv::v_select(inside, cv::v_lut(table + 1, index), zero));
+					sumX = k ? sumX + valueX * w[k] : valueX * w[k];
+					sumY = k ? sumY + valueY * w[k] : valueY * w[k];
+				}
+				posX = posX + sumX;
+				posY = posY + sumY;
+
+				cv::v_store(x, posX);
+				cv::v_store(y, posY);
+				for (int l(0); l < lanes; l++)
+				{
+					rows[l][j] = cv::Point2f(x[l], y[l]);
+				}
+			}
+#else
+			for (int l(0); l < lanes; l++)
+			{
+				for (int j(1); j < tformInd.cols; j++)
+				{
+					rows[l][j] = rows[l][j - 1] + lookup(bO2E, rows[l][j - 1].x, rows[l][j - 1].y);
+				}
+			}
+#endif
+		}
+	});
+}
+
+void Rectifier::reverseRectification(cv::UMat const & tformInd, cv::UMat & invInd, double scale, Engine engine)
+{
+	if (engine == ENGINE_CPU)
+	{
+		cv::Mat invIndMat(invInd.size(), CV_32FC2);
+		reverseScatter(tformInd.getMat(cv::ACCESS_READ), invIndMat, scale);
+		invIndMat.copyTo(invInd);
+		return;
+	}
+
 	cv::UMat tformIndGreater;
 	cv::resize(tformInd, tformIndGreater, cv::Size(), scale, scale);
 	cv::multiply(tformIndGreater, scale, tformIndGreater);
@@ -122,3 +260,174 @@ void Rectifier::reverseRectification(cv::UMat const & tformInd, cv::UMat & invIn
 	cv::multiply(invInd, 1. / scale, invInd);
 	cv::subtract(invInd, cv::Scalar(1.f, 1.f), invInd);
 }
+
+namespace
+{
+	/* Samples of cv::resize with INTER_LINEAR along one axis:
+	dst[d] = src[first[d]] * (1 - weight[d]) + src[second[d]] * weight[d] */
+	struct LinearAxis
+	{
+		std::vector<int> first, second;
+		std::vector<float> weight;
+	};
+
+	LinearAxis linearAxis(int srcSize, int dstSize, double scale)
+	{
+		LinearAxis axis;
+		axis.first.resize(dstSize);
+		axis.second.resize(dstSize);
+		axis.weight.resize(dstSize);
+		for (int d(0); d < dstSize; d++)
+		{
+			float f(float((d + 0.5) * scale - 0.5));
+			int s(cvFloor(f));
+			f -= float(s);
+			if (s < 0)
+			{
+				s = 0;
+				f = 0.f;
+			}
+			if (s >= srcSize - 1)
+			{
+				s = srcSize - 1;
+				f = 0.f;
+			}
+			axis.first[d] = s;
+			axis.second[d] = std::min(s + 1, srcSize - 1);
+			axis.weight[d] = f;
+		}
+		return axis;
+	}
+
+	// Candidates ordered by distance, then by index in the scan order. 
+	// Distances are positive, their bits sort as the floats
+	inline uint64_t packCandidate(float diff, uint32_t index)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &diff, sizeof(bits));
+		return (uint64_t(bits) << 32) | index;
+	}
+
+	inline void atomicMin(std::atomic<uint64_t> & target, uint64_t candidate)
+	{
+		uint64_t current(target.load(std::memory_order_relaxed));
+		while (candidate < current && 
+			!target.compare_exchange_weak(current, candidate, std::memory_order_relaxed))
+		{
+		}
+	}
+}
+
+void Rectifier::reverseScatter(cv::Mat const & tformInd, cv::Mat & invInd, double scale)
+{
+	CV_Assert(tformInd.type() == CV_32FC2 && invInd.type() == CV_32FC2);
+
+	// Upsampled tformInd, as cv::resize(tformInd, ., cv::Size(), scale, scale), interpolated on the fly
+	cv::Size upSize(cvRound(tformInd.cols * scale), cvRound(tformInd.rows * scale));
+	CV_Assert(uint64_t(upSize.width) * uint64_t(upSize.height) < uint64_t(UINT32_MAX));
+	LinearAxis upX(linearAxis(tformInd.cols, upSize.width, 1. / scale)),
+		upY(linearAxis(tformInd.rows, upSize.height, 1. / scale));
+
+	// Upsampled inverse, only at the pixels read when resizing it to the size of invInd
+	cv::Size invUpSize(int(invInd.cols * scale), int(invInd.rows * scale));
+	LinearAxis downX(linearAxis(invUpSize.width, invInd.cols, 1. / (double(invInd.cols) / invUpSize.width))),
+		downY(linearAxis(invUpSize.height, invInd.rows, 1. / (double(invInd.rows) / invUpSize.height)));
+	std::vector<int> slotX(invUpSize.width, -1), slotY(invUpSize.height, -1);
+	int countX(0), countY(0);
+	for (int d(0); d < invInd.cols; d++)
+	{
+		slotX[downX.first[d]] = slotX[downX.first[d]] < 0 ? countX++ : slotX[downX.first[d]];
+		slotX[downX.second[d]] = slotX[downX.second[d]] < 0 ? countX++ : slotX[downX.second[d]];
+	}
+	for (int d(0); d < invInd.rows; d++)
+	{
+		slotY[downY.first[d]] = slotY[downY.first[d]] < 0 ? countY++ : slotY[downY.first[d]];
+		slotY[downY.second[d]] = slotY[downY.second[d]] < 0 ? countY++ : slotY[downY.second[d]];
+	}
+
+	// Best candidate of each kept pixel. As bestDiff, only distances below 1 are accepted
+	const uint64_t noCandidate(packCandidate(1.f, 0));
+	std::vector<std::atomic<uint64_t>> best(size_t(countX) * size_t(countY));
+	for (size_t k(0); k < best.size(); k++)
+	{
+		best[k].store(noCandidate, std::memory_order_relaxed);
+	}
+
+	// Every point of the upsampled tformInd competes for the pixels around where it points
+	const float upScale(static_cast<float>(scale));
+	cv::parallel_for_(cv::Range(1, upSize.height - 1), [&](cv::Range const & range)
+	{
+		for (int i(range.start); i < range.end; i++)
+		{
+			const cv::Point2f * row0(tformInd.ptr<cv::Point2f>(upY.first[i])), 
+				* row1(tformInd.ptr<cv::Point2f>(upY.second[i]));
+			const float beta(upY.weight[i]);
+
+			for (int j(1); j < upSize.width - 1; j++)
+			{
+				const int x0(upX.first[j]), x1(upX.second[j]);
+				const float alpha(upX.weight[j]);
+				cv::Point2f currPos(
+					((row0[x0].x * (1.f - alpha) + row0[x1].x * alpha) * (1.f - beta) + 
+						(row1[x0].x * (1.f - alpha) + row1[x1].x * alpha) * beta) * upScale,
+					((row0[x0].y * (1.f - alpha) + row0[x1].y * alpha) * (1.f - beta) + 
+						(row1[x0].y * (1.f - alpha) + row1[x1].y * alpha) * beta) * upScale);
+				int currX(cvRound(currPos.x)), currY(cvRound(currPos.y));
+
+				// As the original implementation, the boundary is not used
+				if (currX > 1 && currY > 1 && currX < invUpSize.width - 1 && currY < invUpSize.height - 1)
+				{
+					uint32_t index(uint32_t(i) * uint32_t(upSize.width) + uint32_t(j));
+					for (int y(currY - 1); y <= currY + 1; y++)
+					{
+						if (slotY[y] < 0)
+						{
+							continue;
+						}
+						for (int x(currX - 1); x <= currX + 1; x++)
+						{
+							float diff = POINTS_DIFF(currPos, float(x), float(y)) / 2;
+							if (slotX[x] >= 0 && diff < 1.f)
+							{
+								atomicMin(best[size_t(slotY[y]) * countX + slotX[x]], packCandidate(diff, index));
+							}
+						}
+					}
+				}
+			}
+		}
+	});
+
+	// Resize to the size of invInd and restore the scale
+	const float invScale(float(1. / scale));
+	cv::parallel_for_(cv::Range(0, invInd.rows), [&](cv::Range const & range)
+	{
+		for (int dy(range.start); dy < range.end; dy++)
+		{
+			cv::Point2f * dst(invInd.ptr<cv::Point2f>(dy));
+			const float beta(downY.weight[dy]);
+			for (int dx(0); dx < invInd.cols; dx++)
+			{
+				// Inverse of the four neighbours, [0, 0] without candidate
+				cv::Point2f v[4];
+				for (int k(0); k < 4; k++)
+				{
+					uint64_t candidate(best[size_t(slotY[k / 2 ? downY.second[dy] : downY.first[dy]]) * countX +
+						slotX[k % 2 ? downX.second[dx] : downX.first[dx]]].load(std::memory_order_relaxed));
+					if (candidate < noCandidate)
+					{
+						uint32_t index(uint32_t(candidate & UINT32_MAX));
+						v[k] = cv::Point2f(float(index % uint32_t(upSize.width)), float(index / uint32_t(upSize.width)));
+					}
+				}
+
+				const float alpha(downX.weight[dx]);
+				dst[dx] = cv::Point2f(
+					((v[0].x * (1.f - alpha) + v[1].x * alpha) * (1.f - beta) +
+						(v[2].x * (1.f - alpha) + v[3].x * alpha) * beta) * invScale - 1.f,
+					((v[0].y * (1.f - alpha) + v[1].y * alpha) * (1.f - beta) +
+						(v[2].y * (1.f - alpha) + v[3].y * alpha) * beta) * invScale - 1.f);
+			}
+		}
+	});
+}
@@ -42,27 +42,58 @@ SOFTWARE.
 class Rectifier
 {
 public:
+	/* Implementations of buildRectification and reverseRectification */
+	enum Engine
+	{
+		ENGINE_OPENCV, // Original implementation: per-column cv:: calls and sequential scatter
+		ENGINE_CPU // Multithreaded single passes, see buildRectification and reverseRectification
+	};
+
 	/* @brief Build rectification mapping tables and their inverts via dynamic programming.
 	Type should be CV_32F2 for all input and outputs
 	@param bO2D baseline from o-ray to d-ray (given by Baek et al.'s code)
 	@param bE2D the baseline from e-ray to d-ray (given by Baek et al.'s code)
 	@param tformInd component of the rectification remapping table
 	@param invInd component of the table to reverse rectification
+	@param engine implementation of the dynamic programming
 	*/
 	static float buildRectification(cv::UMat const & bO2D, cv::UMat const & bE2D,
-		cv::UMat & tformInd, cv::UMat & invInd);
+		cv::UMat & tformInd, cv::UMat & invInd, Engine engine = ENGINE_CPU);
 
 	/* @brief Generic function to reverse continuous remapping.
 	Does not use explicit nearest neighbours search
-	as the local consistency of the rectification makes it possible without
+	as the local consistency of the rectification makes it possible without.
+	With ENGINE_OPENCV, the competition between the points of tformInd for an inverse pixel 
+	depends on the scan order. ENGINE_CPU keeps, for every inverse pixel, the closest point 
+	(the first in scan order for ties), with atomic updates from all threads. It interpolates 
+	the upsampled tformInd on the fly and only stores the upsampled inverse pixels read by 
+	the final downsampling, so that memory does not grow with scale * scale
 	@param tformInd remapping to reverse (CV_32FC2)
 	@param invInd output inverse. Needs to be initialised to the desired size (CV_32FC2)
 	@param scale for smoothness. Prevents artifacts as no interpolation is used
+	@param engine implementation
 	*/
 	static void reverseRectification(cv::UMat const & tformInd, 
-		cv::UMat & invInd, double scale = 6.);
+		cv::UMat & invInd, double scale = 6., Engine engine = ENGINE_CPU);
 
 private:
 	Rectifier() {}
+
+	/* @brief Column recurrence tformInd(:, j) = tformInd(:, j - 1) + bO2E(tformInd(:, j - 1)) 
+	for all the columns but the first, already initialised. 
+	Each row only depends on itself: rows are processed by groups of four SIMD lanes in parallel. 
+	The bilinear lookup reproduces cv::remap on the CPU: coordinates rounded to 1/INTER_TAB_SIZE 
+	and 0 outside of bO2E
+	@param bO2E normalised o-ray to e-ray baseline (CV_32FC2)
+	@param tformInd rectification remapping table (CV_32FC2)
+	*/
+	static void columnRecurrence(cv::Mat const & bO2E, cv::Mat & tformInd);
+
+	/* @brief ENGINE_CPU implementation of reverseRectification
+	@param tformInd remapping to reverse (CV_32FC2)
+	@param invInd output inverse, of the final size (CV_32FC2)
+	@param scale upsampling of the search
+	*/
+	static void reverseScatter(cv::Mat const & tformInd, cv::Mat & invInd, double scale);
 };
 #endif // RECTIFIER_H
\ No newline at end of file
@@ -0,0 +1,158 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include "scratch_arena.h"
+
+#include <algorithm>
+#include <numeric>
+
+int ScratchArena::add(int type, cv::Size size, int first, int last)
+{
+	CV_Assert(CV_MAT_DEPTH(type) < m_depthCount && first <= last);
+	Buffer buffer = { type, size, first, last, 0 };
+	m_buffers.push_back(buffer);
+	return int(m_buffers.size()) - 1;
+}
+
+void ScratchArena::clear()
+{
+	m_buffers.clear();
+	plan();
+}
+
+size_t ScratchArena::elementCount(Buffer const & buffer)
+{
+	return size_t(buffer.size.area()) * CV_MAT_CN(buffer.type);
+}
+
+void ScratchArena::plan()
+{
+	release();
+	std::fill(m_elements, m_elements + m_depthCount, size_t(0));
+
+	// Largest buffers first, each at the lowest offset 
+	// not overlapping the placed buffers of the same depth live at the same time
+	std::vector<int> order(m_buffers.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [this](int a, int b) 
+		{ return elementCount(m_buffers[a]) > elementCount(m_buffers[b]); });
+
+	std::vector<int> placed;
+	for (size_t i(0); i < order.size(); i++)
+	{
+		Buffer & buffer(m_buffers[order[i]]);
+		int depth(CV_MAT_DEPTH(buffer.type));
+		size_t alignment(m_alignment / CV_ELEM_SIZE1(buffer.type)), count(elementCount(buffer));
+
+		// Placed buffers sharing the depth and the live range, by offset
+		std::vector<int> conflicts;
+		for (size_t j(0); j < placed.size(); j++)
+		{
+			Buffer const & other(m_buffers[placed[j]]);
+			if (CV_MAT_DEPTH(other.type) == depth && other.first <= buffer.last && buffer.first <= other.last)
+				conflicts.push_back(placed[j]);
+		}
+		std::sort(conflicts.begin(), conflicts.end(), [this](int a, int b) 
+			{ return m_buffers[a].offset < m_buffers[b].offset; });
+
+		// First gap large enough
+		size_t offset(0);
+		for (size_t j(0); j < conflicts.size(); j++)
+		{
+			Buffer const & other(m_buffers[conflicts[j]]);
+			if (offset + count <= other.offset)
+				break;
+			offset = std::max(offset, (other.offset + elementCount(other) + alignment - 1) / alignment * alignment);
+		}
+		buffer.offset = offset;
+		m_elements[depth] = std::max(m_elements[depth], offset + count);
+		placed.push_back(order[i]);
+	}
+}
+
+void ScratchArena::allocate()
+{
+	if (m_allocated)
+		return;
+	for (int depth(0); depth < m_depthCount; depth++)
+	{
+		if (m_elements[depth] > 0)
+			m_memory[depth].create(1, int(m_elements[depth]), CV_MAKETYPE(depth, 1));
+	}
+	m_allocated = true;
+}
+
+void ScratchArena::release()
+{
+	for (int depth(0); depth < m_depthCount; depth++)
+	{
+		m_memory[depth].release();
+	}
+	m_allocated = false;
+}
+
+void ScratchArena::bind(int index, cv::Size size, cv::UMat & buffer) const
+{
+	CV_Assert(m_allocated && index >= 0 && index < int(m_buffers.size()));
+	Buffer const & declared(m_buffers[index]);
+	CV_Assert(size.width <= declared.size.width && size.height <= declared.size.height);
+	if (size.area() <= 0)
+	{
+		buffer.release();
+		return;
+	}
+
+	// A single row is continuous: its columns reshape to the image
+	int cn(CV_MAT_CN(declared.type)), begin(int(declared.offset));
+	buffer = m_memory[CV_MAT_DEPTH(declared.type)].colRange(begin, begin + size.area() * cn).reshape(cn, size.height);
+}
+
+size_t ScratchArena::getBytes() const
+{
+	size_t bytes(0);
+	for (int depth(0); depth < m_depthCount; depth++)
+	{
+		bytes += m_elements[depth] * CV_ELEM_SIZE1(depth);
+	}
+	return bytes;
+}
+
+size_t ScratchArena::getUnaliasedBytes() const
+{
+	size_t bytes(0);
+	for (size_t i(0); i < m_buffers.size(); i++)
+	{
+		bytes += elementCount(m_buffers[i]) * CV_ELEM_SIZE1(m_buffers[i].type);
+	}
+	return bytes;
+}
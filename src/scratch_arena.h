@@ -0,0 +1,120 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#ifndef SCRATCHARENA_H
+#define SCRATCHARENA_H
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+/* @class ScratchArena
+@brief Memory of temporary images whose live ranges are known in advance. 
+Each buffer is declared with its largest size and the first and last steps it is live in, 
+then the buffers are placed so that those of the same depth with disjoint live ranges share memory: 
+one allocation per depth, made once, and views bound on it without allocation.
+A view only holds valid data from its first step to its last one. 
+Different arenas never share memory: stages running concurrently each use their own.
+*/
+class ScratchArena
+{
+public:
+	ScratchArena() {}
+
+	/* @brief Declare a buffer
+	@param type type of the buffer
+	@param size largest size of the buffer
+	@param first first step the buffer is live in
+	@param last last step the buffer is live in
+	@return index of the buffer, for bind
+	*/
+	int add(int type, cv::Size size, int first, int last);
+
+	/* @brief Remove the buffers and release the memory */
+	void clear();
+
+	/* @brief Place the declared buffers, releasing the memory of the previous placement */
+	void plan();
+
+	/* @brief Allocate the memory of the placed buffers, if not allocated yet. 
+	Views bound on the previous memory keep it alive until they are bound again
+	*/
+	void allocate();
+
+	/* @brief Release the memory, the placement is kept for the next allocate */
+	void release();
+
+	/* @brief Set a buffer as a view on the memory, without allocation
+	@param index buffer returned by add
+	@param size size of the view, at most the declared size
+	@param buffer the view
+	*/
+	void bind(int index, cv::Size size, cv::UMat & buffer) const;
+
+	/* @brief Get whether the memory is allocated */
+	inline bool isAllocated() const;
+
+	/* @brief Get the bytes of the placed buffers, shared memory counted once */
+	size_t getBytes() const;
+
+	/* @brief Get the bytes the declared buffers would take without sharing memory */
+	size_t getUnaliasedBytes() const;
+
+private:
+	/* Declared buffer and its place in the memory of its depth */
+	struct Buffer
+	{
+		int type;
+		cv::Size size;
+		int first, last; // Live range, in steps
+		size_t offset; // Offset in elements of the depth
+	};
+
+	/* Number of elements of the depth of a buffer */
+	static size_t elementCount(Buffer const & buffer);
+
+	// Offsets are aligned on this many bytes, as the rows of cv::UMat allocations
+	static const size_t m_alignment = 64;
+	static const int m_depthCount = 8;
+
+	std::vector<Buffer> m_buffers;
+	size_t m_elements[m_depthCount] = {}; // Elements of the memory of each depth
+	cv::UMat m_memory[m_depthCount]; // One row of elements per depth
+	bool m_allocated = false;
+};
+
+
+inline bool ScratchArena::isAllocated() const
+{
+	return m_allocated;
+}
+#endif // SCRATCHARENA_H
@@ -0,0 +1,269 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include "sparse_bilateral_filter.h"
+
+#include <opencv2/core/hal/intrin.hpp>
+#include <cmath>
+#include <cstdlib>
+
+SparseBilateralFilter::SparseBilateralFilter(int radius, float sigmaSpace, float sigmaGuide) :
+	m_radius(radius),
+	m_guideCoeff(-0.5f / (sigmaGuide * sigmaGuide))
+{
+	float gaussSpaceCoeff(-0.5f / (sigmaSpace * sigmaSpace));
+
+	// Fill-in the disk
+	for (int i(-m_radius); i <= m_radius; i++)
+	{
+		for (int j(-m_radius); j <= m_radius; j++)
+		{
+			float r(std::sqrt(float(i) * i + float(j) * j));
+			if (r > m_radius)
+				continue;
+			m_spaceWeight.push_back(std::exp(r * r * gaussSpaceCoeff));
+			m_neighbours.push_back(cv::Point(j, i));
+		}
+	}
+
+	// The colour difference is a sum of three absolute 8-bit differences
+	m_guideWeight.resize(3 * 255 + 1);
+	for (int diff(0); diff <= 3 * 255; diff++)
+	{
+		m_guideWeight[diff] = std::exp(float(diff * diff) * m_guideCoeff);
+	}
+}
+
+std::vector<int> SparseBilateralFilter::getOffsets(size_t step, int channels) const
+{
+	std::vector<int> offsets(m_neighbours.size());
+	for (size_t k(0); k < m_neighbours.size(); k++)
+	{
+		offsets[k] = int((m_neighbours[k].y * step + m_neighbours[k].x) * channels);
+	}
+	return offsets;
+}
+
+void SparseBilateralFilter::run(cv::Mat const & src, cv::Mat const & guide, cv::Mat & dst, int outlierThresh)
+{
+	setGuide(src, guide);
+	dst.create(src.size(), CV_8UC1);
+	dst.setTo(0);
+	cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range & range)
+	{
+		filterRows(src, guide, dst, range, outlierThresh);
+	});
+}
+
+void SparseBilateralFilter::setGuide(cv::Mat const & src, cv::Mat const & guide)
+{
+	CV_Assert(src.type() == CV_8UC1 && guide.type() == CV_8UC3 && src.size() == guide.size());
+	const int cols(src.cols);
+
+	// Offsets in bytes of the neighbours
+	m_ofs1.resize(m_neighbours.size());
+	m_ofs3.resize(m_neighbours.size());
+	m_ofsPlanar.resize(m_neighbours.size());
+	for (size_t k(0); k < m_neighbours.size(); k++)
+	{
+		m_ofs1[k] = int(m_neighbours[k].y * src.step + m_neighbours[k].x);
+		m_ofs3[k] = int(m_neighbours[k].y * guide.step + m_neighbours[k].x * 3);
+		m_ofsPlanar[k] = m_neighbours[k].y * 3 * cols + m_neighbours[k].x;
+	}
+
+	// Vector loads of the neighbour colours without deinterleaving each time
+	m_planar.resize(size_t(src.rows) * cols * 3);
+	cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range & range)
+	{
+		for (int y(range.start); y < range.end; y++)
+		{
+			const uchar * guideRow(guide.ptr<uchar>(y));
+			uchar * planarRow(&m_planar[size_t(y) * cols * 3]);
+			for (int x(0); x < cols; x++)
+			{
+				planarRow[x] = guideRow[3 * x];
+				planarRow[x + cols] = guideRow[3 * x + 1];
+				planarRow[x + 2 * cols] = guideRow[3 * x + 2];
+			}
+		}
+	});
+}
+
+void SparseBilateralFilter::filterRows(cv::Mat const & src, cv::Mat const & guide, cv::Mat & dst, 
+	cv::Range rows, int outlierThresh) const
+{
+	// Same valid area as the kernel
+	for (int y(std::max(rows.start, m_radius + 1)); y < std::min(rows.end, src.rows - m_radius); y++)
+	{
+		filterRow(src, guide, dst, y, outlierThresh);
+	}
+}
+
+void SparseBilateralFilter::filterRow(cv::Mat const & src, cv::Mat const & guide, cv::Mat & dst, 
+	int y, int outlierThresh) const
+{
+	const uchar * srcRow(src.ptr<uchar>(y)), * guideRow(guide.ptr<uchar>(y)),
+		* planarRow(&m_planar[size_t(y) * src.cols * 3]);
+	const int * ofs1(&m_ofs1[0]), * ofs3(&m_ofs3[0]), * ofsPlanar(&m_ofsPlanar[0]);
+	uchar * dstRow(dst.ptr<uchar>(y));
+	const float * spaceWeight(&m_spaceWeight[0]), * guideWeight(&m_guideWeight[0]);
+	const int size(getSize()), xEnd(src.cols - m_radius);
+
+	// Weighted mean, then outlier rejection
+	auto store = [&](int x, float sum, float wsum)
+	{
+		uchar filtered(uchar(sum / wsum));
+		if (outlierThresh < 0 || std::abs(int(filtered) - int(srcRow[x])) <= outlierThresh)
+			dstRow[x] = filtered;
+	};
+
+	// One centre, neighbours in the order of the kernel. 0 neighbours add 0 weights
+	auto filterPixel = [&](int x)
+	{
+		const uchar * centre(guideRow + 3 * x);
+		float sum(0.f), wsum(0.f);
+		for (int k(0); k < size; k++)
+		{
+			uchar value(srcRow[x + ofs1[k]]);
+			if (!value)
+				continue;
+			const uchar * neighbour(centre + ofs3[k]);
+			int diff(std::abs(neighbour[0] - centre[0]) + std::abs(neighbour[1] - centre[1]) 
+				+ std::abs(neighbour[2] - centre[2]));
+			float w(spaceWeight[k] * guideWeight[diff]);
+			sum += float(value) * w;
+			wsum += w;
+		}
+		store(x, sum, wsum);
+	};
+
+	int x(m_radius + 1);
+#if CV_SIMD128
+	// 16 centres at once. The sum of each centre runs over the neighbours in the same order 
+	// and with the same operations as the kernel
+	const cv::v_uint8x16 zero(cv::v_setall_u8(0));
+	const cv::v_float32x4 one(cv::v_setall_f32(1.f));
+	for (; x + 16 <= xEnd; x += 16)
+	{
+		int centreCount(0);
+		for (int i(0); i < 16; i++)
+		{
+			centreCount += srcRow[x + i] != 0;
+		}
+		// The neighbour weights are gathered one by one: few centres are faster alone
+		if (centreCount < m_minVectorCentres)
+		{
+			for (int i(0); i < 16; i++)
+			{
+				if (srcRow[x + i])
+					filterPixel(x + i);
+			}
+			continue;
+		}
+
+		const uchar * planarCentre(planarRow + x);
+		const cv::v_uint8x16 centreB(cv::v_load(planarCentre)), centreG(cv::v_load(planarCentre + src.cols)),
+			centreR(cv::v_load(planarCentre + 2 * src.cols));
+
+		cv::v_float32x4 sum[4], wsum[4];
+		for (int i(0); i < 4; i++)
+		{
+			sum[i] = cv::v_setall_f32(0.f);
+			wsum[i] = cv::v_setall_f32(0.f);
+		}
+
+		for (int k(0); k < size; k++)
+		{
+			const cv::v_uint8x16 neighbour(cv::v_load(srcRow + x + ofs1[k]));
+			// Only 0 weights to add
+			if (!cv::v_check_any(neighbour != zero))
+				continue;
+
+			// Colour difference between the centres and the neighbours
+			const uchar * planarNeighbour(planarCentre + ofsPlanar[k]);
+			cv::v_uint16x8 diff[2], diffHandle[2], value[2];
+			cv::v_expand(cv::v_absdiff(cv::v_load(planarNeighbour), centreB), diff[0], diff[1]);
+			cv::v_expand(cv::v_absdiff(cv::v_load(planarNeighbour + src.cols), centreG), 
+				diffHandle[0], diffHandle[1]);
+			diff[0] += diffHandle[0];
+			diff[1] += diffHandle[1];
+			cv::v_expand(cv::v_absdiff(cv::v_load(planarNeighbour + 2 * src.cols), centreR), 
+				diffHandle[0], diffHandle[1]);
+			diff[0] += diffHandle[0];
+			diff[1] += diffHandle[1];
+			cv::v_expand(neighbour, value[0], value[1]);
+			cv::v_uint32x4 diff32[4], value32[4];
+			for (int i(0); i < 2; i++)
+			{
+				cv::v_expand(diff[i], diff32[2 * i], diff32[2 * i + 1]);
+				cv::v_expand(value[i], value32[2 * i], value32[2 * i + 1]);
+			}
+
+			const cv::v_float32x4 weightSpace(cv::v_setall_f32(spaceWeight[k]));
+			for (int i(0); i < 4; i++)
+			{
+				cv::v_float32x4 v(cv::v_cvt_f32(cv::v_reinterpret_as_s32(value32[i])));
+				// (v != 0) * spaceWeight * guideWeight
+				cv::v_float32x4 w(cv::v_min(v, one) * weightSpace
+					* cv::v_lut(guideWeight, cv::v_reinterpret_as_s32(diff32[i])));
+				sum[i] += v * w;
+				wsum[i] += w;
+			}
+		}
+
+		float sumBuf[16], wsumBuf[16];
+		for (int i(0); i < 4; i++)
+		{
+			cv::v_store(sumBuf + 4 * i, sum[i]);
+			cv::v_store(wsumBuf + 4 * i, wsum[i]);
+		}
+		for (int i(0); i < 16; i++)
+		{
+			if (srcRow[x + i])
+				store(x + i, sumBuf[i], wsumBuf[i]);
+		}
+	}
+#endif
+	for (; x < xEnd; x++)
+	{
+		if (srcRow[x])
+			filterPixel(x);
+	}
+}
+
+size_t SparseBilateralFilter::getBytes() const
+{
+	return m_spaceWeight.capacity() * sizeof(float) + m_neighbours.capacity() * sizeof(cv::Point) 
+		+ m_guideWeight.capacity() * sizeof(float) 
+		+ (m_ofs1.capacity() + m_ofs3.capacity() + m_ofsPlanar.capacity()) * sizeof(int) + m_planar.capacity();
+}
@@ -0,0 +1,144 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#ifndef SPARSEBILATERALFILTER_H
+#define SPARSEBILATERALFILTER_H
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+/* @class SparseBilateralFilter
+@brief Bilateral filter for sparse disparity maps guided by a colour image.
+Holds the disk-shaped spatial weights shared by the OpenCL kernel of "bilateral_filter.cl" 
+and a multithreaded CPU implementation giving the same output.
+Pixels with a 0 disparity are ignored, both as centre and as neighbour.
+*/
+class SparseBilateralFilter
+{
+public:
+	SparseBilateralFilter() {}
+
+	/* @brief Build the spatial weights
+	@param radius radius of the disk-shaped window
+	@param sigmaSpace standard deviation of the spatial gaussian
+	@param sigmaGuide standard deviation of the colour gaussian, on the sum of absolute channel differences
+	*/
+	SparseBilateralFilter(int radius, float sigmaSpace, float sigmaGuide);
+
+	/* @brief Filter a sparse disparity map on the CPU, as the bilateralFilter OpenCL kernel
+	followed by outlier rejection
+	@param src sparse disparity map (CV_8UC1)
+	@param guide colour image with the same size (CV_8UC3)
+	@param dst filtered sparse disparity map (CV_8UC1)
+	@param outlierThresh pixels changed by more than this value are set to 0, negative to keep all pixels
+	*/
+	void run(cv::Mat const & src, cv::Mat const & guide, cv::Mat & dst, int outlierThresh = -1);
+
+	/* @brief Prepare the filtering of rows with filterRows: neighbour offsets and planar copy of the guide
+	@param src sparse disparity map (CV_8UC1)
+	@param guide colour image with the same size (CV_8UC3)
+	*/
+	void setGuide(cv::Mat const & src, cv::Mat const & guide);
+
+	/* @brief Filter some rows as run, after setGuide. Different rows can be filtered concurrently, 
+	e.g. to process each row while it is in cache. The rows within the radius of the border are left unchanged
+	@param src sparse disparity map of setGuide (CV_8UC1)
+	@param guide colour image of setGuide (CV_8UC3)
+	@param dst filtered sparse disparity map with the same size (CV_8UC1)
+	@param rows rows to filter
+	@param outlierThresh pixels changed by more than this value are set to 0, negative to keep all pixels
+	*/
+	void filterRows(cv::Mat const & src, cv::Mat const & guide, cv::Mat & dst, cv::Range rows, int outlierThresh = -1) const;
+
+	/* @brief Index offsets of the neighbours for the OpenCL kernel
+	@param step row step of the maps in elements
+	@param channels number of channels
+	@return offsets in the order of getSpaceWeights()
+	*/
+	std::vector<int> getOffsets(size_t step, int channels) const;
+
+	/* @brief Get the spatial weights of the neighbours */
+	inline std::vector<float> const & getSpaceWeights() const;
+
+	/* @brief Get the number of neighbours in the window */
+	inline int getSize() const;
+
+	/* @brief Get the radius of the window */
+	inline int getRadius() const;
+
+	/* @brief Get the coefficient c of the colour weight exp(c * diff^2) */
+	inline float getGuideCoeff() const;
+
+	/* @brief Get the bytes of the weights and of the buffers of the CPU implementation */
+	size_t getBytes() const;
+
+private:
+	/* Filter the row y */
+	void filterRow(cv::Mat const & src, cv::Mat const & guide, cv::Mat & dst, int y, int outlierThresh) const;
+
+	// Vectorised filtering of 16 centres is used when at least this many are not 0
+	static const int m_minVectorCentres = 8;
+
+	int m_radius = 0;
+	float m_guideCoeff = 0.f;
+	std::vector<float> m_spaceWeight; // Gaussian weights of the neighbours in the disk
+	std::vector<cv::Point> m_neighbours; // Positions of the neighbours relative to the centre
+	std::vector<float> m_guideWeight; // exp(m_guideCoeff * diff^2) for every colour difference
+
+	/// Current image
+	std::vector<int> m_ofs1, m_ofs3; // Neighbour offsets in the disparity map and the guide
+	std::vector<int> m_ofsPlanar; // Neighbour offsets in the planar guide
+	std::vector<uchar> m_planar; // Guide with each channel in separate rows
+};
+
+
+inline std::vector<float> const & SparseBilateralFilter::getSpaceWeights() const
+{
+	return m_spaceWeight;
+}
+
+inline int SparseBilateralFilter::getSize() const
+{
+	return int(m_spaceWeight.size());
+}
+
+inline int SparseBilateralFilter::getRadius() const
+{
+	return m_radius;
+}
+
+inline float SparseBilateralFilter::getGuideCoeff() const
+{
+	return m_guideCoeff;
+}
+#endif // SPARSEBILATERALFILTER_H
@@ -0,0 +1,150 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#include "stage_profiler.h"
+
+#include <algorithm>
+#include <fstream>
+
+StageProfiler::StageProfiler(int window, size_t maxEvents) :
+	m_window(size_t(std::max(1, window))),
+	m_maxEvents(maxEvents),
+	m_origin(cv::getTickCount())
+{
+}
+
+void StageProfiler::addValue(std::string const & series, double value)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	addValueLocked(series, value);
+}
+
+void StageProfiler::addValueLocked(std::string const & series, double value)
+{
+	Series & measures(m_series[series]);
+	if (measures.values.size() < m_window)
+	{
+		measures.values.push_back(value);
+	}
+	else
+	{
+		measures.values[measures.next] = value;
+		measures.next = (measures.next + 1) % m_window;
+	}
+	measures.last = value;
+}
+
+void StageProfiler::addEvent(std::string const & series, int64 start, int64 end, double bytes)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	addValueLocked(series, 1000. * double(end - start) / cv::getTickFrequency());
+	if (m_maxEvents == 0)
+		return;
+
+	std::thread::id threadId(std::this_thread::get_id());
+	if (!m_threads.count(threadId))
+	{
+		int index(int(m_threads.size()));
+		m_threads[threadId] = index;
+	}
+	if (m_events.size() == m_maxEvents)
+		m_events.pop_front();
+	Event event = { series, start, end, m_threads[threadId], bytes };
+	m_events.push_back(event);
+}
+
+StageProfiler::Stats StageProfiler::getStats(std::string const & series) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Stats stats;
+	std::map<std::string, Series>::const_iterator it(m_series.find(series));
+	if (it == m_series.end() || it->second.values.empty())
+		return stats;
+
+	std::vector<double> sorted(it->second.values);
+	std::sort(sorted.begin(), sorted.end());
+	stats.count = int(sorted.size());
+	stats.last = it->second.last;
+	for (size_t i(0); i < sorted.size(); i++)
+	{
+		stats.mean += sorted[i] / sorted.size();
+	}
+	// Nearest-rank percentiles: the smallest value with at least p% of the values at or below it, ceil(p / 100 * n) - 1
+	stats.p50 = sorted[(sorted.size() * 50 + 99) / 100 - 1];
+	stats.p90 = sorted[(sorted.size() * 90 + 99) / 100 - 1];
+	stats.p99 = sorted[(sorted.size() * 99 + 99) / 100 - 1];
+	stats.max = sorted.back();
+	return stats;
+}
+
+std::vector<std::string> StageProfiler::getSeriesNames() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::vector<std::string> names;
+	for (std::map<std::string, Series>::const_iterator it(m_series.begin()); it != m_series.end(); it++)
+	{
+		names.push_back(it->first);
+	}
+	return names;
+}
+
+bool StageProfiler::writeTrace(std::string const & file) const
+{
+	std::ofstream json(file);
+	if (!json.is_open())
+		return false;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	const double usPerTick(1e6 / cv::getTickFrequency());
+	json << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+	for (size_t i(0); i < m_events.size(); i++)
+	{
+		Event const & event(m_events[i]);
+		json << (i ? ",\n" : "\n") << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " 
+			<< event.thread << std::fixed << ", \"ts\": " << double(event.start - m_origin) * usPerTick 
+			<< ", \"dur\": " << double(event.end - event.start) * usPerTick;
+		if (event.bytes > 0.)
+			json << ", \"args\": {\"bytes\": " << event.bytes << "}";
+		json << "}";
+	}
+	json << "\n]}" << std::endl;
+	return json.good();
+}
+
+void StageProfiler::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_series.clear();
+	m_events.clear();
+	m_origin = cv::getTickCount();
+}
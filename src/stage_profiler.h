@@ -0,0 +1,128 @@
+/****************************************************************************
+- Codename: Single-shot Monocular RGB-D Imaging using Uneven Double Refraction (CVPR 2020)
+- author: Andreas Meuleman (ameuleman@vclab.kaist.ac.kr)
+- Institute: KAIST Visual Computing Laboratory
+@InProceedings{Meuleman_2020_CVPR,
+	author = {Andreas Meuleman and Seung-Hwan Baek and Felix Heide and Min H. Kim},
+	title = {Single-shot Monocular RGB-D Imaging using Uneven Double Refraction},
+	booktitle = {The IEEE Conference on Computer Vision and Pattern Recognition (CVPR)},
+	month = {June},
+	year = {2020}
+}
+
+Copyright (c) 2020 Andreas Meuleman
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*****************************************************************************/
+
+#ifndef STAGEPROFILER_H
+#define STAGEPROFILER_H
+
+#include <opencv2/core/core.hpp>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* @class StageProfiler
+@brief Thread-safe record of named measures (stage times, byte counts, pixel counts...) 
+over a rolling window, and of timed events for a Chrome trace / Perfetto dump.
+*/
+class StageProfiler
+{
+public:
+	/* Statistics of a series over the rolling window */
+	struct Stats
+	{
+		int count = 0; // Number of measures in the window
+		double last = 0., mean = 0., p50 = 0., p90 = 0., p99 = 0., max = 0.;
+	};
+
+	/* @brief Set the memory bounds
+	@param window number of measures kept per series
+	@param maxEvents number of trace events kept, the oldest are dropped
+	*/
+	StageProfiler(int window = 256, size_t maxEvents = 100000);
+
+	/* @brief Add a measure to a series
+	@param series name of the series
+	@param value measure
+	*/
+	void addValue(std::string const & series, double value);
+
+	/* @brief Add a timed event to the trace and its duration in ms to a series
+	@param series name of the series and of the event
+	@param start tick count at the beginning of the event (cv::getTickCount)
+	@param end tick count at the end of the event
+	@param bytes bytes read and written during the event, added to the trace arguments when positive
+	*/
+	void addEvent(std::string const & series, int64 start, int64 end, double bytes = -1.);
+
+	/* @brief Get the statistics of a series
+	@param series name of the series
+	@return statistics over the rolling window, count is 0 for an unknown series
+	*/
+	Stats getStats(std::string const & series) const;
+
+	/* @brief Get the names of all series
+	@return names in alphabetical order
+	*/
+	std::vector<std::string> getSeriesNames() const;
+
+	/* @brief Write the events in the Chrome trace event format, to be opened
+	in chrome://tracing or https://ui.perfetto.dev
+	@param file output json file
+	@return false if the file cannot be written
+	*/
+	bool writeTrace(std::string const & file) const;
+
+	/* @brief Remove all measures and events */
+	void clear();
+
+private:
+	/* Measures of a series in a ring buffer */
+	struct Series
+	{
+		std::vector<double> values;
+		size_t next = 0; // Position of the next measure once the window is full
+		double last = 0.;
+	};
+
+	/* Timed event of the trace */
+	struct Event
+	{
+		std::string name;
+		int64 start, end;
+		int thread; // Small thread index
+		double bytes;
+	};
+
+	/* Add a measure, with the mutex locked */
+	void addValueLocked(std::string const & series, double value);
+
+	size_t m_window, m_maxEvents;
+	int64 m_origin; // Time origin of the trace
+	mutable std::mutex m_mutex;
+	std::map<std::string, Series> m_series;
+	std::deque<Event> m_events;
+	std::map<std::thread::id, int> m_threads; // Thread indices in the trace
+};
+#endif // STAGEPROFILER_H